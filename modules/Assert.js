@@ -71,4 +71,4 @@ function Assert() {
     return assert;
 };
 
-module.exports.Assert = new Assert();
+module.exports = new Assert();
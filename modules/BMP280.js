@@ -30,26 +30,14 @@ function BMP280() {
     var dig_T2;
     var dig_T3;
 
-    function uint16toInt16(value) {
-        if ((value & 0x8000) > 0) {
-            value = value - 0x10000;
-        }
-        return value;
-    }
-
     bmp280API.readCoefficients = function() {
         // These need to be read as a burst read in order to get accurate numbers,
         // so dig_TAll contains dig_T1 through dig_T3
         var dig_TAll = this.i2cDevice.burstRead(this.bmp280Addrs.ADDRESS, 24,
                                                 this.bmp280Addrs.REGISTER_DIG_T1);
         dig_T1 = dig_TAll.readUInt16LE();
-        dig_T2 = dig_TAll.readUInt16LE(2);
-        dig_T3 = dig_TAll.readUInt16LE(4);
-
-        // Convert these to signed
-        dig_T1 = uint16toInt16(dig_T1);
-        dig_T2 = uint16toInt16(dig_T2);
-        dig_T3 = uint16toInt16(dig_T3);
+        dig_T2 = dig_TAll.readInt16LE(2);
+        dig_T3 = dig_TAll.readInt16LE(4);
     }
 
     bmp280API.readTemperature = function() {
@@ -77,4 +65,4 @@ function BMP280() {
     return bmp280API;
 };
 
-module.exports.BMP280 = new BMP280();
+module.exports = new BMP280();
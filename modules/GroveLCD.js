@@ -150,4 +150,4 @@ function GroveLCD() {
     return groveLCDAPI;
 };
 
-module.exports.GroveLCD = new GroveLCD();
+module.exports = new GroveLCD();
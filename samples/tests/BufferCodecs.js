@@ -0,0 +1,45 @@
+// Copyright (c) 2016, Intel Corporation.
+
+// Buffer codec benchmark for jslinux: reports the throughput in MB/s of
+// toString() and Buffer.from() for each encoding, over a 32KB buffer.
+var performance = require('performance');
+
+var SIZE = 32 * 1024;
+var ROUNDS = 20;
+var encodings = ['utf8', 'ascii', 'hex', 'base64'];
+
+// mostly ASCII text with some two and three byte UTF-8 characters mixed in
+var text = new Buffer(SIZE);
+text.fill('The quick brown fox jumps over the lazy dog. é€ ');
+var binary = new Buffer(SIZE);
+for (var i = 0; i < SIZE; i++) {
+    binary.writeUInt8((i * 7919) & 0xff, i);
+}
+
+function rate(bytes, ms) {
+    return (bytes * ROUNDS / (ms / 1000) / (1024 * 1024)).toFixed(1);
+}
+
+for (var e = 0; e < encodings.length; e++) {
+    var encoding = encodings[e];
+    var buf = encoding === 'utf8' || encoding === 'ascii' ? text : binary;
+
+    var start = performance.now();
+    var str;
+    for (var r = 0; r < ROUNDS; r++) {
+        str = buf.toString(encoding);
+    }
+    var encodeMs = performance.now() - start;
+
+    start = performance.now();
+    var decoded;
+    for (var r = 0; r < ROUNDS; r++) {
+        decoded = Buffer.from(str, encoding);
+    }
+    var decodeMs = performance.now() - start;
+
+    console.log(encoding + ": toString " + rate(SIZE, encodeMs) +
+                " MB/s, Buffer.from " + rate(SIZE, decodeMs) + " MB/s" +
+                (encoding === 'ascii' || decoded.equals(buf) ? "" :
+                 " (round trip MISMATCH)"));
+}
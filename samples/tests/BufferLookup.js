@@ -0,0 +1,27 @@
+// Copyright (c) 2016, Intel Corporation.
+
+// Buffer lookup benchmark for jslinux: times readUInt8() while more and more
+// Buffers are alive. Finding a Buffer's memory should not depend on how many
+// other Buffers exist, so the cost per read should stay flat.
+var performance = require('performance');
+
+var READS = 100000;
+var counts = [10, 100, 1000, 10000];
+
+var live = [];
+var buf = new Buffer(16);
+buf.writeUInt8(42, 0);
+
+for (var c = 0; c < counts.length; c++) {
+    while (live.length < counts[c]) {
+        live.push(new Buffer(8));
+    }
+
+    var start = performance.now();
+    for (var i = 0; i < READS; i++) {
+        buf.readUInt8(i & 15);
+    }
+    var elapsed = performance.now() - start;
+    console.log(counts[c] + " live buffers: " +
+                (elapsed * 1000000 / READS).toFixed(0) + " ns/readUInt8");
+}
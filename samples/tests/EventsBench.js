@@ -0,0 +1,44 @@
+// Copyright (c) 2016, Intel Corporation.
+
+// Event emitter benchmark for jslinux: emits events in batches of 1,000 to an
+// emitter with a few registered event names and reports how many emits per
+// second are queued and delivered to the listeners.
+var EventEmitter = require('events');
+var performance = require('performance');
+
+var BATCH = 1000;
+var DURATION = 5000;
+
+var emitter = new EventEmitter();
+var received = 0;
+function listener(value) {
+    received++;
+}
+
+// several names so lookups have to tell them apart
+var names = ['data', 'end', 'error', 'close', 'change', 'reading'];
+for (var i = 0; i < names.length; i++) {
+    emitter.on(names[i], listener);
+}
+
+var emitted = 0;
+var start = performance.now();
+
+function batch() {
+    for (var i = 0; i < BATCH; i++) {
+        emitter.emit('reading', i);
+    }
+    emitted += BATCH;
+    if (performance.now() - start < DURATION) {
+        // listeners run before this, they were queued first
+        setImmediate(batch);
+        return;
+    }
+    setImmediate(function () {
+        var elapsed = (performance.now() - start) / 1000;
+        console.log("emitted " + emitted + ", received " + received);
+        console.log("events: " + Math.round(received / elapsed) + " emits/s");
+    });
+}
+
+batch();
@@ -0,0 +1,8 @@
+// Copyright (c) 2016, Intel Corporation.
+
+// Mostly idle script for measuring main loop wakeups, see scripts/loopbench.
+// The only work is a single timer once per second.
+var ticks = 0;
+setInterval(function () {
+    ticks++;
+}, 1000);
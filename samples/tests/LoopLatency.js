@@ -0,0 +1,32 @@
+// Copyright (c) 2016, Intel Corporation.
+
+// Measures how late timer callbacks are dispatched relative to their deadline,
+// which includes the time from the timer being signaled to the callback being
+// serviced by the main loop. See scripts/loopbench.
+var performance = require("performance");
+
+var samples = 200;
+var count = 0;
+var total = 0;
+var max = 0;
+
+function schedule() {
+    // vary the delay so deadlines don't line up with any fixed loop tick
+    var delay = 1 + (count % 7);
+    var expected = performance.now() + delay;
+    setTimeout(function () {
+        var late = performance.now() - expected;
+        total += late;
+        if (late > max)
+            max = late;
+        count++;
+        if (count < samples) {
+            schedule();
+        } else {
+            console.log("timer dispatch latency: avg " + (total / samples) +
+                        " ms, max " + max + " ms over " + samples + " samples");
+        }
+    }, delay);
+}
+
+schedule();
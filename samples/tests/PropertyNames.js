@@ -0,0 +1,31 @@
+// Copyright (c) 2016, Intel Corporation.
+
+// Property name benchmark for jslinux: loopstats.timers() and loopstats.get()
+// build their result objects with the zjs_obj_add_* helpers, so calling them
+// in a loop measures how fast native code can set named properties. Compare
+// the rates before and after changes to the property name cache.
+var loopstats = require('loopstats');
+var performance = require('performance');
+
+var ITERATIONS = 100000;
+
+// give loopstats.get() a few callbacks to report
+for (var i = 0; i < 4; i++) {
+    setInterval(function () {}, 1000);
+}
+
+function measure(label, func) {
+    var start = performance.now();
+    for (var i = 0; i < ITERATIONS; i++) {
+        func();
+    }
+    var elapsed = (performance.now() - start) / 1000;
+    console.log(label + ": " + Math.round(ITERATIONS / elapsed) + " calls/s");
+}
+
+measure("loopstats.timers()", function () {
+    loopstats.timers();
+});
+measure("loopstats.get()", function () {
+    loopstats.get();
+});
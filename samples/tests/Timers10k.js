@@ -0,0 +1,42 @@
+// Copyright (c) 2016, Intel Corporation.
+
+// Timer scheduler benchmark for jslinux: creates 10,000 intervals spread over
+// a few seconds, then measures how many fire per second and how late a 10 ms
+// probe interval runs while the main loop is busy with all of them. Run it with
+// jslinux --virtual-time to measure the scheduler without wall-clock noise.
+var performance = require("performance");
+
+var NUM_TIMERS = 10000;
+var DURATION = 10000;
+
+var fired = 0;
+function tick() {
+    fired++;
+}
+
+var start = performance.now();
+for (var i = 0; i < NUM_TIMERS; i++) {
+    // intervals between 2 and 6 seconds so expirations are spread out
+    setInterval(tick, 2000 + (i * 7919) % 4000);
+}
+console.log("created " + NUM_TIMERS + " intervals in " +
+            (performance.now() - start) + " ms");
+
+var probes = 0;
+var lateness = 0;
+var expected = performance.now() + 10;
+var probe = setInterval(function () {
+    var now = performance.now();
+    lateness += now - expected;
+    expected = now + 10;
+    probes++;
+}, 10);
+
+start = performance.now();
+setTimeout(function () {
+    var elapsed = (performance.now() - start) / 1000;
+    clearInterval(probe);
+    console.log("timer callbacks: " + (fired / elapsed) + "/s");
+    console.log("probe interval lateness: avg " + (lateness / probes) +
+                " ms over " + probes + " samples");
+}, DURATION);
@@ -37,14 +37,16 @@ echo $tmpstr > zjs.conf.tmp
 
 function check_for_js_require()
 {
+    # effects: analyzes the JS modules the script requires, directly or
+    #            through other modules, along with the script; the modules
+    #            themselves are built in separately by genjsmodules
 
-    js_files=$(grep "require *( *['\"].*\.js['\"] *)" $SCRIPT | grep -o "['\"].*\.js['\"]" | tr -d \'\")
+    js_files=$($ZJS_BASE/scripts/genjsmodules --list $SCRIPT)
 
     for file in $js_files
     do
-         >&2 echo "Javascript module included : $file"
-         # Add the module JS to the temporary JS file
-         cat "$ZJS_BASE/modules/$file" >> /tmp/zjs.js
+         >&2 echo "Javascript module included : $(basename $file)"
+         cat "$file" >> /tmp/zjs.js
     done
 
     # Add the primary JS file to the temporary JS file
@@ -124,6 +126,12 @@ if check_for_require performance || check_config_file ZJS_PERFORMANCE; then
     echo "export ZJS_PERFORMANCE=y" >> zjs.conf.tmp
 fi
 
+if check_for_require loopstats || check_config_file ZJS_LOOPSTATS; then
+    >&2 echo Using module: Loopstats
+    MODULES+=" -DBUILD_MODULE_LOOPSTATS"
+    echo "export ZJS_LOOPSTATS=y" >> zjs.conf.tmp
+fi
+
 if check_for_require pwm || check_config_file ZJS_PWM; then
     >&2 echo Using module: PWM
     MODULES+=" -DBUILD_MODULE_PWM"
@@ -37,6 +37,7 @@
 #include "../zjs_buffer.h"
 #include "../zjs_callbacks.h"
 #include "../zjs_modules.h"
+#include "../zjs_promise.h"
 #include "../zjs_ipm.h"
 #include "../zjs_sensor.h"
 #include "../zjs_timers.h"
@@ -139,6 +140,7 @@ void restore_zjs_api() {
 #endif
 #endif
     jerry_init(JERRY_INIT_EMPTY);
+    zjs_init_names();
     zjs_timers_init();
 #ifdef BUILD_MODULE_CONSOLE
     zjs_console_init();
@@ -149,6 +151,7 @@ void restore_zjs_api() {
 #ifdef BUILD_MODULE_SENSOR
     zjs_sensor_init();
 #endif
+    zjs_promise_init();
     zjs_init_callbacks();
     zjs_modules_init();
 }
@@ -171,7 +174,9 @@ void javascript_stop()
 #ifdef BUILD_MODULE_SENSOR
     zjs_sensor_cleanup();
 #endif
+    zjs_promise_cleanup();
     zjs_modules_cleanup();
+    zjs_cleanup_names();
     jerry_cleanup();
 
     restore_zjs_api();
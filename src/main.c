@@ -5,6 +5,7 @@
 #include "zjs_zephyr_port.h"
 #else
 #include "zjs_linux_port.h"
+#include <signal.h>
 #endif // ZJS_LINUX_BUILD
 #include <string.h>
 #include "zjs_script.h"
@@ -18,7 +19,11 @@
 #include "zjs_common.h"
 #include "zjs_console.h"
 #include "zjs_event.h"
+#ifdef BUILD_MODULE_LOOPSTATS
+#include "zjs_loopstats.h"
+#endif
 #include "zjs_modules.h"
+#include "zjs_promise.h"
 #ifdef BUILD_MODULE_SENSOR
 #include "zjs_sensor.h"
 #endif
@@ -71,6 +76,70 @@ static jerry_value_t native_print_handler(const jerry_value_t function_obj,
     return ZJS_UNDEFINED;
 }
 
+#if defined(ZJS_LINUX_BUILD) && !defined(ZJS_SNAPSHOT_BUILD)
+static uint64_t real_time_us(void)
+{
+    // effects: returns the monotonic time in us, even with --virtual-time
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+#endif
+
+#if defined(ZJS_LINUX_BUILD) && !defined(ZJS_SNAPSHOT_BUILD)
+static int exit_requested = 0;
+static sigset_t exit_signals;
+
+static void *exit_signal_thread(void *arg)
+{
+    int sig;
+    if (!sigwait(&exit_signals, &sig)) {
+        // JerryScript belongs to the main loop, so have it clean up
+        __atomic_store_n(&exit_requested, 1, __ATOMIC_RELEASE);
+        zjs_loop_unblock();
+    }
+    return NULL;
+}
+
+static bool exit_cleanly(void)
+{
+    // requires: called from the main loop, between passes
+    //  effects: if an exit signal came in, releases everything that holds JS
+    //             values, cleans up JavaScript and returns true
+    if (!__atomic_load_n(&exit_requested, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    // jerry_cleanup() prints the heap stats, if JerryScript was built with
+    //   --mem-stats=on, so nothing may hold on to a JS value by then
+    zjs_timers_cleanup();
+    zjs_callbacks_cleanup();
+#ifdef BUILD_MODULE_BUFFER
+    zjs_buffer_cleanup();
+#endif
+    zjs_promise_cleanup();
+    zjs_modules_cleanup();
+    zjs_cleanup_names();
+    jerry_cleanup();
+    return true;
+}
+
+static void watch_exit_signals(void)
+{
+    // requires: called before any other threads are created
+    //  effects: on SIGTERM or SIGINT, cleans up JerryScript and exits
+    pthread_t thread;
+    sigemptyset(&exit_signals);
+    sigaddset(&exit_signals, SIGTERM);
+    sigaddset(&exit_signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &exit_signals, NULL);
+    if (pthread_create(&thread, NULL, exit_signal_thread, NULL)) {
+        ERR_PRINT("could not create exit signal thread\n");
+        return;
+    }
+    pthread_detach(thread);
+}
+#endif
+
 #ifndef ZJS_LINUX_BUILD
 void main(void)
 #else
@@ -81,6 +150,12 @@ int main(int argc, char *argv[])
     const char *script = NULL;
     jerry_value_t code_eval;
     uint32_t len;
+#endif
+#if defined(ZJS_LINUX_BUILD) && !defined(ZJS_SNAPSHOT_BUILD)
+    bool run_snapshot = false;
+    bool print_times = false;
+    char *compile_file = NULL;
+    const uint32_t *snapshot = NULL;
 #endif
     jerry_value_t result;
 
@@ -95,7 +170,21 @@ int main(int argc, char *argv[])
 #endif
 #endif
 
+#if defined(ZJS_LINUX_BUILD) && !defined(ZJS_SNAPSHOT_BUILD)
+    // JerryScript has to know about --mem-stats before it starts
+    jerry_init_flag_t jerry_flags = JERRY_INIT_EMPTY;
+    for (int i = 1; i < argc && !strncmp(argv[i], "--", 2); ++i) {
+        if (!strcmp(argv[i], "--mem-stats")) {
+            jerry_flags |= JERRY_INIT_MEM_STATS;
+        } else if (!strcmp(argv[i], "--compile")) {
+            ++i;
+        }
+    }
+    jerry_init(jerry_flags);
+#else
     jerry_init(JERRY_INIT_EMPTY);
+#endif
+    zjs_init_names();
 
     zjs_timers_init();
 #ifdef BUILD_MODULE_CONSOLE
@@ -107,15 +196,16 @@ int main(int argc, char *argv[])
 #ifdef BUILD_MODULE_SENSOR
     zjs_sensor_init();
 #endif
+    zjs_promise_init();
     zjs_init_callbacks();
+#if defined(ZJS_LINUX_BUILD) && !defined(ZJS_SNAPSHOT_BUILD)
+    if (jerry_flags & JERRY_INIT_MEM_STATS) {
+        // the stats are printed on exit, so exit cleanly when killed
+        watch_exit_signals();
+    }
+#endif
 
-    // Add module.exports to global namespace
     jerry_value_t global_obj = jerry_get_global_object();
-    jerry_value_t modules_obj = jerry_create_object();
-    jerry_value_t exports_obj = jerry_create_object();
-
-    zjs_set_property(modules_obj, "exports", exports_obj);
-    zjs_set_property(global_obj, "module", modules_obj);
 
     // initialize modules
     zjs_modules_init();
@@ -123,19 +213,55 @@ int main(int argc, char *argv[])
 #ifdef BUILD_MODULE_OCF
     zjs_register_service_routine(NULL, main_poll_routine);
 #endif
+#if defined(ZJS_LINUX_BUILD) && defined(BUILD_MODULE_LOOPSTATS)
+    // kill -USR1 dumps callback latency and run time stats
+    zjs_loopstats_watch_signal();
+#endif
 
 #ifndef ZJS_SNAPSHOT_BUILD
 #ifdef ZJS_LINUX_BUILD
-    if (argc > 1) {
-        if (!strncmp(argv[1], "--unittest", 10)) {
+    // options come before the script file
+    int arg = 1;
+    for (; arg < argc && !strncmp(argv[arg], "--", 2); ++arg) {
+        if (!strcmp(argv[arg], "--unittest")) {
             // run unit tests
             zjs_run_unit_tests();
+        } else if (!strcmp(argv[arg], "--virtual-time")) {
+            // timers fire as soon as the loop is idle, on a virtual clock
+            zjs_port_enable_virtual_time();
+        } else if (!strcmp(argv[arg], "--snapshot")) {
+            // the file is a snapshot made with --compile, run it in place
+            run_snapshot = true;
+        } else if (!strcmp(argv[arg], "--compile") && arg + 1 < argc) {
+            // save a snapshot of the script in the given file and exit
+            compile_file = argv[++arg];
+        } else if (!strcmp(argv[arg], "--time")) {
+            // print how long the script took to parse and run at startup
+            print_times = true;
+        } else if (!strcmp(argv[arg], "--mem-stats")) {
+            // handled before jerry_init() above
+        } else {
+            ERR_PRINT("unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+    if (compile_file && (run_snapshot || arg >= argc)) {
+        ERR_PRINT("--compile needs a script file\n");
+        return -1;
+    }
+    if (run_snapshot && arg >= argc) {
+        ERR_PRINT("--snapshot needs a snapshot file\n");
+        return -1;
+    }
+    if (arg < argc && run_snapshot) {
+        if (zjs_map_snapshot(argv[arg], &snapshot, &len)) {
+            ERR_PRINT("could not map snapshot file %s\n", argv[arg]);
+            return -1;
         }
-        else {
-            if (zjs_read_script(argv[1], &script, &len)) {
-                ERR_PRINT("could not read script file %s\n", argv[1]);
-                return -1;
-            }
+    } else if (arg < argc) {
+        if (zjs_read_script(argv[arg], &script, &len)) {
+            ERR_PRINT("could not read script file %s\n", argv[arg]);
+            return -1;
         }
     } else
     // slightly tricky: reuse next section as else clause
@@ -155,26 +281,47 @@ int main(int argc, char *argv[])
     zjs_obj_add_function(global_obj, native_eval_handler, "eval");
     zjs_obj_add_function(global_obj, native_print_handler, "print");
 
-#ifndef ZJS_SNAPSHOT_BUILD
-    code_eval = jerry_parse((jerry_char_t *)script, len, false);
-    if (jerry_value_has_error_flag(code_eval)) {
-        ZJS_PRINT("JerryScript: cannot parse javascript\n");
-        goto error;
-    }
-#endif
-
-#ifdef ZJS_LINUX_BUILD
-    if (argc > 1) {
+#if defined(ZJS_LINUX_BUILD) && !defined(ZJS_SNAPSHOT_BUILD)
+    if (compile_file) {
+        uint32_t size;
+        uint64_t start = real_time_us();
+        uint8_t rval = zjs_compile_script(script, len, compile_file, &size);
+        if (!rval) {
+            ZJS_PRINT("%s: source code %u bytes, byte code %u bytes, "
+                      "compiled in %u us\n", compile_file, len, size,
+                      (uint32_t)(real_time_us() - start));
+        }
         zjs_free_script(script);
+        return rval;
     }
-#endif
 
+    uint64_t start = real_time_us();
+    uint64_t parsed = start;
+    if (snapshot) {
+        result = jerry_exec_snapshot(snapshot, len, false);
+    } else
+#endif
 #ifdef ZJS_SNAPSHOT_BUILD
     result = jerry_exec_snapshot(snapshot_bytecode,
                                  snapshot_len,
                                  false);
 #else
-    result = jerry_run(code_eval);
+    {
+        code_eval = jerry_parse((jerry_char_t *)script, len, false);
+        if (jerry_value_has_error_flag(code_eval)) {
+            ZJS_PRINT("JerryScript: cannot parse javascript\n");
+            goto error;
+        }
+#ifdef ZJS_LINUX_BUILD
+        parsed = real_time_us();
+        if (arg < argc) {
+            zjs_free_script(script);
+        }
+#endif
+
+        result = jerry_run(code_eval);
+        jerry_release_value(code_eval);
+    }
 #endif
 
     if (jerry_value_has_error_flag(result)) {
@@ -182,12 +329,16 @@ int main(int argc, char *argv[])
         goto error;
     }
 
-#ifndef ZJS_SNAPSHOT_BUILD
-    jerry_release_value(code_eval);
+#if defined(ZJS_LINUX_BUILD) && !defined(ZJS_SNAPSHOT_BUILD)
+    if (print_times) {
+        uint64_t end = real_time_us();
+        ZJS_PRINT("%s: parse %u us, run %u us\n",
+                  snapshot ? "snapshot" : "script",
+                  (uint32_t)(parsed - start), (uint32_t)(end - parsed));
+    }
 #endif
+
     jerry_release_value(global_obj);
-    jerry_release_value(modules_obj);
-    jerry_release_value(exports_obj);
     jerry_release_value(result);
 
 #ifndef ZJS_LINUX_BUILD
@@ -199,12 +350,21 @@ int main(int argc, char *argv[])
 #endif // ZJS_LINUX_BUILD
 
     while (1) {
-        zjs_timers_process_events();
+        int32_t wait = zjs_timers_process_events();
         zjs_service_callbacks();
-        zjs_service_routines();
-        // not sure if this is okay, but it seems better to sleep than
-        //   busy wait
-        zjs_sleep(1);
+        int32_t poll = zjs_service_routines();
+        if (poll != ZJS_TICKS_FOREVER &&
+            (wait == ZJS_TICKS_FOREVER || poll < wait)) {
+            wait = poll;
+        }
+        // sleep until the next timer or poll deadline; signaling a callback
+        //   wakes us early
+        zjs_loop_block(wait);
+#if defined(ZJS_LINUX_BUILD) && !defined(ZJS_SNAPSHOT_BUILD)
+        if (exit_cleanly()) {
+            return 0;
+        }
+#endif
     }
 
 error:
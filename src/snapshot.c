@@ -8,81 +8,136 @@
 #define SNAPSHOT_BUFFER_SIZE 51200
 #define SNAPSHOT_SOURCE_FILE "src/zjs_snapshot_gen.c"
 
+// must match the wrapper in src/zjs_modules.c
+#define JS_MODULE_PREFIX    "(function (exports, require, module) {"
+#define JS_MODULE_SUFFIX    "\n})"
+
 static uint8_t snapshot_buf[SNAPSHOT_BUFFER_SIZE];
 
-static int generate_snapshot(const char *file_name, uint8_t *buf, int buf_size)
+static void write_array(FILE *f, const char *decl, uint8_t *buf, int buf_size)
 {
-    // create or overwite the existing the src file that
-    // initialize the array to stores the byte code
-    // to be executed by jerryscript
-    FILE* f = fopen(file_name, "w+");
-    if (!f) {
-        ERR_PRINT("error opening file\n");
-        return 1;
-    }
-
-    fwrite("/* This file was auto-generated */\n\n", 1, 36, f);
-    fwrite("#include \"zjs_common.h\"\n\n", 1, 25, f);
-    fwrite("const uint8_t snapshot_bytecode[] = {\n", 1, 38, f);
-
+    // effects: writes buf to f as a C byte array, declared by decl
+    fprintf(f, "%s[] = {\n", decl);
     for (int i = 0; i < buf_size; i++)
     {
         if (i > 0) {
             fwrite(",", 1, 1, f);
         }
         char byte[5];
-        snprintf(byte, 5, "0x%02x", snapshot_buf[i]);
+        snprintf(byte, 5, "0x%02x", buf[i]);
         fwrite(byte, 1, 4, f);
         DBG_PRINT("%s,", byte);
     }
-
     fwrite("\n};\n\n", 1, 5, f);
-    fwrite("const int snapshot_len = sizeof(snapshot_bytecode) / ", 1, 53, f);
-    fwrite("sizeof(snapshot_bytecode[0]);\n", 1, 30, f);
-    fclose(f);
-
-    return 0;
 }
 
-int main(int argc, char *argv[])
+static size_t save_snapshot(const char *file_name, bool module)
 {
+    // effects: parses file_name into snapshot_buf, wrapped as a module if
+    //            module is true; returns the snapshot size, or 0 on error
     const char *script = NULL;
     uint32_t len;
-
-    jerry_init(JERRY_INIT_EMPTY);
-
-    if (argc <= 1) {
-        ERR_PRINT("missing script file\n");
-        return 1;
+    if (zjs_read_script((char *)file_name, &script, &len)) {
+        ERR_PRINT("could not read script file %s\n", file_name);
+        return 0;
     }
 
-    if (zjs_read_script(argv[1], &script, &len)) {
-        ERR_PRINT("could not read script file %s\n", argv[1]);
-        return 1;
+    const char *source = script;
+    if (module) {
+        uint32_t prefix = sizeof(JS_MODULE_PREFIX) - 1;
+        uint32_t suffix = sizeof(JS_MODULE_SUFFIX) - 1;
+        char *wrapped = zjs_malloc(prefix + len + suffix);
+        if (!wrapped) {
+            ERR_PRINT("error allocating %u bytes\n", prefix + len + suffix);
+            zjs_free_script(script);
+            return 0;
+        }
+        memcpy(wrapped, JS_MODULE_PREFIX, prefix);
+        memcpy(wrapped + prefix, script, len);
+        memcpy(wrapped + prefix + len, JS_MODULE_SUFFIX, suffix);
+        source = wrapped;
+        len += prefix + suffix;
     }
 
-    size_t size = jerry_parse_and_save_snapshot((jerry_char_t *)script,
-                                                strlen(script),
+    size_t size = jerry_parse_and_save_snapshot((jerry_char_t *)source,
+                                                len,
                                                 true,
                                                 false,
                                                 snapshot_buf,
                                                 sizeof(snapshot_buf));
-
+    if (module) {
+        zjs_free(source);
+    }
     zjs_free_script(script);
 
     if (size == 0) {
-        ERR_PRINT("JerryScript: failed to parse JS and create snapshot\n");
+        ERR_PRINT("JerryScript: failed to parse %s and create snapshot\n",
+                  file_name);
+    } else {
+        ZJS_PRINT("%s: source code %u bytes, byte code %u bytes\n", file_name,
+                  len, (uint32_t)size);
+    }
+    return size;
+}
+
+// usage: snapshot <script.js> [output.c [module.js ...]]
+//   stores the snapshot of the script, and one for each JS module it
+//   requires, in output.c
+int main(int argc, char *argv[])
+{
+    jerry_init(JERRY_INIT_EMPTY);
+
+    if (argc <= 1) {
+        ERR_PRINT("missing script file\n");
         return 1;
     }
+    const char *output = argc > 2 ? argv[2] : SNAPSHOT_SOURCE_FILE;
 
-    // store the snapshot as byte array in header
-    if (generate_snapshot(SNAPSHOT_SOURCE_FILE, snapshot_buf, size) != 0) {
-        ERR_PRINT("failed to generate %s\n", SNAPSHOT_SOURCE_FILE);
+    // create or overwite the existing the src file that
+    // initialize the array to stores the byte code
+    // to be executed by jerryscript
+    FILE* f = fopen(output, "w+");
+    if (!f) {
+        ERR_PRINT("error opening file %s\n", output);
+        return 1;
+    }
+
+    fwrite("/* This file was auto-generated */\n\n", 1, 36, f);
+    fwrite("#include \"zjs_common.h\"\n", 1, 24, f);
+    fwrite("#include \"zjs_modules.h\"\n\n", 1, 26, f);
+
+    size_t size = save_snapshot(argv[1], false);
+    if (size == 0) {
+        fclose(f);
         return 1;
     }
+    write_array(f, "const uint8_t snapshot_bytecode", snapshot_buf, size);
+    fwrite("const int snapshot_len = sizeof(snapshot_bytecode) / ", 1, 53, f);
+    fwrite("sizeof(snapshot_bytecode[0]);\n\n", 1, 31, f);
+
+    // JS modules are executed in place, so keep them aligned like the heap
+    for (int i = 3; i < argc; i++) {
+        size = save_snapshot(argv[i], true);
+        if (size == 0) {
+            fclose(f);
+            return 1;
+        }
+        char decl[64];
+        snprintf(decl, sizeof(decl),
+                 "static const uint8_t __attribute__((aligned(8))) "
+                 "js_module_%d", i - 3);
+        write_array(f, decl, snapshot_buf, size);
+    }
 
-    ZJS_PRINT("Source code %lu bytes\n", len);
-    ZJS_PRINT("Byte code %d bytes\n", size);
+    fwrite("const zjs_js_module_t zjs_js_modules[] = {\n", 1, 43, f);
+    for (int i = 3; i < argc; i++) {
+        const char *name = strrchr(argv[i], '/');
+        name = name ? name + 1 : argv[i];
+        fprintf(f, "    { \"%s\", js_module_%d, sizeof(js_module_%d) },\n",
+                name, i - 3, i - 3);
+    }
+    fwrite("    { NULL, NULL, 0 }\n};\n", 1, 25, f);
+    fclose(f);
 
     return 0;
 }
@@ -252,6 +252,7 @@ static jerry_value_t zjs_aio_pin_on(const jerry_value_t function_obj,
         handle->pin_obj = this;
         jerry_set_object_native_handle(this, (uintptr_t)handle, zjs_aio_free_cb);
         handle->callback_id = zjs_add_callback(argv[1], this, handle, NULL);
+        zjs_set_callback_priority(handle->callback_id, ZJS_PRIORITY_ISR);
         zjs_aio_ipm_send_async(TYPE_AIO_PIN_SUBSCRIBE, pin, handle);
     }
 
@@ -277,6 +278,7 @@ static jerry_value_t zjs_aio_pin_read_async(const jerry_value_t function_obj,
 
     handle->pin_obj = this;
     handle->callback_id = zjs_add_callback(argv[0], this, handle, zjs_aio_free_callback);
+    zjs_set_callback_priority(handle->callback_id, ZJS_PRIORITY_ISR);
 
     jerry_set_object_native_handle(this, (uintptr_t)handle, zjs_aio_free_cb);
 
@@ -5,6 +5,8 @@
 #include <zephyr.h>
 #endif
 
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
 // JerryScript includes
@@ -14,197 +16,760 @@
 #include "zjs_util.h"
 #include "zjs_buffer.h"
 
-static zjs_buffer_t *zjs_buffers = NULL;
 static jerry_value_t zjs_buffer_prototype;
 
-// TODO: this could probably be replaced more efficiently now that there is a
-//   get_native_handle API
+// Memory shared by a Buffer and any views sliced from it, allocated in one
+//   block with the struct of the Buffer that created it
+struct zjs_buffer_store {
+    uint32_t refs;      // Buffer objects using this store
+    zjs_buffer_t owner; // the Buffer that created it, covering all the data
+    uint8_t data[];
+};
+
+// Pooled blocks are carved from slabs that are never freed, like callback
+//   records, and linked through their first word while free
+struct zjs_buffer_pool {
+    void *free;
+    uint8_t *slabs[ZJS_BUFFER_MAX_SLABS];
+    uint8_t slab_count;
+};
+
+static const uint16_t pool_sizes[ZJS_BUFFER_POOL_CLASSES] = {
+    16, 32, 64, 128, 256
+};
+static struct zjs_buffer_pool pools[ZJS_BUFFER_POOL_CLASSES];
+static struct zjs_buffer_pool_stats pool_stats[ZJS_BUFFER_POOL_CLASSES + 1];
+
+static int zjs_buffer_pool_class(uint32_t size)
+{
+    // effects: returns the smallest size class that fits size bytes, or
+    //            ZJS_BUFFER_POOL_CLASSES if none does
+    int i;
+    for (i = 0; i < ZJS_BUFFER_POOL_CLASSES; i++) {
+        if (size <= pool_sizes[i])
+            break;
+    }
+    return i;
+}
+
+static bool zjs_buffer_pool_refill(int cls)
+{
+    // requires: cls is a size class with no free blocks
+    //  effects: allocates a slab of blocks for the class; returns false if
+    //             it has all its slabs or the heap is out of memory
+    struct zjs_buffer_pool *pool = &pools[cls];
+    if (pool->slab_count >= ZJS_BUFFER_MAX_SLABS)
+        return false;
+
+    uint32_t size = pool_sizes[cls];
+    uint8_t *slab = zjs_malloc(size * ZJS_BUFFER_SLAB_BLOCKS);
+    if (!slab)
+        return false;
+
+    pool->slabs[pool->slab_count++] = slab;
+    for (int i = ZJS_BUFFER_SLAB_BLOCKS - 1; i >= 0; i--) {
+        void **block = (void **)(slab + i * size);
+        *block = pool->free;
+        pool->free = block;
+    }
+    pool_stats[cls].blocks += ZJS_BUFFER_SLAB_BLOCKS;
+    return true;
+}
+
+void *zjs_buffer_pool_alloc(uint32_t size)
+{
+    int cls = zjs_buffer_pool_class(size);
+    struct zjs_buffer_pool_stats *stats = &pool_stats[cls];
+    void *ptr = NULL;
+    if (cls < ZJS_BUFFER_POOL_CLASSES) {
+        // a new slab comes from the heap, so it counts as a miss
+        if (pools[cls].free)
+            stats->hits++;
+        else if (zjs_buffer_pool_refill(cls))
+            stats->misses++;
+        ptr = pools[cls].free;
+        if (ptr)
+            pools[cls].free = *(void **)ptr;
+    }
+    if (!ptr) {
+        stats->misses++;
+        ptr = zjs_malloc(size);
+        if (!ptr)
+            return NULL;
+    }
+    if (++stats->live > stats->peak)
+        stats->peak = stats->live;
+    return ptr;
+}
+
+static bool zjs_buffer_pool_owns(int cls, void *ptr)
+{
+    // effects: returns true if ptr is a block from a slab of class cls
+    struct zjs_buffer_pool *pool = &pools[cls];
+    uint32_t slab_size = pool_sizes[cls] * ZJS_BUFFER_SLAB_BLOCKS;
+    for (int i = 0; i < pool->slab_count; i++) {
+        if ((uint8_t *)ptr >= pool->slabs[i] &&
+            (uint8_t *)ptr < pool->slabs[i] + slab_size)
+            return true;
+    }
+    return false;
+}
+
+void zjs_buffer_pool_free(void *ptr, uint32_t size)
+{
+    int cls = zjs_buffer_pool_class(size);
+    pool_stats[cls].live--;
+    if (cls < ZJS_BUFFER_POOL_CLASSES && zjs_buffer_pool_owns(cls, ptr)) {
+        *(void **)ptr = pools[cls].free;
+        pools[cls].free = ptr;
+    } else {
+        zjs_free(ptr);
+    }
+}
+
+void zjs_buffer_get_pool_stats(struct zjs_buffer_pool_stats
+                               stats[ZJS_BUFFER_POOL_CLASSES + 1])
+{
+    for (int i = 0; i <= ZJS_BUFFER_POOL_CLASSES; i++) {
+        stats[i] = pool_stats[i];
+        stats[i].size = i < ZJS_BUFFER_POOL_CLASSES ? pool_sizes[i] : 0;
+    }
+}
+
 zjs_buffer_t *zjs_buffer_find(const jerry_value_t obj)
 {
     // requires: obj should be the JS object associated with a buffer, created
     //             in zjs_buffer
-    //  effects: looks up obj in our list of known buffer objects and returns
-    //             the associated list item struct
-    for (zjs_buffer_t *buf = zjs_buffers; buf; buf = buf->next)
-        if (buf->obj == obj)
-            return buf;
-    return NULL;
+    //  effects: returns the buffer struct stored as the native handle of obj,
+    //             or NULL if obj is not a buffer
+    uintptr_t handle;
+    if (!jerry_value_is_object(obj) ||
+        !jerry_get_object_native_handle(obj, &handle))
+        return NULL;
+
+    // other modules keep their own structs as native handles, so only trust
+    //   it on objects with the Buffer prototype
+    jerry_value_t proto = jerry_get_prototype(obj);
+    bool is_buffer = proto == zjs_buffer_prototype;
+    jerry_release_value(proto);
+    if (!is_buffer)
+        return NULL;
+
+    return (zjs_buffer_t *)handle;
 }
 
-static jerry_value_t zjs_buffer_read_bytes(const jerry_value_t this,
-                                           const jerry_value_t argv[],
-                                           const jerry_length_t argc,
-                                           int bytes, bool big_endian)
+// Kinds of number a Buffer accessor reads and writes
+enum {
+    ACCESS_UINT,
+    ACCESS_INT,
+    ACCESS_FLOAT
+};
+
+// One readX/writeX/readXArray family; the accessor is the native handle of
+//   each of those JS functions, so one C function serves them all
+typedef struct zjs_buffer_accessor {
+    const char *name;       // e.g. "Int16LE" for readInt16LE()
+    uint8_t kind;
+    uint8_t bytes;          // 1, 2, 4 or 8
+    bool big_endian;
+} zjs_buffer_accessor_t;
+
+static const zjs_buffer_accessor_t accessors[] = {
+    { "UInt8", ACCESS_UINT, 1, true },
+    { "UInt16BE", ACCESS_UINT, 2, true },
+    { "UInt16LE", ACCESS_UINT, 2, false },
+    { "UInt32BE", ACCESS_UINT, 4, true },
+    { "UInt32LE", ACCESS_UINT, 4, false },
+    { "Int8", ACCESS_INT, 1, true },
+    { "Int16BE", ACCESS_INT, 2, true },
+    { "Int16LE", ACCESS_INT, 2, false },
+    { "Int32BE", ACCESS_INT, 4, true },
+    { "Int32LE", ACCESS_INT, 4, false },
+    { "FloatBE", ACCESS_FLOAT, 4, true },
+    { "FloatLE", ACCESS_FLOAT, 4, false },
+    { "DoubleBE", ACCESS_FLOAT, 8, true },
+    { "DoubleLE", ACCESS_FLOAT, 8, false },
+};
+
+static double zjs_buffer_decode(const zjs_buffer_accessor_t *acc,
+                                const uint8_t *src)
+{
+    // requires: src points to acc->bytes bytes
+    //  effects: returns the number stored there in acc's format
+    uint64_t raw = 0;
+    for (int i = 0; i < acc->bytes; i++) {
+        raw <<= 8;
+        raw |= src[acc->big_endian ? i : acc->bytes - 1 - i];
+    }
+
+    if (acc->kind == ACCESS_UINT)
+        return (uint32_t)raw;
+
+    if (acc->kind == ACCESS_INT) {
+        // sign extend from the top bit of the field
+        uint32_t sign = 1u << (acc->bytes * 8 - 1);
+        return (int32_t)(((uint32_t)raw ^ sign) - sign);
+    }
+
+    if (acc->bytes == 4) {
+        uint32_t bits = raw;
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    double value;
+    memcpy(&value, &raw, sizeof(value));
+    return value;
+}
+
+static void zjs_buffer_encode(const zjs_buffer_accessor_t *acc, uint8_t *dst,
+                              double value)
+{
+    // requires: dst has room for acc->bytes bytes
+    //  effects: stores value there in acc's format; integers are clamped to
+    //             the 32-bit range, then truncated to the field size
+    uint64_t raw;
+    if (acc->kind == ACCESS_UINT) {
+        raw = !(value > 0) ? 0 :
+              value >= 4294967295.0 ? 0xffffffff : (uint32_t)value;
+    } else if (acc->kind == ACCESS_INT) {
+        raw = (uint32_t)(!(value > INT32_MIN) ? INT32_MIN :
+                         value >= INT32_MAX ? INT32_MAX : (int32_t)value);
+    } else if (acc->bytes == 4) {
+        float f = value;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        raw = bits;
+    } else {
+        memcpy(&raw, &value, sizeof(raw));
+    }
+
+    for (int i = 0; i < acc->bytes; i++) {
+        dst[acc->big_endian ? acc->bytes - 1 - i : i] = raw & 0xff;
+        raw >>= 8;
+    }
+}
+
+static uint8_t *zjs_buffer_get_field(zjs_buffer_t *buf, double offset,
+                                     uint32_t size)
+{
+    // effects: returns a pointer to size bytes at offset in buf, or NULL if
+    //             that is outside the buffer
+    if (!(offset >= 0) || size > buf->bufsize ||
+        offset > buf->bufsize - size)
+        return NULL;
+    return buf->buffer + (uint32_t)offset;
+}
+
+static jerry_value_t zjs_buffer_read(const jerry_value_t function_obj,
+                                     const jerry_value_t this,
+                                     const jerry_value_t argv[],
+                                     const jerry_length_t argc)
 {
     // requires: this is a JS buffer object created with zjs_buffer_create,
+    //             function_obj has an accessor as its native handle,
     //             argv[0] should be an offset into the buffer, but will treat
     //             offset as 0 if not given, as node.js seems to
-    //           bytes is the number of bytes to read (expects 1, 2, or 4)
-    //           big_endian true reads the bytes in big endian order, false in
-    //             little endian order
-    //  effects: reads bytes from the buffer associated with this JS object, if
-    //             found, at the given offset, if within the bounds of the
-    //             buffer; otherwise returns an error
+    //  effects: reads a number in the accessor's format from the buffer
+    //             associated with this JS object, if found, at the given
+    //             offset, if within the bounds of the buffer; otherwise
+    //             returns an error
+    const zjs_buffer_accessor_t *acc;
+    if (!jerry_get_object_native_handle(function_obj, (uintptr_t *)&acc))
+        return zjs_error("zjs_buffer_read: accessor not found");
+
     if (argc >= 1 && !jerry_value_is_number(argv[0]))
-        return zjs_error("zjs_buffer_read_bytes: invalid argument");
+        return zjs_error("zjs_buffer_read: invalid argument");
 
-    uint32_t offset = 0;
+    double offset = 0;
     if (argc >= 1)
-        offset = (uint32_t)jerry_get_number_value(argv[0]);
+        offset = jerry_get_number_value(argv[0]);
 
     zjs_buffer_t *buf = zjs_buffer_find(this);
     if (!buf)
-        return zjs_error("zjs_buffer_read_bytes: buffer not found on read");
-
-    if (offset + bytes > buf->bufsize)
-        return zjs_error("zjs_buffer_read_bytes: read attempted beyond buffer");
-
-    int dir = big_endian ? 1 : -1;
-    if (!big_endian)
-        offset += bytes - 1;  // start on the big end
+        return zjs_error("zjs_buffer_read: buffer not found on read");
 
-    uint32_t value = 0;
-    for (int i = 0; i < bytes; i++) {
-        value <<= 8;
-        value |= buf->buffer[offset];
-        offset += dir;
-    }
+    uint8_t *src = zjs_buffer_get_field(buf, offset, acc->bytes);
+    if (!src)
+        return zjs_error("zjs_buffer_read: read attempted beyond buffer");
 
-    return jerry_create_number(value);
+    return jerry_create_number(zjs_buffer_decode(acc, src));
 }
 
-static jerry_value_t zjs_buffer_write_bytes(const jerry_value_t this,
-                                            const jerry_value_t argv[],
-                                            const jerry_length_t argc,
-                                            int bytes, bool big_endian)
+static jerry_value_t zjs_buffer_write(const jerry_value_t function_obj,
+                                      const jerry_value_t this,
+                                      const jerry_value_t argv[],
+                                      const jerry_length_t argc)
 {
     // requires: this is a JS buffer object created with zjs_buffer_create,
+    //             function_obj has an accessor as its native handle,
     //             argv[0] must be the value to be written, argv[1] should be
     //             an offset into the buffer, but will treat offset as 0 if not
     //             given, as node.js seems to
-    //           bytes is the number of bytes to write (expects 1, 2, or 4)
-    //           big_endian true writes the bytes in big endian order, false in
-    //             little endian order
-    //  effects: writes bytes into the buffer associated with this JS object, if
-    //             found, at the given offset, if within the bounds of the
-    //             buffer; otherwise returns an error
+    //  effects: writes the value in the accessor's format into the buffer
+    //             associated with this JS object, if found, at the given
+    //             offset, if within the bounds of the buffer; otherwise
+    //             returns an error
+    const zjs_buffer_accessor_t *acc;
+    if (!jerry_get_object_native_handle(function_obj, (uintptr_t *)&acc))
+        return zjs_error("zjs_buffer_write: accessor not found");
+
     if (argc < 1 || !jerry_value_is_number(argv[0]) ||
         (argc >= 2 && !jerry_value_is_number(argv[1]))) {
-        return zjs_error("zjs_buffer_write_bytes: invalid argument");
+        return zjs_error("zjs_buffer_write: invalid argument");
     }
 
-    uint32_t value = jerry_get_number_value(argv[0]);
-
-    uint32_t offset = 0;
+    double offset = 0;
     if (argc > 1)
-        offset = (uint32_t)jerry_get_number_value(argv[1]);
+        offset = jerry_get_number_value(argv[1]);
 
     zjs_buffer_t *buf = zjs_buffer_find(this);
     if (!buf)
-        return zjs_error("zjs_buffer_write_bytes: buffer not found on write");
+        return zjs_error("zjs_buffer_write: buffer not found on write");
 
-    if (offset + bytes > buf->bufsize)
-        return zjs_error("zjs_buffer_write_bytes: write attempted beyond buffer");
-
-    int dir = big_endian ? -1 : 1;
-    if (big_endian)
-        offset += bytes - 1;  // start on the little end
-
-    for (int i = 0; i < bytes; i++) {
-        buf->buffer[offset] = value & 0xff;
-        value >>= 8;
-        offset += dir;
-    }
+    uint8_t *dst = zjs_buffer_get_field(buf, offset, acc->bytes);
+    if (!dst)
+        return zjs_error("zjs_buffer_write: write attempted beyond buffer");
 
+    zjs_buffer_encode(acc, dst, jerry_get_number_value(argv[0]));
     return ZJS_UNDEFINED;
 }
 
-static jerry_value_t zjs_buffer_read_uint8(const jerry_value_t function_obj,
+static jerry_value_t zjs_buffer_read_array(const jerry_value_t function_obj,
                                            const jerry_value_t this,
                                            const jerry_value_t argv[],
                                            const jerry_length_t argc)
 {
-    return zjs_buffer_read_bytes(this, argv, argc, 1, true);
+    // requires: this is a JS buffer object created with zjs_buffer_create,
+    //             function_obj has an accessor as its native handle,
+    //             argv[0] is the offset of the first number and argv[1] how
+    //             many to read; both are optional, defaulting to 0 and as
+    //             many as fit
+    //  effects: returns an array of the numbers, which are packed one after
+    //             the other in the accessor's format, or an error if they
+    //             don't all fit in the buffer
+    const zjs_buffer_accessor_t *acc;
+    if (!jerry_get_object_native_handle(function_obj, (uintptr_t *)&acc))
+        return zjs_error("zjs_buffer_read_array: accessor not found");
+
+    if ((argc >= 1 && !jerry_value_is_number(argv[0])) ||
+        (argc >= 2 && !jerry_value_is_number(argv[1])))
+        return zjs_error("zjs_buffer_read_array: invalid argument");
+
+    zjs_buffer_t *buf = zjs_buffer_find(this);
+    if (!buf)
+        return zjs_error("zjs_buffer_read_array: buffer not found on read");
+
+    double offset = argc >= 1 ? jerry_get_number_value(argv[0]) : 0;
+    double count = 0;
+    if (argc >= 2)
+        count = jerry_get_number_value(argv[1]);
+    else if (offset >= 0 && offset <= buf->bufsize)
+        count = (buf->bufsize - (uint32_t)offset) / acc->bytes;
+
+    if (!(count >= 0) || count > buf->bufsize / acc->bytes)
+        return zjs_error("zjs_buffer_read_array: read attempted beyond buffer");
+    uint32_t num = count;
+    uint8_t *src = zjs_buffer_get_field(buf, offset, num * acc->bytes);
+    if (!src)
+        return zjs_error("zjs_buffer_read_array: read attempted beyond buffer");
+
+    jerry_value_t array = jerry_create_array(num);
+    for (uint32_t i = 0; i < num; i++, src += acc->bytes) {
+        jerry_value_t value = jerry_create_number(zjs_buffer_decode(acc, src));
+        jerry_release_value(jerry_set_property_by_index(array, i, value));
+        jerry_release_value(value);
+    }
+    return array;
 }
 
-static jerry_value_t zjs_buffer_read_uint16_be(const jerry_value_t function_obj,
-                                               const jerry_value_t this,
-                                               const jerry_value_t argv[],
-                                               const jerry_length_t argc)
+static void zjs_buffer_add_accessor(jerry_value_t proto,
+                                    const zjs_buffer_accessor_t *acc,
+                                    void *function, const char *prefix,
+                                    const char *suffix)
 {
-    return zjs_buffer_read_bytes(this, argv, argc, 2, true);
+    // effects: adds a function named prefix + acc->name + suffix to proto
+    //             that calls function with acc as its native handle
+    char name[32];
+    snprintf(name, sizeof(name), "%s%s%s", prefix, acc->name, suffix);
+    jerry_value_t func = jerry_create_external_function(function);
+    jerry_set_object_native_handle(func, (uintptr_t)acc, NULL);
+    zjs_set_property(proto, name, func);
+    jerry_release_value(func);
 }
 
-static jerry_value_t zjs_buffer_read_uint16_le(const jerry_value_t function_obj,
-                                               const jerry_value_t this,
-                                               const jerry_value_t argv[],
-                                               const jerry_length_t argc)
+static uint32_t zjs_buffer_get_index(const jerry_value_t argv[],
+                                     const jerry_length_t argc, int index,
+                                     uint32_t def, uint32_t len, bool from_end)
 {
-    return zjs_buffer_read_bytes(this, argv, argc, 2, false);
+    // requires: len is the length of the buffer being indexed
+    //  effects: returns argv[index] as a position in the buffer, clamped to
+    //             [0, len]; if from_end is true, negative values count back
+    //             from the end, as slice() does; returns def if the argument
+    //             is not given or not a number
+    if (argc <= index || !jerry_value_is_number(argv[index]))
+        return def;
+
+    double value = jerry_get_number_value(argv[index]);
+    if (value < 0)
+        value = from_end ? value + len : 0;
+    if (value < 0)
+        return 0;
+    if (value > len)
+        return len;
+    return (uint32_t)value;
 }
 
-static jerry_value_t zjs_buffer_read_uint32_be(const jerry_value_t function_obj,
-                                               const jerry_value_t this,
-                                               const jerry_value_t argv[],
-                                               const jerry_length_t argc)
+// Strings from JerryScript are CESU-8: like UTF-8, except that code points
+//   above U+FFFF are a surrogate pair of two 3 byte sequences. The codecs
+//   convert between that and the bytes in a Buffer.
+
+// largest Buffer toString() will convert, so the string size fits 32 bits
+#define MAX_ENCODE_SIZE         0x3fffffff
+// strings up to this size are decoded on the stack instead of the heap
+#define DECODE_STACK_SIZE       64
+
+static const char hex_digits[] = "0123456789abcdef";
+static const char base64_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// value of each base64 digit, including the URL safe '-' and '_', or -1
+static const int8_t base64_values[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, 62, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, 63,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+// value of each hex digit, or -1
+static const int8_t hex_values[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+// One encoding that toString(), write() and Buffer.from() understand
+typedef struct zjs_buffer_codec {
+    const char *name;
+    // effects: writes the string form of len bytes from src to dst, unless dst
+    //            is NULL; returns its size in bytes either way
+    uint32_t (*encode)(const uint8_t *src, uint32_t len, uint8_t *dst);
+    // effects: replaces the len bytes of string data at data with the bytes
+    //            it represents, which are never more; returns their count
+    uint32_t (*decode)(uint8_t *data, uint32_t len);
+} zjs_buffer_codec_t;
+
+static inline bool zjs_is_ascii_word(const uint8_t *src)
 {
-    return zjs_buffer_read_bytes(this, argv, argc, 4, true);
+    // effects: returns true if the 4 bytes at src are all ASCII
+    uint32_t word;
+    memcpy(&word, src, sizeof(word));
+    return !(word & 0x80808080);
 }
 
-static jerry_value_t zjs_buffer_read_uint32_le(const jerry_value_t function_obj,
-                                               const jerry_value_t this,
-                                               const jerry_value_t argv[],
-                                               const jerry_length_t argc)
+static uint32_t zjs_put_cesu8(uint8_t *dst, uint32_t cp)
 {
-    return zjs_buffer_read_bytes(this, argv, argc, 4, false);
+    // requires: cp is a code point up to U+FFFF, or a surrogate
+    //  effects: writes cp as a 3 byte sequence to dst, unless it is NULL;
+    //             returns 3
+    if (dst) {
+        dst[0] = 0xe0 | cp >> 12;
+        dst[1] = 0x80 | ((cp >> 6) & 0x3f);
+        dst[2] = 0x80 | (cp & 0x3f);
+    }
+    return 3;
 }
 
-static jerry_value_t zjs_buffer_write_uint8(const jerry_value_t function_obj,
-                                           const jerry_value_t this,
-                                           const jerry_value_t argv[],
-                                           const jerry_length_t argc)
+static uint32_t zjs_utf8_encode(const uint8_t *src, uint32_t len, uint8_t *dst)
 {
-    return zjs_buffer_write_bytes(this, argv, argc, 1, true);
+    // effects: converts UTF-8 bytes to a CESU-8 string, replacing invalid
+    //            sequences with U+FFFD
+    uint32_t size = 0;
+    uint32_t i = 0;
+    while (i < len) {
+        if (i + 4 <= len && zjs_is_ascii_word(src + i)) {
+            if (dst)
+                memcpy(dst + size, src + i, 4);
+            size += 4;
+            i += 4;
+            continue;
+        }
+
+        uint8_t c = src[i];
+        if (c < 0x80) {
+            if (dst)
+                dst[size] = c;
+            size++;
+            i++;
+            continue;
+        }
+
+        // lead byte gives the number of continuation bytes and the smallest
+        //   code point that isn't overlong
+        int extra = 0;
+        uint32_t cp = 0, min = 0;
+        if (c >= 0xc2 && c <= 0xdf) {
+            extra = 1;
+            cp = c & 0x1f;
+            min = 0x80;
+        } else if (c >= 0xe0 && c <= 0xef) {
+            extra = 2;
+            cp = c & 0x0f;
+            min = 0x800;
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            extra = 3;
+            cp = c & 0x07;
+            min = 0x10000;
+        }
+        bool valid = extra && i + extra < len;
+        for (int j = 1; valid && j <= extra; j++) {
+            valid = (src[i + j] & 0xc0) == 0x80;
+            cp = cp << 6 | (src[i + j] & 0x3f);
+        }
+        if (!valid || cp < min || cp > 0x10ffff ||
+            (cp >= 0xd800 && cp <= 0xdfff)) {
+            size += zjs_put_cesu8(dst ? dst + size : NULL, 0xfffd);
+            i++;
+        } else if (cp < 0x10000) {
+            if (dst)
+                memcpy(dst + size, src + i, extra + 1);
+            size += extra + 1;
+            i += extra + 1;
+        } else {
+            cp -= 0x10000;
+            size += zjs_put_cesu8(dst ? dst + size : NULL, 0xd800 + (cp >> 10));
+            size += zjs_put_cesu8(dst ? dst + size : NULL,
+                                  0xdc00 + (cp & 0x3ff));
+            i += 4;
+        }
+    }
+    return size;
 }
 
-static jerry_value_t zjs_buffer_write_uint16_be(const jerry_value_t function_obj,
-                                               const jerry_value_t this,
-                                               const jerry_value_t argv[],
-                                               const jerry_length_t argc)
+static uint32_t zjs_utf8_decode(uint8_t *data, uint32_t len)
 {
-    return zjs_buffer_write_bytes(this, argv, argc, 2, true);
+    // effects: converts a CESU-8 string to UTF-8 in place, joining surrogate
+    //            pairs into 4 byte sequences
+    uint32_t out = 0;
+    uint32_t i = 0;
+    while (i < len) {
+        if (i + 4 <= len && zjs_is_ascii_word(data + i)) {
+            memmove(data + out, data + i, 4);
+            out += 4;
+            i += 4;
+        } else if (i + 6 <= len && data[i] == 0xed &&
+                   (data[i + 1] & 0xf0) == 0xa0 && data[i + 3] == 0xed &&
+                   (data[i + 4] & 0xf0) == 0xb0) {
+            uint32_t high = (data[i + 1] & 0x0f) << 6 | (data[i + 2] & 0x3f);
+            uint32_t low = (data[i + 4] & 0x0f) << 6 | (data[i + 5] & 0x3f);
+            uint32_t cp = 0x10000 + (high << 10) + low;
+            data[out++] = 0xf0 | cp >> 18;
+            data[out++] = 0x80 | ((cp >> 12) & 0x3f);
+            data[out++] = 0x80 | ((cp >> 6) & 0x3f);
+            data[out++] = 0x80 | (cp & 0x3f);
+            i += 6;
+        } else {
+            data[out++] = data[i++];
+        }
+    }
+    return out;
 }
 
-static jerry_value_t zjs_buffer_write_uint16_le(const jerry_value_t function_obj,
-                                               const jerry_value_t this,
-                                               const jerry_value_t argv[],
-                                               const jerry_length_t argc)
+static uint32_t zjs_ascii_encode(const uint8_t *src, uint32_t len,
+                                 uint8_t *dst)
 {
-    return zjs_buffer_write_bytes(this, argv, argc, 2, false);
+    // effects: converts bytes to a string, dropping the high bit of each
+    if (dst) {
+        for (uint32_t i = 0; i < len; i++)
+            dst[i] = src[i] & 0x7f;
+    }
+    return len;
 }
 
-static jerry_value_t zjs_buffer_write_uint32_be(const jerry_value_t function_obj,
-                                               const jerry_value_t this,
-                                               const jerry_value_t argv[],
-                                               const jerry_length_t argc)
+static uint32_t zjs_ascii_decode(uint8_t *data, uint32_t len)
 {
-    return zjs_buffer_write_bytes(this, argv, argc, 4, true);
+    // effects: converts a CESU-8 string in place to one byte per character,
+    //            keeping the low 8 bits of each
+    uint32_t out = 0;
+    uint32_t i = 0;
+    while (i < len) {
+        uint8_t c = data[i];
+        uint32_t cp = c;
+        int extra = c < 0x80 ? 0 : c < 0xe0 ? 1 : 2;
+        if (i + extra >= len)
+            break;
+        if (extra)
+            cp = (c & (extra == 1 ? 0x1f : 0x0f));
+        for (int j = 1; j <= extra; j++)
+            cp = cp << 6 | (data[i + j] & 0x3f);
+        data[out++] = cp & 0xff;
+        i += extra + 1;
+    }
+    return out;
 }
 
-static jerry_value_t zjs_buffer_write_uint32_le(const jerry_value_t function_obj,
-                                               const jerry_value_t this,
-                                               const jerry_value_t argv[],
-                                               const jerry_length_t argc)
+static uint32_t zjs_hex_encode(const uint8_t *src, uint32_t len, uint8_t *dst)
 {
-    return zjs_buffer_write_bytes(this, argv, argc, 4, false);
+    // effects: converts bytes to a string of two lowercase hex digits each
+    if (dst) {
+        for (uint32_t i = 0; i < len; i++) {
+            *dst++ = hex_digits[src[i] >> 4];
+            *dst++ = hex_digits[src[i] & 0xf];
+        }
+    }
+    return len * 2;
 }
 
-char zjs_int_to_hex(int value) {
-    // requires: value is between 0 and 15
-    //  effects: returns value as a lowercase hex digit 0-9a-f
-    if (value < 10)
-        return '0' + value;
-    return 'a' + value - 10;
+static uint32_t zjs_hex_decode(uint8_t *data, uint32_t len)
+{
+    // effects: converts pairs of hex digits to bytes in place, stopping at
+    //            the first invalid digit, as node.js does
+    uint32_t i;
+    for (i = 0; i + 1 < len; i += 2) {
+        int high = hex_values[data[i]];
+        int low = hex_values[data[i + 1]];
+        if (high < 0 || low < 0)
+            break;
+        data[i / 2] = high << 4 | low;
+    }
+    return i / 2;
+}
+
+static uint32_t zjs_base64_encode(const uint8_t *src, uint32_t len,
+                                  uint8_t *dst)
+{
+    // effects: converts bytes to a padded base64 string
+    if (dst) {
+        uint32_t i;
+        for (i = 0; i + 3 <= len; i += 3) {
+            uint32_t word = src[i] << 16 | src[i + 1] << 8 | src[i + 2];
+            *dst++ = base64_digits[word >> 18];
+            *dst++ = base64_digits[(word >> 12) & 0x3f];
+            *dst++ = base64_digits[(word >> 6) & 0x3f];
+            *dst++ = base64_digits[word & 0x3f];
+        }
+        if (i < len) {
+            bool two = len - i == 2;
+            uint32_t word = src[i] << 16 | (two ? src[i + 1] << 8 : 0);
+            *dst++ = base64_digits[word >> 18];
+            *dst++ = base64_digits[(word >> 12) & 0x3f];
+            *dst++ = two ? base64_digits[(word >> 6) & 0x3f] : '=';
+            *dst++ = '=';
+        }
+    }
+    return (len + 2) / 3 * 4;
+}
+
+static uint32_t zjs_base64_decode(uint8_t *data, uint32_t len)
+{
+    // effects: converts base64 to bytes in place, skipping characters that
+    //            aren't base64 digits, e.g. line breaks, up to any padding
+    uint32_t out = 0;
+    uint32_t i = 0;
+
+    // four digits at a time while there are no surprises
+    while (i + 4 <= len) {
+        int a = base64_values[data[i]];
+        int b = base64_values[data[i + 1]];
+        int c = base64_values[data[i + 2]];
+        int d = base64_values[data[i + 3]];
+        if ((a | b | c | d) < 0)
+            break;
+        uint32_t word = a << 18 | b << 12 | c << 6 | d;
+        data[out++] = word >> 16;
+        data[out++] = word >> 8;
+        data[out++] = word;
+        i += 4;
+    }
+
+    uint32_t bits = 0;
+    uint32_t acc = 0;
+    for (; i < len && data[i] != '='; i++) {
+        int value = base64_values[data[i]];
+        if (value < 0)
+            continue;
+        acc = (acc << 6 | value) & 0xffffff;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            data[out++] = acc >> bits;
+        }
+    }
+    return out;
+}
+
+static const zjs_buffer_codec_t codecs[] = {
+    { "utf8", zjs_utf8_encode, zjs_utf8_decode },
+    { "utf-8", zjs_utf8_encode, zjs_utf8_decode },
+    { "ascii", zjs_ascii_encode, zjs_ascii_decode },
+    { "hex", zjs_hex_encode, zjs_hex_decode },
+    { "base64", zjs_base64_encode, zjs_base64_decode },
+};
+
+static const zjs_buffer_codec_t *zjs_buffer_find_codec(jerry_value_t name)
+{
+    // requires: name is a JS string
+    //  effects: returns the codec for the encoding name, or NULL if there is
+    //             none
+    char encoding[8];
+    jerry_size_t sz = jerry_get_string_size(name);
+    if (sz >= sizeof(encoding))
+        return NULL;
+    jerry_string_to_char_buffer(name, (jerry_char_t *)encoding, sz);
+    encoding[sz] = '\0';
+
+    int count = sizeof(codecs) / sizeof(codecs[0]);
+    for (int i = 0; i < count; i++) {
+        if (!strcmp(codecs[i].name, encoding))
+            return &codecs[i];
+    }
+    return NULL;
+}
+
+static uint8_t *zjs_buffer_decode_string(jerry_value_t str,
+                                         const zjs_buffer_codec_t *codec,
+                                         uint8_t *stack_buf, uint32_t *len)
+{
+    // requires: str is a JS string, stack_buf has DECODE_STACK_SIZE bytes
+    //  effects: converts str to bytes with codec, in stack_buf if it fits or
+    //             in heap memory the caller must free if it is not stack_buf;
+    //             sets len to the number of bytes; returns NULL if out of
+    //             memory
+    jerry_size_t sz = jerry_get_string_size(str);
+    uint8_t *data = stack_buf;
+    if (sz > DECODE_STACK_SIZE) {
+        data = zjs_malloc(sz);
+        if (!data)
+            return NULL;
+    }
+    jerry_string_to_char_buffer(str, data, sz);
+    *len = codec->decode(data, sz);
+    return data;
 }
 
 static jerry_value_t zjs_buffer_to_string(const jerry_value_t function_obj,
@@ -212,64 +777,56 @@ static jerry_value_t zjs_buffer_to_string(const jerry_value_t function_obj,
                                           const jerry_value_t argv[],
                                           const jerry_length_t argc)
 {
-    // requires: this must be a JS buffer object, if an argument is present it
-    //             must be the string 'hex', as that is the only supported
-    //             encoding for now
-    //  effects: if the buffer object is found, converts its contents to a hex
-    //             string and returns it in ret_val_p
-    if (argc > 1 || (argc == 1 && !jerry_value_is_string(argv[0])))
+    // requires: this must be a JS buffer object, argv[0] is the encoding,
+    //             argv[1] and argv[2] the optional start and end offsets
+    //  effects: returns the bytes from start to end converted to a string in
+    //             the given encoding
+    if (argc > 3 || (argc >= 1 && !jerry_value_is_string(argv[0])))
         return zjs_error("zjs_buffer_to_string: invalid argument");
 
     zjs_buffer_t *buf = zjs_buffer_find(this);
-    if (buf && argc == 0) {
+    if (!buf)
+        return zjs_error("zjs_buffer_to_string: buffer not found");
+    if (argc == 0)
         return jerry_create_string((jerry_char_t *)"[Buffer Object]");
-    }
 
-    const int maxlen = 16;
-    char encoding[maxlen];
-    jerry_size_t sz = jerry_get_string_size(argv[0]);
-    if (sz >= maxlen) {
-        return zjs_error("zjs_buffer_to_string: encoding argument too long");
-    }
-    int len = jerry_string_to_char_buffer(argv[0], (jerry_char_t *)encoding,
-                                          sz);
-    encoding[len] = '\0';
-
-    if (strcmp(encoding, "ascii") == 0) {
-        buf->buffer[buf->bufsize] = '\0';
-        return jerry_create_string((jerry_char_t *)buf->buffer);
-    } else if (strcmp(encoding, "hex") == 0) {
-        if (buf && buf->bufsize > 0) {
-            char hexbuf[buf->bufsize * 2 + 1];
-            for (int i=0; i<buf->bufsize; i++) {
-                int high = (0xf0 & buf->buffer[i]) >> 4;
-                int low = 0xf & buf->buffer[i];
-                hexbuf[2*i] = zjs_int_to_hex(high);
-                hexbuf[2*i+1] = zjs_int_to_hex(low);
-            }
-            hexbuf[buf->bufsize * 2] = '\0';
-            return jerry_create_string((jerry_char_t *)hexbuf);
-        }
-    } else {
+    const zjs_buffer_codec_t *codec = zjs_buffer_find_codec(argv[0]);
+    if (!codec)
         return zjs_error("zjs_buffer_to_string: unsupported encoding type");
-    }
-    return zjs_error("zjs_buffer_to_string: buffer is empty");
+
+    uint32_t start = zjs_buffer_get_index(argv, argc, 1, 0, buf->bufsize,
+                                          false);
+    uint32_t end = zjs_buffer_get_index(argv, argc, 2, buf->bufsize,
+                                        buf->bufsize, false);
+    uint32_t len = end > start ? end - start : 0;
+    if (len > MAX_ENCODE_SIZE)
+        return zjs_error("zjs_buffer_to_string: buffer is too large");
+
+    // the whole string is built in the heap, not on the stack
+    uint32_t size = codec->encode(buf->buffer + start, len, NULL);
+    uint8_t *str = zjs_malloc(size ? size : 1);
+    if (!str)
+        return zjs_error("zjs_buffer_to_string: out of memory");
+    codec->encode(buf->buffer + start, len, str);
+
+    jerry_value_t result = jerry_create_string_sz(str, size);
+    zjs_free(str);
+    return result;
 }
 
 static void zjs_buffer_callback_free(uintptr_t handle)
 {
     // requires: handle is the native pointer we registered with
     //             jerry_set_object_native_handle
-    //  effects: frees the callback list item for the given pin object
-    zjs_buffer_t **pItem = &zjs_buffers;
-    while (*pItem) {
-        if ((uintptr_t)*pItem == handle) {
-            zjs_free((*pItem)->buffer);
-            *pItem = (*pItem)->next;
-            zjs_free((void *)handle);
-            return;
-        }
-        pItem = &(*pItem)->next;
+    //  effects: frees the buffer struct, and the backing store once no other
+    //             Buffer uses it
+    zjs_buffer_t *buf = (zjs_buffer_t *)handle;
+    struct zjs_buffer_store *store = buf->store;
+    if (buf != &store->owner)
+        zjs_buffer_pool_free(buf, sizeof(zjs_buffer_t));
+    if (--store->refs == 0) {
+        zjs_buffer_pool_free(store, sizeof(struct zjs_buffer_store) +
+                                    store->owner.bufsize);
     }
 }
 
@@ -281,118 +838,383 @@ static jerry_value_t zjs_buffer_write_string(const jerry_value_t function_obj_va
     // requires: string - what will be written to buf
     //           offset - where to start writing (Default: 0)
     //           length - how many bytes to write (Default: buf.length -offset)
-    //           encoding - the character encoding of string. Currently only supports
-    //           the default of utf8
-    // effects: writes string to buf at offset according to the character encoding in encoding.
-
-    if (argc < 1 || !jerry_value_is_string(argv[0]) ||
-        (argc > 1 && !jerry_value_is_number(argv[1])) ||
-        (argc > 2 && !jerry_value_is_number(argv[2])) ||
-        (argc > 3 && !jerry_value_is_string(argv[3])))
-        return zjs_error("zjs_buffer_write_string: invalid argument");
-
-    // Check if the encoding string is anything other than utf8
-    if (argc > 3) {
-        jerry_value_t arg4 = argv[3];
-        jerry_size_t arg4_sz = jerry_get_string_size(arg4);
+    //           encoding - the character encoding of string (Default: utf8),
+    //             may be given in place of offset or length
+    // effects: writes string to buf at offset according to the character
+    //            encoding, as much as fits; returns the number of bytes written
 
-        if (arg4_sz > 4096) {
-            return zjs_error("zjs_buffer_write_string: encoding arg string is too long");
-        }
+    if (argc < 1 || !jerry_value_is_string(argv[0]) || argc > 4)
+        return zjs_error("zjs_buffer_write_string: invalid argument");
 
-        char arg4_str[arg4_sz];
-        char utf8_str[4];
-        strcpy(utf8_str, "utf8");
-        uint8_t utf8 = strcmp(arg4_str, utf8_str);
+    zjs_buffer_t *buf = zjs_buffer_find(this);
+    if (!buf) {
+        return zjs_error("zjs_buffer_write_string: buffer pointer not found");
+    }
 
-        if (utf8 != 0) {
-            return zjs_error("zjs_buffer_write_string: only utf8 encoding is supported");
+    const zjs_buffer_codec_t *codec = &codecs[0];
+    double numbers[2] = { 0, buf->bufsize };
+    int count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (jerry_value_is_string(argv[i]) && i == argc - 1) {
+            codec = zjs_buffer_find_codec(argv[i]);
+            if (!codec)
+                return zjs_error("zjs_buffer_write_string: unsupported encoding type");
+        } else if (jerry_value_is_number(argv[i]) && count < 2) {
+            numbers[count++] = jerry_get_number_value(argv[i]);
+        } else {
+            return zjs_error("zjs_buffer_write_string: invalid argument");
         }
     }
 
-    uint32_t offset = 0;
-    jerry_value_t arg = argv[0];
-    jerry_size_t sz = jerry_get_string_size(arg);
-    zjs_buffer_t *buf = zjs_buffer_find(this);
-
-    if (sz > 4096) {
-        return zjs_error("zjs_buffer_write_string: string is too long for the buffer");
+    double offset = numbers[0];
+    double length = count > 1 ? numbers[1] : buf->bufsize - offset;
+    if (!(offset >= 0) || offset > buf->bufsize || !(length >= 0) ||
+        offset + length > buf->bufsize) {
+        return zjs_error("zjs_buffer_write_string: string + offset is larger than the buffer");
     }
 
-    char str[sz];
+    uint8_t stack_buf[DECODE_STACK_SIZE];
+    uint32_t len;
+    uint8_t *data = zjs_buffer_decode_string(argv[0], codec, stack_buf, &len);
+    if (!data)
+        return zjs_error("zjs_buffer_write_string: out of memory");
 
-    if (!buf) {
-        return zjs_error("zjs_buffer_write_string: buffer pointer not found");
-    }
+    if (len > length)
+        len = length;
+    memcpy(buf->buffer + (uint32_t)offset, data, len);
+    if (data != stack_buf)
+        zjs_free(data);
 
-    if (argc > 1)
-        offset = (uint32_t)jerry_get_number_value(argv[1]);
+    return jerry_create_number(len);
+}
 
-    uint32_t length = buf->bufsize - offset;
+static jerry_value_t zjs_buffer_wrap(zjs_buffer_t *buf_item,
+                                     struct zjs_buffer_store *store,
+                                     uint8_t *data, uint32_t size)
+{
+    // requires: buf_item is an unused buffer struct, data points to size
+    //             bytes in store
+    //  effects: creates a JS Buffer object for these bytes described by
+    //             buf_item, that holds a reference to the store
+    jerry_value_t buf_obj = jerry_create_object();
 
-    if (argc > 2)
-        length = (uint32_t)jerry_get_number_value(argv[2]);
+    buf_item->obj = buf_obj;
+    buf_item->buffer = data;
+    buf_item->bufsize = size;
+    buf_item->store = store;
+    store->refs++;
 
-    if (offset + length > buf->bufsize) {
-        return zjs_error("zjs_buffer_write_string: string + offset is larger than the buffer");
-    }
+    jerry_set_prototype(buf_obj, zjs_buffer_prototype);
+    zjs_obj_add_number(buf_obj, size, "length");
 
-    jerry_string_to_char_buffer(arg, str, sz);
+    // the struct is found through the native handle, and freed when the
+    //   object is garbage collected
+    jerry_set_object_native_handle(buf_obj, (uintptr_t)buf_item,
+                                   zjs_buffer_callback_free);
 
-    memcpy(&buf->buffer[offset], &str[0], length);
+    return buf_obj;
+}
 
-    return jerry_create_number(length);
+static jerry_value_t zjs_buffer_create_view(struct zjs_buffer_store *store,
+                                            uint8_t *data, uint32_t size)
+{
+    // requires: store is a backing store, data points to size bytes in it
+    //  effects: allocates a JS Buffer object for these bytes that holds a
+    //             reference to the store; returns undefined if out of memory
+    zjs_buffer_t *buf_item = zjs_buffer_pool_alloc(sizeof(zjs_buffer_t));
+    if (!buf_item) {
+        ERR_PRINT("zjs_buffer_create: unable to allocate buffer\n");
+        return ZJS_UNDEFINED;
+    }
+    return zjs_buffer_wrap(buf_item, store, data, size);
 }
 
 jerry_value_t zjs_buffer_create(uint32_t size)
 {
     // requires: size is size of desired buffer, in bytes
-    //  effects: allocates a JS Buffer object, an underlying C buffer, and a
-    //             list item to track it; if any of these fail, free them all
-    //             and return NULL, otherwise return the JS object
-    jerry_value_t buf_obj = jerry_create_object();
-    void *buf = zjs_malloc(size);
-    zjs_buffer_t *buf_item =
-        (zjs_buffer_t *)zjs_malloc(sizeof(zjs_buffer_t));
-
-    if (!buf_obj || !buf || !buf_item) {
+    //  effects: allocates a JS Buffer object with a new backing store, in one
+    //             block with its struct; returns undefined if out of memory,
+    //             otherwise the JS object
+    struct zjs_buffer_store *store = NULL;
+    if (size <= UINT32_MAX - sizeof(struct zjs_buffer_store))
+        store = zjs_buffer_pool_alloc(sizeof(struct zjs_buffer_store) + size);
+    if (!store) {
         ERR_PRINT("zjs_buffer_create: unable to allocate buffer\n");
-        jerry_release_value(buf_obj);
-        zjs_free(buf);
-        zjs_free(buf_item);
         return ZJS_UNDEFINED;
     }
+    store->refs = 0;
+    return zjs_buffer_wrap(&store->owner, store, store->data, size);
+}
 
-    buf_item->obj = buf_obj;
-    buf_item->buffer = buf;
-    buf_item->bufsize = size;
-    buf_item->next = zjs_buffers;
-    zjs_buffers = buf_item;
+static jerry_value_t zjs_buffer_slice(const jerry_value_t function_obj,
+                                      const jerry_value_t this,
+                                      const jerry_value_t argv[],
+                                      const jerry_length_t argc)
+{
+    // requires: this is a JS buffer object, argv[0] is an optional start
+    //             offset and argv[1] an optional end offset; negative offsets
+    //             count back from the end
+    //  effects: returns a new Buffer for the bytes from start up to end that
+    //             shares memory with this one, so writes to either are seen in
+    //             both
+    zjs_buffer_t *buf = zjs_buffer_find(this);
+    if (!buf)
+        return zjs_error("zjs_buffer_slice: buffer not found");
 
-    jerry_set_prototype(buf_obj, zjs_buffer_prototype);
-    zjs_obj_add_number(buf_obj, size, "length");
+    uint32_t start = zjs_buffer_get_index(argv, argc, 0, 0, buf->bufsize,
+                                          true);
+    uint32_t end = zjs_buffer_get_index(argv, argc, 1, buf->bufsize,
+                                        buf->bufsize, true);
+    if (end < start)
+        end = start;
 
-    // TODO: sign up to get callback when the object is freed, then free the
-    //   buffer and remove it from the list
+    return zjs_buffer_create_view(buf->store, buf->buffer + start,
+                                  end - start);
+}
 
-    // watch for the object getting garbage collected, and clean up
-    jerry_set_object_native_handle(buf_obj, (uintptr_t)buf_item,
-                                   zjs_buffer_callback_free);
+static jerry_value_t zjs_buffer_copy(const jerry_value_t function_obj,
+                                     const jerry_value_t this,
+                                     const jerry_value_t argv[],
+                                     const jerry_length_t argc)
+{
+    // requires: this is a JS buffer object, argv[0] is the target Buffer,
+    //             optional argv[1] is the offset in target, argv[2] and
+    //             argv[3] the start and end offsets in this buffer
+    //  effects: copies as many bytes as fit into target, and returns the
+    //             number copied; the two may share memory
+    zjs_buffer_t *buf = zjs_buffer_find(this);
+    zjs_buffer_t *target = argc >= 1 ? zjs_buffer_find(argv[0]) : NULL;
+    if (!buf || !target)
+        return zjs_error("zjs_buffer_copy: invalid argument");
+
+    uint32_t target_start = zjs_buffer_get_index(argv, argc, 1, 0,
+                                                 target->bufsize, false);
+    uint32_t start = zjs_buffer_get_index(argv, argc, 2, 0, buf->bufsize,
+                                          false);
+    uint32_t end = zjs_buffer_get_index(argv, argc, 3, buf->bufsize,
+                                        buf->bufsize, false);
+    uint32_t count = end > start ? end - start : 0;
+    if (count > target->bufsize - target_start)
+        count = target->bufsize - target_start;
+
+    memmove(target->buffer + target_start, buf->buffer + start, count);
+    return jerry_create_number(count);
+}
 
-    return buf_obj;
+static jerry_value_t zjs_buffer_fill(const jerry_value_t function_obj,
+                                     const jerry_value_t this,
+                                     const jerry_value_t argv[],
+                                     const jerry_length_t argc)
+{
+    // requires: this is a JS buffer object, argv[0] is a byte value or a
+    //             string, optional argv[1] and argv[2] are the start and end
+    //             offsets to fill
+    //  effects: fills the range with the byte, or repeats the string's bytes
+    //             over it, and returns this buffer
+    zjs_buffer_t *buf = zjs_buffer_find(this);
+    if (!buf || argc < 1 ||
+        !(jerry_value_is_number(argv[0]) || jerry_value_is_string(argv[0])))
+        return zjs_error("zjs_buffer_fill: invalid argument");
+
+    uint32_t start = zjs_buffer_get_index(argv, argc, 1, 0, buf->bufsize,
+                                          false);
+    uint32_t end = zjs_buffer_get_index(argv, argc, 2, buf->bufsize,
+                                        buf->bufsize, false);
+    if (end <= start)
+        return jerry_acquire_value(this);
+
+    uint8_t *dst = buf->buffer + start;
+    uint32_t count = end - start;
+    jerry_size_t sz = 0;
+    if (jerry_value_is_string(argv[0]))
+        sz = jerry_get_string_size(argv[0]);
+
+    if (!sz) {
+        uint8_t value = 0;
+        if (jerry_value_is_number(argv[0]))
+            value = (uint32_t)jerry_get_number_value(argv[0]) & 0xff;
+        memset(dst, value, count);
+    } else {
+        // copy the pattern once, then keep doubling the filled part
+        uint32_t filled = sz < count ? sz : count;
+        if (sz <= count) {
+            jerry_string_to_char_buffer(argv[0], dst, sz);
+        } else {
+            uint8_t *pattern = zjs_malloc(sz);
+            if (!pattern)
+                return zjs_error("zjs_buffer_fill: out of memory");
+            jerry_string_to_char_buffer(argv[0], pattern, sz);
+            memcpy(dst, pattern, filled);
+            zjs_free(pattern);
+        }
+        while (filled < count) {
+            uint32_t chunk = filled < count - filled ? filled : count - filled;
+            memcpy(dst + filled, dst, chunk);
+            filled += chunk;
+        }
+    }
+    return jerry_acquire_value(this);
+}
+
+static int zjs_buffer_compare_bytes(zjs_buffer_t *a, zjs_buffer_t *b)
+{
+    // effects: returns -1, 0 or 1 as a sorts before, the same as, or after b
+    uint32_t len = a->bufsize < b->bufsize ? a->bufsize : b->bufsize;
+    int result = len ? memcmp(a->buffer, b->buffer, len) : 0;
+    if (!result)
+        result = (a->bufsize > b->bufsize) - (a->bufsize < b->bufsize);
+    return (result > 0) - (result < 0);
+}
+
+static jerry_value_t zjs_buffer_equals(const jerry_value_t function_obj,
+                                       const jerry_value_t this,
+                                       const jerry_value_t argv[],
+                                       const jerry_length_t argc)
+{
+    // requires: this is a JS buffer object, argv[0] is another Buffer
+    //  effects: returns true if both hold the same bytes
+    zjs_buffer_t *buf = zjs_buffer_find(this);
+    zjs_buffer_t *other = argc >= 1 ? zjs_buffer_find(argv[0]) : NULL;
+    if (!buf || !other)
+        return zjs_error("zjs_buffer_equals: invalid argument");
+
+    return jerry_create_boolean(zjs_buffer_compare_bytes(buf, other) == 0);
+}
+
+static jerry_value_t zjs_buffer_compare(const jerry_value_t function_obj,
+                                        const jerry_value_t this,
+                                        const jerry_value_t argv[],
+                                        const jerry_length_t argc)
+{
+    // requires: this is a JS buffer object, argv[0] is another Buffer
+    //  effects: returns -1, 0 or 1 as this buffer sorts before, the same as,
+    //             or after argv[0], comparing bytes and then lengths
+    zjs_buffer_t *buf = zjs_buffer_find(this);
+    zjs_buffer_t *other = argc >= 1 ? zjs_buffer_find(argv[0]) : NULL;
+    if (!buf || !other)
+        return zjs_error("zjs_buffer_compare: invalid argument");
+
+    return jerry_create_number(zjs_buffer_compare_bytes(buf, other));
+}
+
+static jerry_value_t zjs_buffer_concat(const jerry_value_t function_obj,
+                                       const jerry_value_t this,
+                                       const jerry_value_t argv[],
+                                       const jerry_length_t argc)
+{
+    // requires: argv[0] is an array of Buffers, optional argv[1] is the
+    //             length of the result
+    //  effects: returns a new Buffer with the contents of all the Buffers
+    //             one after the other, truncated or zero padded to the given
+    //             length
+    if (argc < 1 || !jerry_value_is_array(argv[0]) ||
+        (argc > 1 && !jerry_value_is_number(argv[1])))
+        return zjs_error("zjs_buffer_concat: invalid argument");
+
+    uint32_t count = jerry_get_array_length(argv[0]);
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        jerry_value_t item = jerry_get_property_by_index(argv[0], i);
+        zjs_buffer_t *buf = zjs_buffer_find(item);
+        jerry_release_value(item);
+        if (!buf)
+            return zjs_error("zjs_buffer_concat: list must hold Buffers");
+        total += buf->bufsize;
+    }
+
+    uint32_t length = total;
+    if (argc > 1) {
+        double value = jerry_get_number_value(argv[1]);
+        length = value > 0 ? (uint32_t)value : 0;
+    }
+
+    jerry_value_t new_buf_obj = zjs_buffer_create(length);
+    zjs_buffer_t *new_buf = zjs_buffer_find(new_buf_obj);
+    if (!new_buf)
+        return new_buf_obj;
+
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < count && offset < length; i++) {
+        jerry_value_t item = jerry_get_property_by_index(argv[0], i);
+        zjs_buffer_t *buf = zjs_buffer_find(item);
+        uint32_t size = buf->bufsize;
+        if (size > length - offset)
+            size = length - offset;
+        memcpy(new_buf->buffer + offset, buf->buffer, size);
+        offset += size;
+        jerry_release_value(item);
+    }
+    memset(new_buf->buffer + offset, 0, length - offset);
+
+    return new_buf_obj;
 }
 
 // Buffer constructor
+static jerry_value_t zjs_buffer_from_value(jerry_value_t value,
+                                           const zjs_buffer_codec_t *codec)
+{
+    // requires: value is an array of numbers, a string or a Buffer; codec is
+    //             the encoding of a string
+    //  effects: returns a new Buffer holding the bytes of value
+    if (jerry_value_is_string(value)) {
+        uint8_t stack_buf[DECODE_STACK_SIZE];
+        uint32_t len;
+        uint8_t *data = zjs_buffer_decode_string(value, codec, stack_buf,
+                                                 &len);
+        if (!data)
+            return zjs_error("zjs_buffer: out of memory");
+
+        jerry_value_t new_buf_obj = zjs_buffer_create(len);
+        zjs_buffer_t *buf = zjs_buffer_find(new_buf_obj);
+        if (buf)
+            memcpy(buf->buffer, data, len);
+        if (data != stack_buf)
+            zjs_free(data);
+        return new_buf_obj;
+    }
+
+    zjs_buffer_t *src = zjs_buffer_find(value);
+    if (src) {
+        jerry_value_t new_buf_obj = zjs_buffer_create(src->bufsize);
+        zjs_buffer_t *buf = zjs_buffer_find(new_buf_obj);
+        if (buf)
+            memcpy(buf->buffer, src->buffer, src->bufsize);
+        return new_buf_obj;
+    }
+
+    if (!jerry_value_is_array(value))
+        return zjs_error("zjs_buffer: invalid argument");
+
+    uint32_t arr_size = jerry_get_array_length(value);
+    jerry_value_t new_buf_obj = zjs_buffer_create(arr_size);
+    zjs_buffer_t *buf = zjs_buffer_find(new_buf_obj);
+    if (!buf)
+        return new_buf_obj;
+
+    for (uint32_t i = 0; i < arr_size; i++) {
+        jerry_value_t array_item = jerry_get_property_by_index(value, i);
+        bool is_number = jerry_value_is_number(array_item);
+        if (is_number)
+            buf->buffer[i] = (uint8_t)jerry_get_number_value(array_item);
+        jerry_release_value(array_item);
+        if (!is_number) {
+            jerry_release_value(new_buf_obj);
+            return zjs_error("zjs_buffer: buffer only supports numeric values in an array");
+        }
+    }
+    return new_buf_obj;
+}
+
 static jerry_value_t zjs_buffer(const jerry_value_t function_obj,
                                 const jerry_value_t this,
                                 const jerry_value_t argv[],
                                 const jerry_length_t argc)
 {
     // requires: single argument can be a numeric size in bytes, an array of uint8,
-    //           or a string.
+    //           or a UTF-8 string.
     //  effects: constructs a new JS Buffer object, and an associated buffer
-    //             tied to it through a zjs_buffer_t struct stored in a global
-    //             list
+    //             tied to it through a zjs_buffer_t struct stored as its
+    //             native handle
     if (argc != 1 ||
         !(jerry_value_is_number(argv[0]) ||
         jerry_value_is_array(argv[0]) ||
@@ -403,69 +1225,65 @@ static jerry_value_t zjs_buffer(const jerry_value_t function_obj,
         // If passed a number, use that to allocate a buffer with a length of that number
         uint32_t size = (uint32_t)jerry_get_number_value(argv[0]);
         return zjs_buffer_create(size);
-    } else if (jerry_value_is_array(argv[0])){
-        // If passed an array, allocate the memory and fill it with the array value
-        jerry_value_t array = argv[0];
-        uint32_t arr_size = jerry_get_array_length(array);
-        jerry_value_t new_buf_obj = zjs_buffer_create(arr_size);
-        zjs_buffer_t *buf = zjs_buffer_find(new_buf_obj);
-        jerry_value_t array_item;
-
-        if (buf) {
-            if (arr_size > buf->bufsize) {
-                return zjs_error("zjs_buffer: write beyond end of buffer");
-            }
-
-            for (int i = 0; i < arr_size; i++) {
-                array_item = jerry_get_property_by_index(array, i);
-                if (jerry_value_is_number(array_item)) {
-                    buf->buffer[i] = (uint8_t)jerry_get_number_value(array_item);
-                } else {
-                    return zjs_error("zjs_buffer: buffer only supports numeric values in an array");
-                }
-            }
-        }
-        return new_buf_obj;
-    } else {
-        // If passed a string, convert it into a char array and copy it to the buffer.
-        jerry_value_t arg = argv[0];
-        jerry_size_t sz = jerry_get_string_size(arg);
-        jerry_value_t new_buf_obj = zjs_buffer_create(sz);
-        zjs_buffer_t *buf = zjs_buffer_find(new_buf_obj);
-
-        if (buf) {
-            jerry_string_to_char_buffer(arg, (char*)buf->buffer, sz);
-        } else {
-            return zjs_error("zjs_buffer: unable to find string buffer");
-        }
+    }
+    return zjs_buffer_from_value(argv[0], &codecs[0]);
+}
 
-        return new_buf_obj;
+static jerry_value_t zjs_buffer_from(const jerry_value_t function_obj,
+                                     const jerry_value_t this,
+                                     const jerry_value_t argv[],
+                                     const jerry_length_t argc)
+{
+    // requires: argv[0] is an array of uint8, a Buffer or a string, argv[1]
+    //             the optional encoding of a string (Default: utf8)
+    //  effects: returns a new Buffer holding a copy of the bytes of argv[0]
+    if (argc < 1 || argc > 2 ||
+        (argc > 1 && !jerry_value_is_string(argv[1])))
+        return zjs_error("zjs_buffer_from: invalid argument");
+
+    const zjs_buffer_codec_t *codec = &codecs[0];
+    if (argc > 1) {
+        codec = zjs_buffer_find_codec(argv[1]);
+        if (!codec)
+            return zjs_error("zjs_buffer_from: unsupported encoding type");
     }
+    return zjs_buffer_from_value(argv[0], codec);
 }
 
 void zjs_buffer_init()
 {
     jerry_value_t global_obj = jerry_get_global_object();
-    zjs_obj_add_function(global_obj, zjs_buffer, "Buffer");
+    jerry_value_t buffer_func = jerry_create_external_function(zjs_buffer);
+    zjs_obj_add_function(buffer_func, zjs_buffer_concat, "concat");
+    zjs_obj_add_function(buffer_func, zjs_buffer_from, "from");
+    zjs_set_property(global_obj, "Buffer", buffer_func);
+    jerry_release_value(buffer_func);
     jerry_release_value(global_obj);
 
     zjs_native_func_t array[] = {
-        { zjs_buffer_read_uint8, "readUInt8" },
-        { zjs_buffer_write_uint8, "writeUInt8" },
-        { zjs_buffer_read_uint16_be, "readUInt16BE" },
-        { zjs_buffer_write_uint16_be, "writeUInt16BE" },
-        { zjs_buffer_read_uint16_le, "readUInt16LE" },
-        { zjs_buffer_write_uint16_le, "writeUInt16LE" },
-        { zjs_buffer_read_uint32_be, "readUInt32BE" },
-        { zjs_buffer_write_uint32_be, "writeUInt32BE" },
-        { zjs_buffer_read_uint32_le, "readUInt32LE" },
-        { zjs_buffer_write_uint32_le, "writeUInt32LE" },
         { zjs_buffer_to_string, "toString" },
         { zjs_buffer_write_string, "write" },
+        { zjs_buffer_slice, "slice" },
+        { zjs_buffer_slice, "subarray" },
+        { zjs_buffer_copy, "copy" },
+        { zjs_buffer_fill, "fill" },
+        { zjs_buffer_equals, "equals" },
+        { zjs_buffer_compare, "compare" },
         { NULL, NULL }
     };
     zjs_buffer_prototype = jerry_create_object();
     zjs_obj_add_functions(zjs_buffer_prototype, array);
+
+    int count = sizeof(accessors) / sizeof(accessors[0]);
+    for (int i = 0; i < count; i++) {
+        const zjs_buffer_accessor_t *acc = &accessors[i];
+        zjs_buffer_add_accessor(zjs_buffer_prototype, acc, zjs_buffer_read,
+                                "read", "");
+        zjs_buffer_add_accessor(zjs_buffer_prototype, acc, zjs_buffer_write,
+                                "write", "");
+        zjs_buffer_add_accessor(zjs_buffer_prototype, acc,
+                                zjs_buffer_read_array, "read", "Array");
+    }
 }
 
 void zjs_buffer_cleanup()
@@ -5,21 +5,87 @@
 
 #include "jerry-api.h"
 
+// Buffers whose struct and data fit in a block of up to 256 bytes come from
+//   pools, one for each size class, so allocating a Buffer for every read
+//   doesn't fragment the heap; larger ones use the heap
+#define ZJS_BUFFER_POOL_CLASSES     5
+
+// blocks allocated at once when a pool runs dry
+#ifndef ZJS_BUFFER_SLAB_BLOCKS
+#ifdef ZJS_LINUX_BUILD
+#define ZJS_BUFFER_SLAB_BLOCKS      16
+#else
+#define ZJS_BUFFER_SLAB_BLOCKS      4
+#endif
+#endif
+// most slabs each pool may hold, after that it falls back to the heap
+#ifndef ZJS_BUFFER_MAX_SLABS
+#ifdef ZJS_LINUX_BUILD
+#define ZJS_BUFFER_MAX_SLABS        16
+#else
+#define ZJS_BUFFER_MAX_SLABS        2
+#endif
+#endif
+
+struct zjs_buffer_pool_stats {
+    uint32_t size;      // largest block in this class, 0 for the heap
+    uint32_t hits;      // allocations served by a free pooled block
+    uint32_t misses;    // allocations that needed memory from the heap
+    uint32_t live;      // blocks in use
+    uint32_t peak;      // most blocks in use at once
+    uint32_t blocks;    // pooled blocks allocated, in use or free
+};
+
 /** Initialize the buffer module, or reinitialize after cleanup */
 void zjs_buffer_init();
 
 /** Release resources held by the buffer module */
 void zjs_buffer_cleanup();
 
+struct zjs_buffer_store;
+
 typedef struct zjs_buffer {
     jerry_value_t obj;
-    uint8_t *buffer;
+    uint8_t *buffer;                    // this Buffer's bytes, within store
     uint32_t bufsize;
-    struct zjs_buffer *next;
+    struct zjs_buffer_store *store;     // refcounted, shared with slices
 } zjs_buffer_t;
 
+/**
+ * Get the buffer struct of a JS Buffer object, from its native handle
+ *
+ * @param obj           JS object to look up
+ *
+ * @return              The buffer struct, or NULL if obj is not a Buffer
+ */
 zjs_buffer_t *zjs_buffer_find(const jerry_value_t obj);
 
 jerry_value_t zjs_buffer_create(uint32_t size);
 
+/**
+ * Allocate memory from the pool for its size class, or the heap if too big
+ *
+ * @param size          Size in bytes
+ *
+ * @return              The memory, or NULL if out of memory
+ */
+void *zjs_buffer_pool_alloc(uint32_t size);
+
+/**
+ * Give back memory from zjs_buffer_pool_alloc()
+ *
+ * @param ptr           The memory
+ * @param size          Size it was allocated with
+ */
+void zjs_buffer_pool_free(void *ptr, uint32_t size);
+
+/**
+ * Get the allocation counts of the Buffer pools
+ *
+ * @param stats[out]    Filled in with the counts of each size class, then
+ *                        of allocations too big for any class
+ */
+void zjs_buffer_get_pool_stats(struct zjs_buffer_pool_stats
+                               stats[ZJS_BUFFER_POOL_CLASSES + 1]);
+
 #endif  // __zjs_buffer_h__
@@ -7,6 +7,7 @@
 #else
 #include "zjs_linux_port.h"
 #endif
+#include <stddef.h>
 #include <string.h>
 
 #include "zjs_util.h"
@@ -14,20 +15,101 @@
 
 #include "jerry-api.h"
 
-// this could be defined with config options in the future
+// size of the ring buffer signals are queued in, in bytes; set with
+//   CB_BUF_SIZE=<bytes> on the make command line
 #ifndef ZJS_CALLBACK_BUF_SIZE
+#ifdef ZJS_LINUX_BUILD
 #define ZJS_CALLBACK_BUF_SIZE   1024
+#else
+#define ZJS_CALLBACK_BUF_SIZE   128
+#endif
+#endif
+// Signals that don't fit in the ring buffer are queued in a fixed pool of
+//   spill entries, each with room for ZJS_CALLBACK_SPILL_SIZE bytes of args.
+//   Only when that is full too are they dropped.
+#ifndef ZJS_CALLBACK_SPILL_ENTRIES
+#ifdef ZJS_LINUX_BUILD
+#define ZJS_CALLBACK_SPILL_ENTRIES  32
+#else
+#define ZJS_CALLBACK_SPILL_ENTRIES  4
 #endif
-// max number of callbacks that can be serviced before continuing execution. If
-// this value is reached, any additional callbacks will be serviced on the next
-// time around the main loop.
-#ifndef ZJS_MAX_CB_LOOP_ITERATION
-#define ZJS_MAX_CB_LOOP_ITERATION   12
 #endif
+#ifndef ZJS_CALLBACK_SPILL_SIZE
+#define ZJS_CALLBACK_SPILL_SIZE     32
+#endif
+// time in us that callbacks can be serviced for before continuing execution.
+// Callbacks whose average run time would go over it are serviced on the next
+// time around the main loop, but each priority class gets at least one call.
+#ifndef ZJS_CALLBACK_BUDGET_US
+#define ZJS_CALLBACK_BUDGET_US      5000
+#endif
+// staging ring buffer size per priority class, in 32-bit chunks; a class
+//   whose ring fills up gets a bigger one, up to CB_CLASS_RING_MAX, so it
+//   doesn't hold up the signals for other classes behind its own
+#define CB_CLASS_RING_SIZE  (ZJS_CALLBACK_BUF_SIZE / 4)
+#define CB_CLASS_RING_MAX   (CB_CLASS_RING_SIZE * 8)
+// spill entry args size in 32-bit chunks, plus one for the loop stats time
+#define CB_SPILL_WORDS      (ZJS_CALLBACK_SPILL_SIZE / 4 + 1)
 
+// initial number of slots in the callback map, doubled whenever it fills up
 #define INITIAL_CALLBACK_SIZE  16
-#define CB_CHUNK_SIZE          16
+// number of callback records allocated at once when the slab runs dry
+#define CB_SLAB_SIZE           16
 #define CB_LIST_MULTIPLIER  4
+// largest argument slot for a coalescing callback, in bytes
+#define CB_COALESCE_MAX_SIZE    64
+// initial number of entries in the immediate queue, doubled whenever it fills
+#define IMMEDIATE_INITIAL_SIZE  16
+// args stored in an immediate queue entry, more are allocated separately
+#define IMMEDIATE_INLINE_ARGS   3
+
+// Callback IDs are sparse: the low bits index the callback map and the high
+// bits hold a generation count for that slot, bumped each time the slot is
+// freed. Freed slots are reused right away, so this keeps a stale ID, e.g. a
+// signal still in the ring buffer for a removed callback, from reaching the
+// callback that took over its slot. IDs travel through the ring buffer in the
+// 16-bit type and low 6 bits of the value, which leaves a bit to mark payload
+// signals, so they are limited to 22 bits; 16-bit IDs are limited to 15 since
+// -1 means no callback. Both Linux and Zephyr builds use 32-bit IDs; a build
+// with 16-bit IDs uses all 15 bits for the index by default, so it keeps the
+// 32k callback limit but has no generation check, and a stale ID reaches
+// whatever callback has its slot, as before IDs had generations.
+#ifdef ZJS_32_BIT_CALLBACK_ID
+#ifndef ZJS_CALLBACK_INDEX_BITS
+#define ZJS_CALLBACK_INDEX_BITS 16
+#endif
+#define CB_ID_BITS          22
+typedef uint32_t cb_index_t;
+#else
+#ifndef ZJS_CALLBACK_INDEX_BITS
+#define ZJS_CALLBACK_INDEX_BITS 15
+#endif
+#define CB_ID_BITS          15
+typedef uint16_t cb_index_t;
+#endif
+
+#if ZJS_CALLBACK_INDEX_BITS > CB_ID_BITS
+#error "ZJS_CALLBACK_INDEX_BITS is more than callback IDs hold"
+#endif
+
+#define CB_INDEX_MASK       ((1 << ZJS_CALLBACK_INDEX_BITS) - 1)
+#define CB_GEN_MASK         ((1 << (CB_ID_BITS - ZJS_CALLBACK_INDEX_BITS)) - 1)
+#define CB_MAX_SLOTS        (1 << ZJS_CALLBACK_INDEX_BITS)
+#define CB_MAKE_ID(gen, index) \
+    ((zjs_callback_id)(((gen) << ZJS_CALLBACK_INDEX_BITS) | (index)))
+// marks the end of the free slot list
+#define CB_NO_SLOT          ((cb_index_t)-1)
+
+// split an ID into the ring buffer's type and value fields and back
+#define CB_ID_TYPE(id)      ((uint16_t)(id))
+#define CB_ID_VALUE(id)     ((uint8_t)((uint32_t)(id) >> 16))
+#define CB_ID_FROM_RING(type, value) \
+    ((zjs_callback_id)((type) | ((uint32_t)((value) & 0x3f) << 16)))
+// set in the ring buffer value when the args are a payload pointer
+#define CB_RING_PAYLOAD     0x40
+// payloads held this long after being handed to their callback are reported
+//   as leaks in debug builds
+#define CB_PAYLOAD_LEAK_US  1000000
 
 // flag bit value for JS callback
 #define CALLBACK_TYPE_JS    0
@@ -50,12 +132,26 @@
 #define GET_TYPE(f)         (f & (1 << TYPE_BIT)) >> TYPE_BIT
 #define GET_JS_TYPE(f)      (f & (1 << JS_TYPE_BIT)) >> JS_TYPE_BIT
 
+// Latest arguments of a coalescing callback, see zjs_set_callback_coalescing()
+struct cb_coalesce {
+    uint32_t size;          // size of args from the last signal, in bytes
+    uint32_t signaled;      // time in us it was marked pending
+    uint32_t max_size;
+    uint32_t coalesced;     // signals folded into one already pending
+    uint32_t args[];
+};
+
 struct zjs_callback_t {
     zjs_callback_id id;
     void* handle;
+    struct cb_coalesce* coalesce;   // NULL unless signals are coalesced
+#ifdef BUILD_MODULE_LOOPSTATS
+    struct zjs_callback_loop_stats loop_stats;
+#endif
     uint8_t flags;      // holds once and type bits
     zjs_post_callback_func post;
     jerry_value_t this;
+    uint8_t priority;   // enum zjs_callback_priority
     uint8_t max_funcs;
     uint8_t num_funcs;
     union {
@@ -65,89 +161,390 @@ struct zjs_callback_t {
     };
 };
 
-#ifdef ZJS_LINUX_BUILD
-static uint8_t args_buffer[ZJS_CALLBACK_BUF_SIZE];
+// Callback records come from fixed size slabs that are never freed, unused
+// records are kept in a free list
+union cb_record {
+    struct zjs_callback_t cb;
+    union cb_record* next;
+};
+
+struct cb_slot {
+    struct zjs_callback_t* cb;  // NULL if the slot is free
+    cb_index_t next_free;       // next free slot, if this one is free
+    uint16_t gen;               // generation of the current/next ID
+};
+
+static uint32_t args_buffer[ZJS_CALLBACK_BUF_SIZE / 4];
 static struct zjs_port_ring_buf ring_buffer;
-#else
-SYS_RING_BUF_DECLARE_POW2(ring_buffer, 5);
+
+struct cb_spill {
+    struct cb_spill* next;
+    zjs_callback_id id;
+    uint8_t flags;      // CB_RING_PAYLOAD or 0
+    uint8_t size32;
+    uint32_t args[CB_SPILL_WORDS];
+};
+
+// spill entries, in a free list and a FIFO queue guarded by the port
+//   critical section; spill_count is changed under it too, but read without
+//   it, so both use atomic loads and stores
+static struct cb_spill spill_pool[ZJS_CALLBACK_SPILL_ENTRIES];
+static struct cb_spill* spill_free = NULL;
+static struct cb_spill* spill_head = NULL;
+static struct cb_spill* spill_tail = NULL;
+static uint32_t spill_count = 0;
+
+enum cb_payload_state {
+    PAYLOAD_FREE,
+    PAYLOAD_HELD,       // allocated, with the producer or a callback
+    PAYLOAD_QUEUED,     // signaled, on its way to its callback
+};
+
+struct cb_payload {
+    struct cb_payload* next;    // next free payload
+    uint32_t size;
+    uint8_t state;              // enum cb_payload_state
+#ifdef DEBUG_BUILD
+    uint8_t reported;           // leak already reported
+    zjs_callback_id id;         // callback it was handed to, or -1
+    uint32_t delivered;         // time in us it was handed over
 #endif
+    uint32_t data[ZJS_PAYLOAD_SIZE / 4];
+};
+
+// payload buffers, in a free list guarded by the port critical section
+static struct cb_payload payload_pool[ZJS_PAYLOAD_COUNT];
+static struct cb_payload* payload_free = NULL;
 static uint8_t ring_buf_initialized = 1;
+// Signals are moved from the ring buffer, where they are in the order they
+//   came in, to one ring per priority class. Only the main loop uses these.
+static uint32_t class_buffers[ZJS_PRIORITY_COUNT][CB_CLASS_RING_SIZE];
+static struct zjs_port_ring_buf class_rings[ZJS_PRIORITY_COUNT];
+// size of each class ring in 32-bit chunks, and its buffer if it has grown
+//   out of class_buffers
+static uint32_t class_sizes[ZJS_PRIORITY_COUNT];
+static uint32_t* class_grown[ZJS_PRIORITY_COUNT];
+// moving average of callback run time per priority class, in us
+static uint32_t class_avg_us[ZJS_PRIORITY_COUNT];
+// given whenever there is new work for the main loop, taken when it blocks
+static struct zjs_port_sem loop_sem;
+
+static cb_index_t cb_limit = 0;
+// highest slot index ever used plus one
+static cb_index_t cb_size = 0;
+static struct cb_slot* cb_map = NULL;
+static cb_index_t free_slots = CB_NO_SLOT;
+static union cb_record* free_records = NULL;
+static struct zjs_callback_stats cb_stats;
+
+// State below is shared with signalers and guarded by the port critical
+//   section: a bit per map slot set while a coalescing callback is pending,
+//   the number of bits set, and the number of coalescing callbacks; the
+//   counts are also checked without it, so they use atomic loads and stores
+static uint32_t* pending_map = NULL;
+static uint32_t pending_count = 0;
+static uint32_t coalescing_cbs = 0;
+
+struct cb_immediate {
+    uint32_t id;                    // 0 once cancelled
+    zjs_immediate_func function;    // C function, or NULL to call js_func
+    void* handle;
+    jerry_value_t js_func;
+    jerry_value_t this;
+    uint32_t argc;
+    union {
+        jerry_value_t args[IMMEDIATE_INLINE_ARGS];
+        jerry_value_t* argv;        // if argc > IMMEDIATE_INLINE_ARGS
+    };
+};
 
-static zjs_callback_id cb_limit = INITIAL_CALLBACK_SIZE;
-static zjs_callback_id cb_size = 0;
-static struct zjs_callback_t** cb_map = NULL;
+// FIFO of immediates in a ring of imm_limit entries, a power of 2; only the
+//   main thread uses it
+static struct cb_immediate* imm_queue = NULL;
+static uint32_t imm_limit = 0;
+static uint32_t imm_head = 0;
+static uint32_t imm_count = 0;
+static uint32_t imm_next_id = 1;
 
-static zjs_callback_id new_id(void)
+#define PENDING_WORDS(slots)    (((slots) + 31) / 32)
+#define PENDING_BIT(index)      (1u << ((index) % 32))
+
+static bool grow_map(void)
+{
+    // effects: doubles the size of the callback map so growing it is
+    //            amortized O(1); returns false if out of memory or IDs
+    if (cb_limit >= CB_MAX_SLOTS) {
+        ERR_PRINT("out of callback IDs, increase ZJS_CALLBACK_INDEX_BITS\n");
+        return false;
+    }
+    cb_index_t limit = cb_limit ? cb_limit * 2 : INITIAL_CALLBACK_SIZE;
+    if (limit > CB_MAX_SLOTS) {
+        limit = CB_MAX_SLOTS;
+    }
+    size_t size = sizeof(struct cb_slot) * limit;
+    size_t pending_size = sizeof(uint32_t) * PENDING_WORDS(limit);
+    struct cb_slot* new_map = zjs_malloc(size);
+    uint32_t* new_pending = zjs_malloc(pending_size);
+    if (!new_map || !new_pending) {
+        DBG_PRINT("error allocating space for new callback map\n");
+        zjs_free(new_map);
+        zjs_free(new_pending);
+        return false;
+    }
+    DBG_PRINT("callback map size too small, increasing to %u\n", limit);
+    memset(new_map, 0, size);
+    memset(new_pending, 0, pending_size);
+
+    struct cb_slot* old_map = cb_map;
+    uint32_t* old_pending = pending_map;
+    zjs_port_critical_t key = zjs_port_enter_critical();
+    if (old_map) {
+        memcpy(new_map, old_map, sizeof(struct cb_slot) * cb_limit);
+        memcpy(new_pending, old_pending,
+               sizeof(uint32_t) * PENDING_WORDS(cb_limit));
+    }
+    cb_map = new_map;
+    pending_map = new_pending;
+    cb_limit = limit;
+    zjs_port_exit_critical(key);
+
+    zjs_free(old_map);
+    zjs_free(old_pending);
+    return true;
+}
+
+static struct zjs_callback_t* alloc_record(void)
+{
+    if (!free_records) {
+        union cb_record* slab = zjs_malloc(sizeof(union cb_record) *
+                                           CB_SLAB_SIZE);
+        if (!slab) {
+            DBG_PRINT("error allocating space for new callback\n");
+            return NULL;
+        }
+        for (int i = 0; i < CB_SLAB_SIZE; ++i) {
+            slab[i].next = free_records;
+            free_records = &slab[i];
+        }
+    }
+    union cb_record* record = free_records;
+    free_records = record->next;
+    memset(&record->cb, 0, sizeof(struct zjs_callback_t));
+    record->cb.priority = ZJS_PRIORITY_IO;
+    return &record->cb;
+}
+
+static void put_record(struct zjs_callback_t* cb)
 {
-    zjs_callback_id id = 0;
-    if (cb_size >= cb_limit) {
-        cb_limit += CB_CHUNK_SIZE;
-        size_t size = sizeof(struct zjs_callback_t *) * cb_limit;
-        struct zjs_callback_t** new_map = zjs_malloc(size);
-        if (!new_map) {
-            DBG_PRINT("error allocating space for new callback map\n");
+    // effects: returns a record from alloc_record() to the free list
+    union cb_record* record = (union cb_record*)cb;
+    record->next = free_records;
+    free_records = record;
+}
+
+static zjs_callback_id add_record(struct zjs_callback_t* cb)
+{
+    // requires: cb was allocated with alloc_record()
+    //  effects: assigns cb an ID in a free slot of the callback map, growing
+    //             the map if needed; returns the ID, or -1 on failure
+    cb_index_t index;
+    if (free_slots != CB_NO_SLOT) {
+        index = free_slots;
+        free_slots = cb_map[index].next_free;
+    } else {
+        if (cb_size >= cb_limit && !grow_map()) {
             return -1;
         }
-        DBG_PRINT("callback list size too small, increasing by %d\n",
-                  CB_CHUNK_SIZE);
-        memset(new_map, 0, size);
-        memcpy(new_map, cb_map, sizeof(struct zjs_callback_t *) * cb_size);
-        zjs_free(cb_map);
-        cb_map = new_map;
+        index = cb_size++;
+    }
+    cb->id = CB_MAKE_ID(cb_map[index].gen, index);
+    zjs_port_critical_t key = zjs_port_enter_critical();
+    cb_map[index].cb = cb;
+    zjs_port_exit_critical(key);
+
+    cb_stats.live++;
+    cb_stats.added++;
+    if (cb_stats.live > cb_stats.peak) {
+        cb_stats.peak = cb_stats.live;
+    }
+    return cb->id;
+}
+
+static void free_record(struct zjs_callback_t* cb)
+{
+    // effects: frees the map slot and record of cb; bumps the slot's
+    //            generation so the old ID no longer matches it
+    cb_index_t index = cb->id & CB_INDEX_MASK;
+    struct cb_coalesce* coalesce = cb->coalesce;
+    zjs_port_critical_t key = zjs_port_enter_critical();
+    cb_map[index].cb = NULL;
+    if (coalesce) {
+        uint32_t* word = &pending_map[index / 32];
+        if (*word & PENDING_BIT(index)) {
+            *word &= ~PENDING_BIT(index);
+            __atomic_store_n(&pending_count, pending_count - 1,
+                             __ATOMIC_RELAXED);
+        }
+        cb->coalesce = NULL;
+        __atomic_store_n(&coalescing_cbs, coalescing_cbs - 1,
+                         __ATOMIC_RELAXED);
+    }
+    zjs_port_exit_critical(key);
+    zjs_free(coalesce);
+
+    cb_map[index].gen = (cb_map[index].gen + 1) & CB_GEN_MASK;
+    cb_map[index].next_free = free_slots;
+    free_slots = index;
+    put_record(cb);
+
+    cb_stats.live--;
+    cb_stats.removed++;
+}
+
+static struct zjs_callback_t* get_cb(zjs_callback_id id)
+{
+    // effects: returns the callback for id, or NULL if it doesn't exist or
+    //            was removed, even if its slot has been reused since
+    if (id < 0) {
+        return NULL;
+    }
+    cb_index_t index = id & CB_INDEX_MASK;
+    if (index >= cb_size) {
+        return NULL;
     }
-    while (cb_map[id] != NULL) {
-        id++;
+    struct zjs_callback_t* cb = cb_map[index].cb;
+    if (!cb || cb->id != id) {
+        return NULL;
     }
-    return id;
+    return cb;
 }
 
 void zjs_init_callbacks(void)
 {
-    if (!cb_map) {
-        size_t size = sizeof(struct zjs_callback_t *) *
-            INITIAL_CALLBACK_SIZE;
-        cb_map = (struct zjs_callback_t**)zjs_malloc(size);
-        if (!cb_map) {
-            DBG_PRINT("error allocating space for CB map\n");
-            return;
-        }
-        memset(cb_map, 0, size);
+    if (!cb_map && !grow_map()) {
+        DBG_PRINT("error allocating space for CB map\n");
+        return;
     }
-#ifdef ZJS_LINUX_BUILD
-    zjs_port_ring_buf_init(&ring_buffer, ZJS_CALLBACK_BUF_SIZE, (uint32_t*)args_buffer);
-#endif
+    zjs_port_ring_buf_init(&ring_buffer, ZJS_CALLBACK_BUF_SIZE / 4, args_buffer);
+    for (int i = 0; i < ZJS_CALLBACK_SPILL_ENTRIES; ++i) {
+        spill_pool[i].next = spill_free;
+        spill_free = &spill_pool[i];
+    }
+    for (int i = 0; i < ZJS_PAYLOAD_COUNT; ++i) {
+        payload_pool[i].next = payload_free;
+        payload_free = &payload_pool[i];
+    }
+    for (int i = 0; i < ZJS_PRIORITY_COUNT; ++i) {
+        zjs_port_ring_buf_init(&class_rings[i], CB_CLASS_RING_SIZE,
+                               class_buffers[i]);
+        class_sizes[i] = CB_CLASS_RING_SIZE;
+    }
+    zjs_port_sem_init(&loop_sem, 0, 1);
     ring_buf_initialized = 1;
     return;
 }
 
+void zjs_get_callback_stats(struct zjs_callback_stats* stats)
+{
+    zjs_port_critical_t key = zjs_port_enter_critical();
+    *stats = cb_stats;
+    zjs_port_exit_critical(key);
+}
+
+#ifdef BUILD_MODULE_LOOPSTATS
+void zjs_foreach_loop_stats(zjs_loop_stats_func func, void* data)
+{
+    cb_index_t i;
+    for (i = 0; i < cb_size; ++i) {
+        struct zjs_callback_t* cb = cb_map[i].cb;
+        if (cb) {
+            func(cb->id, cb->priority, &cb->loop_stats, data);
+        }
+    }
+}
+
+void zjs_reset_loop_stats(void)
+{
+    cb_index_t i;
+    zjs_port_critical_t key = zjs_port_enter_critical();
+    for (i = 0; i < cb_size; ++i) {
+        if (cb_map[i].cb) {
+            memset(&cb_map[i].cb->loop_stats, 0,
+                   sizeof(struct zjs_callback_loop_stats));
+        }
+    }
+    zjs_port_exit_critical(key);
+}
+#endif
+
+bool zjs_set_callback_coalescing(zjs_callback_id id, uint32_t max_size)
+{
+    struct zjs_callback_t* cb = get_cb(id);
+    if (!cb || max_size > CB_COALESCE_MAX_SIZE) {
+        ERR_PRINT("cannot coalesce callback %d\n", id);
+        return false;
+    }
+    if (cb->coalesce) {
+        return cb->coalesce->max_size >= max_size;
+    }
+    // round up so the slot holds whole 32-bit chunks, like the ring buffer
+    max_size = (max_size + 3) & ~3;
+    struct cb_coalesce* coalesce = zjs_malloc(sizeof(struct cb_coalesce) +
+                                              max_size);
+    if (!coalesce) {
+        DBG_PRINT("error allocating coalesce slot\n");
+        return false;
+    }
+    memset(coalesce, 0, sizeof(struct cb_coalesce) + max_size);
+    coalesce->max_size = max_size;
+
+    zjs_port_critical_t key = zjs_port_enter_critical();
+    cb->coalesce = coalesce;
+    __atomic_store_n(&coalescing_cbs, coalescing_cbs + 1, __ATOMIC_RELAXED);
+    zjs_port_exit_critical(key);
+    return true;
+}
+
+void zjs_set_callback_priority(zjs_callback_id id,
+                               enum zjs_callback_priority priority)
+{
+    struct zjs_callback_t* cb = get_cb(id);
+    if (cb && priority < ZJS_PRIORITY_COUNT) {
+        cb->priority = priority;
+    }
+}
+
 void zjs_edit_js_func(zjs_callback_id id, jerry_value_t func)
 {
-    if (id != -1) {
-        jerry_release_value(cb_map[id]->js_func);
-        cb_map[id]->js_func = jerry_acquire_value(func);
+    struct zjs_callback_t* cb = get_cb(id);
+    if (cb) {
+        jerry_release_value(cb->js_func);
+        cb->js_func = jerry_acquire_value(func);
     }
 }
 
 void zjs_edit_callback_handle(zjs_callback_id id, void* handle)
 {
-    if (id != -1 && cb_map[id]) {
-        cb_map[id]->handle = handle;
+    struct zjs_callback_t* cb = get_cb(id);
+    if (cb) {
+        cb->handle = handle;
     }
 }
 
 bool zjs_remove_callback_list_func(zjs_callback_id id, jerry_value_t js_func)
 {
-    if (id != -1 && cb_map[id]) {
+    struct zjs_callback_t* cb = get_cb(id);
+    if (cb) {
         int i;
-        for (i = 0; i < cb_map[id]->num_funcs; ++i) {
-            if (js_func == cb_map[id]->func_list[i]) {
+        for (i = 0; i < cb->num_funcs; ++i) {
+            if (js_func == cb->func_list[i]) {
                 int j;
-                jerry_release_value(cb_map[id]->func_list[i]);
-                for (j = i; j < cb_map[id]->num_funcs - 1; ++j) {
-                    cb_map[id]->func_list[j] = cb_map[id]->func_list[j + 1];
+                jerry_release_value(cb->func_list[i]);
+                for (j = i; j < cb->num_funcs - 1; ++j) {
+                    cb->func_list[j] = cb->func_list[j + 1];
                 }
-                cb_map[id]->num_funcs--;
-                cb_map[id]->func_list[cb_map[id]->num_funcs] = 0;
+                cb->num_funcs--;
+                cb->func_list[cb->num_funcs] = 0;
                 return true;
             }
         }
@@ -158,19 +555,19 @@ bool zjs_remove_callback_list_func(zjs_callback_id id, jerry_value_t js_func)
 
 int zjs_get_num_callbacks(zjs_callback_id id)
 {
-    if (id != -1 && cb_map[id]) {
-        return cb_map[id]->num_funcs;
+    struct zjs_callback_t* cb = get_cb(id);
+    if (cb) {
+        return cb->num_funcs;
     }
     return 0;
 }
 
 jerry_value_t* zjs_get_callback_func_list(zjs_callback_id id, int* count)
 {
-    if (id != -1) {
-        if (cb_map[id]) {
-            *count = cb_map[id]->num_funcs;
-            return cb_map[id]->func_list;
-        }
+    struct zjs_callback_t* cb = get_cb(id);
+    if (cb) {
+        *count = cb->num_funcs;
+        return cb->func_list;
     }
     return NULL;
 }
@@ -182,67 +579,66 @@ zjs_callback_id zjs_add_callback_list(jerry_value_t js_func,
                                       zjs_callback_id id)
 {
     if (id != -1) {
-        if (cb_map[id] && cb_map[id]->func_list) {
+        struct zjs_callback_t* cb = get_cb(id);
+        if (cb && cb->func_list) {
             // The function list is full, allocate more space, copy the existing
             // list, and add the new function
-            if (cb_map[id]->num_funcs == cb_map[id]->max_funcs - 1) {
+            if (cb->num_funcs == cb->max_funcs - 1) {
                 int i;
                 jerry_value_t* new_list = zjs_malloc((sizeof(jerry_value_t) *
-                        (cb_map[id]->max_funcs + CB_LIST_MULTIPLIER)));
-                for (i = 0; i < cb_map[id]->num_funcs; ++i) {
-                    new_list[i] = cb_map[id]->func_list[i];
+                        (cb->max_funcs + CB_LIST_MULTIPLIER)));
+                for (i = 0; i < cb->num_funcs; ++i) {
+                    new_list[i] = cb->func_list[i];
                 }
-                new_list[cb_map[id]->num_funcs] = jerry_acquire_value(js_func);
+                new_list[cb->num_funcs] = jerry_acquire_value(js_func);
 
-                cb_map[id]->max_funcs += CB_LIST_MULTIPLIER;
-                zjs_free(cb_map[id]->func_list);
-                cb_map[id]->func_list = new_list;
+                cb->max_funcs += CB_LIST_MULTIPLIER;
+                zjs_free(cb->func_list);
+                cb->func_list = new_list;
             } else {
                 // Add function to list
-                cb_map[id]->func_list[cb_map[id]->num_funcs] =
-                        jerry_acquire_value(js_func);
+                cb->func_list[cb->num_funcs] = jerry_acquire_value(js_func);
             }
             // If not already set, set the handle/pre/post provided. These will
             // only be set once, when the list is created.
-            if (!cb_map[id]->handle) {
-                cb_map[id]->handle = handle;
+            if (!cb->handle) {
+                cb->handle = handle;
             }
-            if (!cb_map[id]->post) {
-                cb_map[id]->post = post;
+            if (!cb->post) {
+                cb->post = post;
             }
-            cb_map[id]->num_funcs++;
-            return cb_map[id]->id;
+            cb->num_funcs++;
+            return cb->id;
         } else {
             DBG_PRINT("list handle was NULL\n");
             return -1;
         }
     } else {
-        struct zjs_callback_t* new_cb = zjs_malloc(sizeof(struct zjs_callback_t));
+        struct zjs_callback_t* new_cb = alloc_record();
         if (!new_cb) {
-            DBG_PRINT("error allocating space for new callback\n");
             return -1;
         }
-        memset(new_cb, 0, sizeof(struct zjs_callback_t));
 
         SET_ONCE(new_cb->flags, 0);
         SET_TYPE(new_cb->flags, CALLBACK_TYPE_JS);
         SET_JS_TYPE(new_cb->flags, JS_TYPE_LIST);
-        new_cb->id = new_id();
-        new_cb->this = jerry_acquire_value(this);
-        new_cb->post = post;
-        new_cb->handle = handle;
-        new_cb->max_funcs = CB_LIST_MULTIPLIER;
-        new_cb->num_funcs = 1;
         new_cb->func_list = zjs_malloc(sizeof(jerry_value_t) * CB_LIST_MULTIPLIER);
         if (!new_cb->func_list) {
             DBG_PRINT("could not allocate function list\n");
+            put_record(new_cb);
             return -1;
         }
-        new_cb->func_list[0] = jerry_acquire_value(js_func);
-        cb_map[new_cb->id] = new_cb;
-        if (new_cb->id >= cb_size - 1) {
-            cb_size++;
+        if (add_record(new_cb) == -1) {
+            zjs_free(new_cb->func_list);
+            put_record(new_cb);
+            return -1;
         }
+        new_cb->this = jerry_acquire_value(this);
+        new_cb->post = post;
+        new_cb->handle = handle;
+        new_cb->max_funcs = CB_LIST_MULTIPLIER;
+        new_cb->num_funcs = 1;
+        new_cb->func_list[0] = jerry_acquire_value(js_func);
         return new_cb->id;
     }
 }
@@ -253,17 +649,18 @@ zjs_callback_id add_callback(jerry_value_t js_func,
                              zjs_post_callback_func post,
                              uint8_t once)
 {
-    struct zjs_callback_t* new_cb = zjs_malloc(sizeof(struct zjs_callback_t));
+    struct zjs_callback_t* new_cb = alloc_record();
     if (!new_cb) {
-        DBG_PRINT("error allocating space for new callback\n");
         return -1;
     }
-    memset(new_cb, 0, sizeof(struct zjs_callback_t));
+    if (add_record(new_cb) == -1) {
+        put_record(new_cb);
+        return -1;
+    }
 
     SET_ONCE(new_cb->flags, (once) ? 1 : 0);
     SET_TYPE(new_cb->flags, CALLBACK_TYPE_JS);
     SET_JS_TYPE(new_cb->flags, JS_TYPE_SINGLE);
-    new_cb->id = new_id();
     new_cb->js_func = jerry_acquire_value(js_func);
     new_cb->this = jerry_acquire_value(this);
     new_cb->post = post;
@@ -271,12 +668,6 @@ zjs_callback_id add_callback(jerry_value_t js_func,
     new_cb->max_funcs = 1;
     new_cb->num_funcs = 1;
 
-    // Add callback to list
-    cb_map[new_cb->id] = new_cb;
-    if (new_cb->id >= cb_size - 1) {
-        cb_size++;
-    }
-
     DBG_PRINT("adding new callback id %d, js_func=%lu, once=%u\n",
               new_cb->id, new_cb->js_func, once);
 
@@ -301,58 +692,291 @@ zjs_callback_id zjs_add_callback_once(jerry_value_t js_func,
 
 void zjs_remove_callback(zjs_callback_id id)
 {
-    if (id != -1 && cb_map[id]) {
-        if (GET_TYPE(cb_map[id]->flags) == CALLBACK_TYPE_JS) {
-            if (GET_JS_TYPE(cb_map[id]->flags) == JS_TYPE_SINGLE) {
-                jerry_release_value(cb_map[id]->js_func);
-            } else if (GET_JS_TYPE(cb_map[id]->flags) == JS_TYPE_LIST && cb_map[id]->func_list) {
+    struct zjs_callback_t* cb = get_cb(id);
+    if (cb) {
+        if (GET_TYPE(cb->flags) == CALLBACK_TYPE_JS) {
+            if (GET_JS_TYPE(cb->flags) == JS_TYPE_SINGLE) {
+                jerry_release_value(cb->js_func);
+            } else if (GET_JS_TYPE(cb->flags) == JS_TYPE_LIST && cb->func_list) {
                 int i;
-                for (i = 0; i < cb_map[id]->num_funcs; ++i) {
-                    jerry_release_value(cb_map[id]->func_list[i]);
+                for (i = 0; i < cb->num_funcs; ++i) {
+                    jerry_release_value(cb->func_list[i]);
                 }
-                zjs_free(cb_map[id]->func_list);
+                zjs_free(cb->func_list);
             }
-            jerry_release_value(cb_map[id]->this);
+            jerry_release_value(cb->this);
         }
-        zjs_free(cb_map[id]);
-        cb_map[id] = NULL;
+        free_record(cb);
         DBG_PRINT("removing callback id %d\n", id);
     }
 }
 
-void zjs_signal_callback(zjs_callback_id id, void* args, uint32_t size)
+static bool signal_coalesced(zjs_callback_id id, void* args, uint32_t size)
+{
+    // effects: if id coalesces its signals, saves args as its latest and
+    //            marks it pending; returns true if so, false if the signal
+    //            should go through the ring buffer
+    bool handled = false, wake = false;
+    zjs_port_critical_t key = zjs_port_enter_critical();
+    struct zjs_callback_t* cb = get_cb(id);
+    if (cb && cb->coalesce) {
+        struct cb_coalesce* coalesce = cb->coalesce;
+        if (size > coalesce->max_size) {
+            size = coalesce->max_size;
+        }
+        if (size) {
+            memcpy(coalesce->args, args, size);
+        }
+        coalesce->size = size;
+
+        cb_index_t index = id & CB_INDEX_MASK;
+        uint32_t* word = &pending_map[index / 32];
+        if (*word & PENDING_BIT(index)) {
+            coalesce->coalesced++;
+            cb_stats.coalesced++;
+        } else {
+            *word |= PENDING_BIT(index);
+            __atomic_store_n(&pending_count, pending_count + 1,
+                             __ATOMIC_RELAXED);
+            coalesce->signaled = zjs_port_get_uptime_us();
+            wake = true;
+        }
+#ifdef BUILD_MODULE_LOOPSTATS
+        cb->loop_stats.signals++;
+#endif
+        handled = true;
+    }
+    zjs_port_exit_critical(key);
+
+    if (wake) {
+        zjs_loop_unblock();
+    }
+    return handled;
+}
+
+static int spill_signal(zjs_callback_id id, uint8_t flags, uint32_t* args,
+                        uint8_t size32)
 {
+    // effects: queues the signal in a spill entry; returns 0 on success or
+    //            -ENOSPC if the spill pool is full or args are too big
+    int ret = -ENOSPC;
+    zjs_port_critical_t key = zjs_port_enter_critical();
+    struct cb_spill* spill = spill_free;
+    if (spill && size32 <= CB_SPILL_WORDS) {
+        spill_free = spill->next;
+        spill->next = NULL;
+        spill->id = id;
+        spill->flags = flags;
+        spill->size32 = size32;
+        if (size32) {
+            memcpy(spill->args, args, size32 * 4);
+        }
+        if (spill_tail) {
+            spill_tail->next = spill;
+        } else {
+            spill_head = spill;
+        }
+        spill_tail = spill;
+        __atomic_store_n(&spill_count, spill_count + 1, __ATOMIC_RELAXED);
+        cb_stats.spilled++;
+        ret = 0;
+    }
+    zjs_port_exit_critical(key);
+    return ret;
+}
+
+static int queue_signal(zjs_callback_id id, uint8_t flags, void* args,
+                        uint32_t size)
+{
+    // effects: queues the signal in the ring buffer, or the spill pool if
+    //            that is full; returns 0 on success or -ENOSPC if both are
+#ifdef BUILD_MODULE_LOOPSTATS
+    // append the signal time so the wait until it is serviced can be measured
+    uint32_t words = (size + 3) / 4;
+    uint32_t stamped[words + 1];
+    if (size) {
+        memcpy(stamped, args, size);
+    }
+    stamped[words] = zjs_port_get_uptime_us();
+    args = stamped;
+    size = (words + 1) * 4;
+#endif
     DBG_PRINT("pushing item to ring buffer. id=%d, args=%p, size=%lu\n", id, args, size);
-    int ret = zjs_port_ring_buf_put(&ring_buffer,
-                                    (uint16_t)id,
-                                    0,
+    uint8_t size32 = (size + 3) / 4;
+    int ret = -EMSGSIZE;
+    // once signals spill over, keep queueing them there until the spill queue
+    //   drains so they stay in order
+    if (!__atomic_load_n(&spill_count, __ATOMIC_RELAXED)) {
+        ret = zjs_port_ring_buf_put(&ring_buffer,
+                                    CB_ID_TYPE(id),
+                                    CB_ID_VALUE(id) | flags,
                                     (uint32_t*)args,
-                                    (uint8_t)((size + 3) / 4));
+                                    size32);
+    }
+    if (ret != 0) {
+        ret = spill_signal(id, flags, (uint32_t*)args, size32);
+    }
     if (ret != 0) {
-        ERR_PRINT("error putting into ring buffer, ret=%u\n", ret);
+        DBG_PRINT("callback queue full, dropped signal for %d\n", id);
+        zjs_port_critical_t key = zjs_port_enter_critical();
+        cb_stats.dropped++;
+#ifdef BUILD_MODULE_LOOPSTATS
+        struct zjs_callback_t* cb = get_cb(id);
+        if (cb) {
+            cb->loop_stats.signals++;
+            cb->loop_stats.drops++;
+        }
+#endif
+        zjs_port_exit_critical(key);
+        return -ENOSPC;
+    }
+    zjs_loop_unblock();
+    return 0;
+}
+
+int zjs_signal_callback(zjs_callback_id id, void* args, uint32_t size)
+{
+    // only look for a coalescing callback if there are any
+    if (__atomic_load_n(&coalescing_cbs, __ATOMIC_RELAXED) &&
+        signal_coalesced(id, args, size)) {
+        return 0;
+    }
+    return queue_signal(id, 0, args, size);
+}
+
+static struct cb_payload* get_payload(const void* data)
+{
+    // effects: returns the pool entry data belongs to, or NULL if it isn't
+    //            the data of a payload in use
+    uintptr_t offset = (uintptr_t)data - (uintptr_t)payload_pool -
+                       offsetof(struct cb_payload, data);
+    if (offset >= sizeof(payload_pool) ||
+        offset % sizeof(struct cb_payload)) {
+        return NULL;
     }
+    struct cb_payload* payload = &payload_pool[offset / sizeof(struct cb_payload)];
+    return payload->state == PAYLOAD_FREE ? NULL : payload;
 }
 
+void* zjs_alloc_payload(uint32_t size)
+{
+    if (size > ZJS_PAYLOAD_SIZE) {
+        return NULL;
+    }
+    zjs_port_critical_t key = zjs_port_enter_critical();
+    struct cb_payload* payload = payload_free;
+    if (payload) {
+        payload_free = payload->next;
+        payload->state = PAYLOAD_HELD;
+        payload->size = size;
+#ifdef DEBUG_BUILD
+        payload->id = -1;
+        payload->reported = 0;
+#endif
+        cb_stats.payloads++;
+    }
+    zjs_port_exit_critical(key);
+    return payload ? payload->data : NULL;
+}
+
+void zjs_release_payload(void* data)
+{
+    zjs_port_critical_t key = zjs_port_enter_critical();
+    struct cb_payload* payload = get_payload(data);
+    if (payload) {
+        payload->state = PAYLOAD_FREE;
+        payload->next = payload_free;
+        payload_free = payload;
+        cb_stats.payloads--;
+    }
+    zjs_port_exit_critical(key);
+    if (!payload) {
+        DBG_PRINT("released payload %p is not in use\n", data);
+    }
+}
+
+uint32_t zjs_payload_size(const void* data)
+{
+    struct cb_payload* payload = get_payload(data);
+    return payload ? payload->size : 0;
+}
+
+int zjs_signal_callback_payload(zjs_callback_id id, void* data, uint32_t size)
+{
+    struct cb_payload* payload = get_payload(data);
+    if (!payload || size > ZJS_PAYLOAD_SIZE) {
+        return -EMSGSIZE;
+    }
+    payload->size = size;
+    // set before queueing, the main loop may take it right away
+    payload->state = PAYLOAD_QUEUED;
+    int ret = queue_signal(id, CB_RING_PAYLOAD, &data, sizeof(data));
+    if (ret != 0) {
+        payload->state = PAYLOAD_HELD;
+    }
+    return ret;
+}
+
+static void* claim_payload(zjs_callback_id id, uint32_t* data)
+{
+    // requires: data holds a pointer queued by zjs_signal_callback_payload()
+    //  effects: returns the payload to hand to callback id, or releases it and
+    //             returns NULL if id is gone or isn't a C callback
+    void* ptr;
+    memcpy(&ptr, data, sizeof(ptr));
+    struct cb_payload* payload = get_payload(ptr);
+    if (!payload) {
+        ERR_PRINT("bad payload %p signaled for %d\n", ptr, id);
+        return NULL;
+    }
+    struct zjs_callback_t* cb = get_cb(id);
+    if (!cb || GET_TYPE(cb->flags) != CALLBACK_TYPE_C) {
+        DBG_PRINT("no C callback %d for payload, releasing it\n", id);
+        zjs_release_payload(ptr);
+        return NULL;
+    }
+    payload->state = PAYLOAD_HELD;
+#ifdef DEBUG_BUILD
+    payload->id = id;
+    payload->delivered = zjs_port_get_uptime_us();
+#endif
+    return ptr;
+}
+
+#ifdef DEBUG_BUILD
+static void check_payload_leaks(void)
+{
+    // effects: reports payloads their callbacks have held for too long, once
+    uint32_t now = zjs_port_get_uptime_us();
+    for (int i = 0; i < ZJS_PAYLOAD_COUNT; ++i) {
+        struct cb_payload* payload = &payload_pool[i];
+        if (payload->state == PAYLOAD_HELD && payload->id != -1 &&
+            !payload->reported && now - payload->delivered > CB_PAYLOAD_LEAK_US) {
+            ERR_PRINT("payload %p given to callback %d was never released\n",
+                      payload->data, payload->id);
+            payload->reported = 1;
+        }
+    }
+}
+#else
+#define check_payload_leaks() do {} while (0)
+#endif
+
 zjs_callback_id zjs_add_c_callback(void* handle, zjs_c_callback_func callback)
 {
-    struct zjs_callback_t* new_cb = zjs_malloc(sizeof(struct zjs_callback_t));
+    struct zjs_callback_t* new_cb = alloc_record();
     if (!new_cb) {
-        DBG_PRINT("error allocating space for new callback\n");
         return -1;
     }
-    memset(new_cb, 0, sizeof(struct zjs_callback_t));
+    if (add_record(new_cb) == -1) {
+        put_record(new_cb);
+        return -1;
+    }
 
     SET_ONCE(new_cb->flags, 0);
     SET_TYPE(new_cb->flags, CALLBACK_TYPE_C);
-    new_cb->id = new_id();
     new_cb->function = callback;
     new_cb->handle = handle;
-
-    // Add callback to list
-    cb_map[new_cb->id] = new_cb;
-    if (new_cb->id >= cb_size - 1) {
-        cb_size++;
-    }
     DBG_PRINT("adding new C callback id %d\n", new_cb->id);
 
     return new_cb->id;
@@ -363,24 +987,32 @@ void print_callbacks(void)
 {
     int i;
     for (i = 0; i < cb_size; i++) {
-        if (cb_map[i]) {
-            if (GET_TYPE(cb_map[i]->flags) == CALLBACK_TYPE_JS) {
-                ZJS_PRINT("[%u] JS Callback:\n\tType: ", i);
-                if (cb_map[i]->func_list == NULL &&
-                    jerry_value_is_function(cb_map[i]->js_func)) {
+        struct zjs_callback_t* cb = cb_map[i].cb;
+        if (cb) {
+            if (GET_TYPE(cb->flags) == CALLBACK_TYPE_JS) {
+                ZJS_PRINT("[%u] JS Callback %d:\n\tType: ", i, cb->id);
+                if (GET_JS_TYPE(cb->flags) == JS_TYPE_SINGLE) {
                     ZJS_PRINT("Single Function\n");
-                    ZJS_PRINT("\tjs_func: %lu\n", cb_map[i]->js_func);
-                    ZJS_PRINT("\tonce: %u\n", GET_ONCE(cb_map[i]->flags));
+                    ZJS_PRINT("\tjs_func: %lu\n", cb->js_func);
+                    ZJS_PRINT("\tonce: %u\n", GET_ONCE(cb->flags));
                 } else {
                     ZJS_PRINT("List\n");
-                    ZJS_PRINT("\tmax_funcs: %u\n", cb_map[i]->max_funcs);
-                    ZJS_PRINT("\tmax_funcs: %u\n", cb_map[i]->num_funcs);
+                    ZJS_PRINT("\tmax_funcs: %u\n", cb->max_funcs);
+                    ZJS_PRINT("\tnum_funcs: %u\n", cb->num_funcs);
                 }
             }
+            if (cb->coalesce) {
+                ZJS_PRINT("\tcoalesced: %u\n", cb->coalesce->coalesced);
+            }
         } else {
             ZJS_PRINT("[%u] Empty\n", i);
         }
     }
+    ZJS_PRINT("live: %u, peak: %u, added: %u, removed: %u, coalesced: %u\n",
+              cb_stats.live, cb_stats.peak, cb_stats.added, cb_stats.removed,
+              cb_stats.coalesced);
+    ZJS_PRINT("payloads in use: %u of %u\n", cb_stats.payloads,
+              ZJS_PAYLOAD_COUNT);
 }
 #else
 #define print_callbacks() do {} while (0)
@@ -388,35 +1020,399 @@ void print_callbacks(void)
 
 void zjs_call_callback(zjs_callback_id id, void* data, uint32_t sz)
 {
-    if (id <= cb_size && cb_map[id]) {
-        if (GET_TYPE(cb_map[id]->flags) == CALLBACK_TYPE_JS) {
+    struct zjs_callback_t* cb = get_cb(id);
+    if (cb) {
+        if (GET_TYPE(cb->flags) == CALLBACK_TYPE_JS) {
             // Function list callback
             int i;
-            jerry_value_t ret_val;
-            if (GET_JS_TYPE(cb_map[id]->flags) == JS_TYPE_SINGLE) {
-                ret_val = jerry_call_function(cb_map[id]->js_func, cb_map[id]->this, data, sz);
+            jerry_value_t ret_val = ZJS_UNDEFINED;
+            if (GET_JS_TYPE(cb->flags) == JS_TYPE_SINGLE) {
+                ret_val = jerry_call_function(cb->js_func, cb->this, data, sz);
                 if (jerry_value_has_error_flag(ret_val)) {
                     DBG_PRINT("callback %d returned an error for function\n", id);
                 }
-            } else if (GET_JS_TYPE(cb_map[id]->flags) == JS_TYPE_LIST) {
-                for (i = 0; i < cb_map[id]->num_funcs; ++i) {
-                    ret_val = jerry_call_function(cb_map[id]->func_list[i], cb_map[id]->this, data, sz);
+            } else if (GET_JS_TYPE(cb->flags) == JS_TYPE_LIST) {
+                // a listener may remove the whole list while it runs
+                for (i = 0; cb && i < cb->num_funcs; ++i) {
+                    jerry_release_value(ret_val);
+                    ret_val = jerry_call_function(cb->func_list[i], cb->this, data, sz);
                     if (jerry_value_has_error_flag(ret_val)) {
                         DBG_PRINT("callback %d returned an error for function[%i]\n", id, i);
                     }
+                    cb = get_cb(id);
                 }
             }
-            if (cb_map[id]->post) {
-                cb_map[id]->post(cb_map[id]->handle, &ret_val);
-            }
-            if (GET_ONCE(cb_map[id]->flags)) {
-                zjs_remove_callback(id);
+            // the JS function may have removed its own callback, e.g. by
+            //   calling clearInterval(), and its record may have been reused
+            cb = get_cb(id);
+            if (cb) {
+                if (cb->post) {
+                    cb->post(cb->handle, &ret_val);
+                }
+                if (GET_ONCE(cb->flags)) {
+                    zjs_remove_callback(id);
+                }
             }
-        } else if (GET_TYPE(cb_map[id]->flags) == CALLBACK_TYPE_C && cb_map[id]->function) {
-            cb_map[id]->function(cb_map[id]->handle, data);
+            jerry_release_value(ret_val);
+        } else if (GET_TYPE(cb->flags) == CALLBACK_TYPE_C && cb->function) {
+            cb->function(cb->handle, data);
         }
     } else {
-        ERR_PRINT("callback does not exist: %d\n", id);
+        DBG_PRINT("callback does not exist: %d\n", id);
+    }
+}
+
+#ifdef BUILD_MODULE_LOOPSTATS
+static void add_to_histogram(uint32_t* histogram, uint32_t us)
+{
+    // effects: counts us in the bucket for its power of 2
+    int bucket = us ? 32 - __builtin_clz(us) : 0;
+    if (bucket >= ZJS_LOOP_STATS_BUCKETS) {
+        bucket = ZJS_LOOP_STATS_BUCKETS - 1;
+    }
+    histogram[bucket]++;
+}
+#endif
+
+static bool grow_immediates(void)
+{
+    // effects: doubles the immediate queue, keeping the entries in order
+    uint32_t limit = imm_limit ? imm_limit * 2 : IMMEDIATE_INITIAL_SIZE;
+    struct cb_immediate* queue = zjs_malloc(sizeof(struct cb_immediate) * limit);
+    if (!queue) {
+        return false;
+    }
+    for (uint32_t i = 0; i < imm_count; ++i) {
+        queue[i] = imm_queue[(imm_head + i) & (imm_limit - 1)];
+    }
+    zjs_free(imm_queue);
+    imm_queue = queue;
+    imm_limit = limit;
+    imm_head = 0;
+    return true;
+}
+
+static jerry_value_t* immediate_args(struct cb_immediate* imm)
+{
+    return imm->argc > IMMEDIATE_INLINE_ARGS ? imm->argv : imm->args;
+}
+
+static void release_immediate(struct cb_immediate* imm)
+{
+    jerry_value_t* argv = immediate_args(imm);
+    for (uint32_t i = 0; i < imm->argc; ++i) {
+        jerry_release_value(argv[i]);
+    }
+    if (imm->argc > IMMEDIATE_INLINE_ARGS) {
+        zjs_free(imm->argv);
+    }
+    if (!imm->function) {
+        jerry_release_value(imm->js_func);
+        jerry_release_value(imm->this);
+    }
+    imm->argc = 0;
+}
+
+static uint32_t queue_immediate(zjs_immediate_func function, void* handle,
+                                jerry_value_t js_func, jerry_value_t this,
+                                const jerry_value_t argv[], uint32_t argc)
+{
+    // effects: adds a call to the end of the immediate queue, acquiring the
+    //            JS values; returns its ID, or 0 if out of memory
+    if (imm_count == imm_limit && !grow_immediates()) {
+        return 0;
+    }
+    struct cb_immediate* imm = &imm_queue[(imm_head + imm_count) &
+                                          (imm_limit - 1)];
+    imm->argc = argc;
+    if (argc > IMMEDIATE_INLINE_ARGS) {
+        imm->argv = zjs_malloc(sizeof(jerry_value_t) * argc);
+        if (!imm->argv) {
+            return 0;
+        }
+    }
+    jerry_value_t* args = immediate_args(imm);
+    for (uint32_t i = 0; i < argc; ++i) {
+        args[i] = jerry_acquire_value(argv[i]);
+    }
+    imm->function = function;
+    imm->handle = handle;
+    if (!function) {
+        imm->js_func = jerry_acquire_value(js_func);
+        imm->this = jerry_acquire_value(this);
+    }
+    imm->id = imm_next_id++;
+    if (!imm_next_id) {
+        // 0 marks a cancelled entry
+        imm_next_id = 1;
+    }
+    imm_count++;
+    return imm->id;
+}
+
+uint32_t zjs_queue_immediate(zjs_immediate_func function, void* handle,
+                             const jerry_value_t argv[], uint32_t argc)
+{
+    return queue_immediate(function, handle, 0, 0, argv, argc);
+}
+
+uint32_t zjs_queue_js_immediate(jerry_value_t js_func, jerry_value_t this,
+                                const jerry_value_t argv[], uint32_t argc)
+{
+    return queue_immediate(NULL, NULL, js_func, this, argv, argc);
+}
+
+bool zjs_cancel_immediate(uint32_t id)
+{
+    for (uint32_t i = 0; id && i < imm_count; ++i) {
+        struct cb_immediate* imm = &imm_queue[(imm_head + i) & (imm_limit - 1)];
+        if (imm->id == id) {
+            release_immediate(imm);
+            imm->id = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_immediates(void)
+{
+    // effects: calls the immediates that were queued before this call, in
+    //            order; ones they queue wait for the next run, so a callback
+    //            that keeps queueing itself can't starve the loop
+    uint32_t count = imm_count;
+    while (count--) {
+        // copy it out, the queue may grow while it runs
+        struct cb_immediate imm = imm_queue[imm_head];
+        imm_head = (imm_head + 1) & (imm_limit - 1);
+        imm_count--;
+        if (!imm.id) {
+            // cancelled, already released
+            continue;
+        }
+        jerry_value_t* argv = immediate_args(&imm);
+        if (imm.function) {
+            imm.function(imm.handle, argv, imm.argc);
+        } else {
+            jerry_value_t ret = jerry_call_function(imm.js_func, imm.this,
+                                                    argv, imm.argc);
+            if (jerry_value_has_error_flag(ret)) {
+                DBG_PRINT("immediate %u returned an error\n", imm.id);
+            }
+            jerry_release_value(ret);
+        }
+        release_immediate(&imm);
+    }
+}
+
+static uint32_t dispatch_callback(zjs_callback_id id, void* data, uint32_t sz,
+                                  uint32_t signaled)
+{
+    // requires: signaled is the time in us the callback was signaled
+    //  effects: calls the callback with sz args, returns the time it took in us
+    uint32_t start = zjs_port_get_uptime_us();
+#ifdef BUILD_MODULE_LOOPSTATS
+    struct zjs_callback_t* cb = get_cb(id);
+    if (cb) {
+        cb->loop_stats.dispatches++;
+        add_to_histogram(cb->loop_stats.wait_us, start - signaled);
+    }
+#endif
+    zjs_call_callback(id, sz ? data : NULL, sz);
+    uint32_t took = zjs_port_get_uptime_us() - start;
+#ifdef BUILD_MODULE_LOOPSTATS
+    // the callback may have removed itself
+    cb = get_cb(id);
+    if (cb) {
+        add_to_histogram(cb->loop_stats.run_us, took);
+    }
+#endif
+    if (imm_count) {
+        // finish what the callback deferred before the next one runs
+        run_immediates();
+    }
+    return took;
+}
+
+static void service_coalesced(void)
+{
+    // effects: calls each pending coalescing callback once with the args
+    //            from its latest signal
+    uint32_t w;
+    for (w = 0; w < PENDING_WORDS(cb_size) &&
+         __atomic_load_n(&pending_count, __ATOMIC_RELAXED); ++w) {
+        zjs_port_critical_t key = zjs_port_enter_critical();
+        uint32_t bits = pending_map[w];
+        zjs_port_exit_critical(key);
+
+        while (bits) {
+            cb_index_t index = w * 32 + __builtin_ctz(bits);
+            uint32_t data[CB_COALESCE_MAX_SIZE / 4];
+            uint32_t size = 0, signaled = 0;
+            zjs_callback_id id = -1;
+            bits &= bits - 1;
+
+            // the callback may have been removed by the one before it
+            key = zjs_port_enter_critical();
+            if (pending_map[w] & PENDING_BIT(index)) {
+                struct zjs_callback_t* cb = cb_map[index].cb;
+                pending_map[w] &= ~PENDING_BIT(index);
+                __atomic_store_n(&pending_count, pending_count - 1,
+                                 __ATOMIC_RELAXED);
+                id = cb->id;
+                size = cb->coalesce->size;
+                signaled = cb->coalesce->signaled;
+                memcpy(data, cb->coalesce->args, size);
+            }
+            zjs_port_exit_critical(key);
+
+            if (id != -1) {
+                dispatch_callback(id, data, (size + 3) / 4, signaled);
+            }
+        }
+    }
+}
+
+static void move_class_ring(int p, uint32_t* data, uint32_t size)
+{
+    // requires: data has room for size chunks, enough for what class ring p
+    //             holds
+    //  effects: moves the signals in class ring p, in order, to a new ring in
+    //             data, freeing its old buffer if it had grown
+    struct zjs_port_ring_buf ring;
+    zjs_port_ring_buf_init(&ring, size, data);
+    while (1) {
+        uint16_t type;
+        uint8_t value, size32;
+        if (zjs_port_ring_buf_peek(&class_rings[p], &type, &value,
+                                   &size32) != 0) {
+            break;
+        }
+        uint32_t args[size32 ? size32 : 1];
+        zjs_port_ring_buf_get(&class_rings[p], &type, &value, args, &size32);
+        zjs_port_ring_buf_put(&ring, type, value, args, size32);
+    }
+    zjs_free(class_grown[p]);
+    class_grown[p] = data == class_buffers[p] ? NULL : data;
+    class_rings[p] = ring;
+    class_sizes[p] = size;
+}
+
+static bool class_has_space(zjs_callback_id id, uint8_t size32)
+{
+    // effects: returns true if the ring for the priority class of callback id
+    //            has room for a signal with size32 chunks of args, growing it
+    //            if need be, or if id is gone and its signal will be dropped;
+    //            only the class's own ring matters, so a class that can't
+    //            keep up doesn't hold up signals for the others
+    struct zjs_callback_t* cb = get_cb(id);
+    if (!cb) {
+        return true;
+    }
+    int p = cb->priority;
+    while (zjs_port_ring_buf_space_get(&class_rings[p]) < size32 + 1) {
+        uint32_t size = class_sizes[p] * 2;
+        uint32_t* data = size <= CB_CLASS_RING_MAX ?
+                         zjs_malloc(sizeof(uint32_t) * size) : NULL;
+        if (!data) {
+            return false;
+        }
+        DBG_PRINT("class %d ring full, increasing to %u\n", p, size);
+        move_class_ring(p, data, size);
+    }
+    return true;
+}
+
+static void shrink_class_rings(void)
+{
+    // effects: puts class rings that grew and have since drained back in
+    //            their static buffers
+    for (int p = 0; p < ZJS_PRIORITY_COUNT; ++p) {
+        if (class_grown[p] && zjs_port_ring_buf_is_empty(&class_rings[p])) {
+            move_class_ring(p, class_buffers[p], CB_CLASS_RING_SIZE);
+        }
+    }
+}
+
+static void stage_signal(zjs_callback_id id, uint8_t flags, uint32_t* data,
+                         uint8_t size32)
+{
+    // requires: class_has_space(id, size32)
+    //  effects: queues the signal in the ring for its priority class
+    struct zjs_callback_t* cb = get_cb(id);
+    if (!cb) {
+        // removed since it was signaled
+        if (flags & CB_RING_PAYLOAD) {
+            claim_payload(id, data);
+        }
+        return;
+    }
+#ifdef BUILD_MODULE_LOOPSTATS
+    // signalers count coalesced and dropped signals here too
+    zjs_port_critical_t key = zjs_port_enter_critical();
+    cb->loop_stats.signals++;
+    zjs_port_exit_critical(key);
+#endif
+    zjs_port_ring_buf_put(&class_rings[cb->priority], CB_ID_TYPE(id),
+                          CB_ID_VALUE(id) | flags, data, size32);
+}
+
+static bool stage_spilled(void)
+{
+    // effects: moves signals from the spill queue to the ring for their
+    //            callback's priority class; returns false if some were left
+    //            because a class ring was full
+    while (__atomic_load_n(&spill_count, __ATOMIC_RELAXED)) {
+        zjs_port_critical_t key = zjs_port_enter_critical();
+        struct cb_spill* spill = spill_head;
+        zjs_port_exit_critical(key);
+        // only the main loop takes entries off the head, so it stays put
+        if (!class_has_space(spill->id, spill->size32)) {
+            return false;
+        }
+        key = zjs_port_enter_critical();
+        spill_head = spill->next;
+        if (!spill_head) {
+            spill_tail = NULL;
+        }
+        zjs_port_exit_critical(key);
+
+        stage_signal(spill->id, spill->flags, spill->args, spill->size32);
+
+        key = zjs_port_enter_critical();
+        spill->next = spill_free;
+        spill_free = spill;
+        __atomic_store_n(&spill_count, spill_count - 1, __ATOMIC_RELAXED);
+        zjs_port_exit_critical(key);
+    }
+    return true;
+}
+
+static bool stage_signals(void)
+{
+    // effects: moves signals from the ring buffer, then the spill queue, to
+    //            the ring for their callback's priority class; returns false
+    //            if some were left because a class ring was full
+    while (1) {
+        uint16_t type;
+        uint8_t value, size;
+        if (zjs_port_ring_buf_peek(&ring_buffer, &type, &value, &size) != 0) {
+            // no more items in ring buffer
+            return stage_spilled();
+        }
+        zjs_callback_id id = CB_ID_FROM_RING(type, value);
+        if (!class_has_space(id, size)) {
+            return false;
+        }
+
+        uint32_t data[size ? size : 1];
+        int ret = zjs_port_ring_buf_get(&ring_buffer, &type, &value, data,
+                                        &size);
+        if (ret != 0) {
+            ERR_PRINT("error pulling from ring buffer: ret = %u\n", ret);
+            return true;
+        }
+        stage_signal(id, value & CB_RING_PAYLOAD, data, size);
     }
 }
 
@@ -427,64 +1423,153 @@ void zjs_service_callbacks(void)
         uint8_t header_printed = 0;
         uint32_t num_callbacks = 0;
 #endif
-        uint16_t count = 0;
-        while (count++ < ZJS_MAX_CB_LOOP_ITERATION) {
-            int ret;
-            uint16_t id;
-            uint8_t value;
-            uint8_t size = 0;
-            // setting size = 0 will check if there is an item in the ring buffer
-            ret = zjs_port_ring_buf_get(&ring_buffer,
-                                        &id,
-                                        &value,
-                                        NULL,
-                                        &size);
-            if (ret == -EMSGSIZE || ret == 0) {
-                // item in ring buffer with size > 0, has args
-                // pull from ring buffer
+        uint32_t start = zjs_port_get_uptime_us();
+        if (imm_count) {
+            // queued by the script, or another caller of zjs_call_callback()
+            run_immediates();
+        }
+        bool more = !stage_signals();
+        if (__atomic_load_n(&coalescing_cbs, __ATOMIC_RELAXED)) {
+            // these came from ISRs or other threads, handle them first
+            service_coalesced();
+        }
+
+        for (int p = 0; p < ZJS_PRIORITY_COUNT; ++p) {
+            bool first = true;
+            while (!zjs_port_ring_buf_is_empty(&class_rings[p])) {
+                uint32_t now = zjs_port_get_uptime_us();
+                if (!first && now - start + class_avg_us[p] >
+                    ZJS_CALLBACK_BUDGET_US) {
+                    // the next call would likely go over the budget
+                    more = true;
+                    break;
+                }
+
+                int ret;
+                uint16_t type;
+                uint8_t value;
+                uint8_t size = 0;
+                // setting size = 0 will check if there is an item in the ring
+                ret = zjs_port_ring_buf_get(&class_rings[p], &type, &value,
+                                            NULL, &size);
                 uint8_t sz = size;
                 jerry_value_t data[sz];
                 if (ret == -EMSGSIZE) {
-                    ret = zjs_port_ring_buf_get(&ring_buffer,
-                                                &id,
-                                                &value,
-                                                (uint32_t*)data,
-                                                &sz);
-                    if (ret != 0) {
-                        ERR_PRINT("error pulling from ring buffer: ret = %u\n", ret);
-                        break;
+                    ret = zjs_port_ring_buf_get(&class_rings[p], &type, &value,
+                                                (uint32_t*)data, &sz);
+                }
+                if (ret != 0) {
+                    ERR_PRINT("error pulling from ring buffer: ret = %u\n", ret);
+                    break;
+                }
+                zjs_callback_id id = CB_ID_FROM_RING(type, value);
+                uint32_t signaled = now;
+#ifdef BUILD_MODULE_LOOPSTATS
+                // strip the signal time zjs_signal_callback() added
+                signaled = data[--sz];
+#endif
+                void* args = data;
+                if (value & CB_RING_PAYLOAD) {
+                    // the callback gets the payload itself
+                    args = claim_payload(id, (uint32_t*)data);
+                    if (!args) {
+                        continue;
                     }
-                    DBG_PRINT("calling callback with args. id=%u, args=%p, sz=%u, ret=%i\n", id, data, sz, ret);
-                    zjs_call_callback(id, data, sz);
-                } else if (ret == 0) {
-                    // item in ring buffer with size == 0, no args
-                    DBG_PRINT("calling callback with no args, original vals id=%u, size=%u, ret=%i\n", id, size, ret);
-                    zjs_call_callback(id, NULL, 0);
                 }
+                DBG_PRINT("calling callback. id=%d, args=%p, sz=%u\n", id,
+                          args, sz);
+                uint32_t took = dispatch_callback(id, args, sz, signaled);
+                first = false;
+
+                // track how long this class's callbacks take
+                class_avg_us[p] += ((int32_t)took - (int32_t)class_avg_us[p]) / 8;
 #ifdef ZJS_PRINT_CALLBACK_STATS
                 if (!header_printed) {
-                    PRINT("\n--------- Callback Stats ------------\n");
+                    ZJS_PRINT("\n--------- Callback Stats ------------\n");
                     header_printed = 1;
                 }
-                if (cb_map[id]) {
-                    PRINT("[cb stats] Callback[%u]: type=%s, arg_sz=%u\n",
-                            id,
-                            (cb_map[id]->type == CALLBACK_TYPE_JS) ? "JS" : "C",
-                            size);
-                }
+                ZJS_PRINT("[cb stats] Callback[%d]: priority=%d, arg_sz=%u, "
+                          "time=%uus\n", id, p, sz, took);
                 num_callbacks++;
 #endif
-            } else {
-                // no more items in ring buffer
-                break;
             }
         }
+
+        if (more || imm_count) {
+            // there are more items waiting, don't let the loop block
+            zjs_loop_unblock();
+        }
+        shrink_class_rings();
+        check_payload_leaks();
 #ifdef ZJS_PRINT_CALLBACK_STATS
         if (num_callbacks) {
-            PRINT("[cb stats] Number of Callbacks (this service): %lu\n", num_callbacks);
-            PRINT("[cb stats] Max Callbacks Per Service: %u\n", ZJS_MAX_CB_LOOP_ITERATION);
-            PRINT("------------- End ----------------\n");
+            ZJS_PRINT("[cb stats] Number of Callbacks (this service): %u\n", num_callbacks);
+            ZJS_PRINT("[cb stats] Service time: %uus of %uus budget\n",
+                      zjs_port_get_uptime_us() - start, ZJS_CALLBACK_BUDGET_US);
+            ZJS_PRINT("[cb stats] Live: %u, Peak: %u\n", cb_stats.live, cb_stats.peak);
+            ZJS_PRINT("------------- End ----------------\n");
         }
 #endif
     }
 }
+
+void zjs_callbacks_cleanup(void)
+{
+    ring_buf_initialized = 0;
+
+    for (uint32_t i = 0; i < imm_count; ++i) {
+        struct cb_immediate* imm = &imm_queue[(imm_head + i) & (imm_limit - 1)];
+        if (imm->id) {
+            release_immediate(imm);
+        }
+    }
+    zjs_free(imm_queue);
+    imm_queue = NULL;
+    imm_limit = imm_head = imm_count = 0;
+
+    for (cb_index_t i = 0; i < cb_size; ++i) {
+        if (cb_map[i].cb) {
+            zjs_remove_callback(cb_map[i].cb->id);
+        }
+    }
+    for (int p = 0; p < ZJS_PRIORITY_COUNT; ++p) {
+        zjs_free(class_grown[p]);
+        class_grown[p] = NULL;
+    }
+
+    // the records themselves stay in their slabs, which are never freed;
+    //   with an empty map, IDs modules still hold no longer match anything
+    zjs_port_critical_t key = zjs_port_enter_critical();
+    struct cb_slot* old_map = cb_map;
+    uint32_t* old_pending = pending_map;
+    cb_map = NULL;
+    pending_map = NULL;
+    cb_size = cb_limit = 0;
+    free_slots = CB_NO_SLOT;
+    zjs_port_exit_critical(key);
+    zjs_free(old_map);
+    zjs_free(old_pending);
+}
+
+void zjs_loop_block(int32_t time)
+{
+    if (imm_count) {
+        // immediates were queued outside of zjs_service_callbacks()
+        return;
+    }
+#ifdef ZJS_LINUX_BUILD
+    if (zjs_port_is_virtual_time() && time != ZJS_TICKS_FOREVER) {
+        // unless there is work already, skip the wait on the virtual clock
+        if (zjs_port_sem_take(&loop_sem, ZJS_TICKS_NONE) != 0) {
+            zjs_port_advance_virtual_time((uint64_t)time * 1000);
+        }
+        return;
+    }
+#endif
+    zjs_port_sem_take(&loop_sem, time);
+}
+
+void zjs_loop_unblock(void)
+{
+    zjs_port_sem_give(&loop_sem);
+}
@@ -11,6 +11,24 @@ typedef int32_t zjs_callback_id;
 typedef int16_t zjs_callback_id;
 #endif
 
+// size in bytes of each buffer in the payload pool, the most that can be
+//   passed with zjs_signal_callback_payload()
+#ifndef ZJS_PAYLOAD_SIZE
+#ifdef ZJS_LINUX_BUILD
+#define ZJS_PAYLOAD_SIZE    1024
+#else
+#define ZJS_PAYLOAD_SIZE    64
+#endif
+#endif
+// number of buffers in the payload pool
+#ifndef ZJS_PAYLOAD_COUNT
+#ifdef ZJS_LINUX_BUILD
+#define ZJS_PAYLOAD_COUNT   16
+#else
+#define ZJS_PAYLOAD_COUNT   4
+#endif
+#endif
+
 /*
  * Function that will be called BEFORE the JS function is called.
  * This should return an array of jerry_value_t's that contain
@@ -41,11 +59,90 @@ typedef void (*zjs_post_callback_func)(void* handle, jerry_value_t* ret_val);
  */
 typedef void (*zjs_c_callback_func)(void* handle, void* args);
 
+/*
+ * Function definition for an immediate, see zjs_queue_immediate()
+ *
+ * @param handle        Handle given to zjs_queue_immediate()
+ * @param argv          Args given to zjs_queue_immediate()
+ * @param argc          Number of args
+ */
+typedef void (*zjs_immediate_func)(void* handle, const jerry_value_t argv[],
+                                   uint32_t argc);
+
+/*
+ * Callbacks are serviced in order of priority class, and in the order they
+ * were signaled within a class.
+ */
+enum zjs_callback_priority {
+    ZJS_PRIORITY_ISR,           // signaled from an ISR, e.g. GPIO or UART
+    ZJS_PRIORITY_IO,            // I/O completions, the default
+    ZJS_PRIORITY_TIMER,         // timer expirations
+    ZJS_PRIORITY_BACKGROUND,    // bulk work that can wait
+    ZJS_PRIORITY_COUNT
+};
+
+struct zjs_callback_stats {
+    uint32_t live;      // callbacks currently registered
+    uint32_t peak;      // most callbacks registered at once
+    uint32_t added;     // callbacks registered since init
+    uint32_t removed;   // callbacks removed since init
+    uint32_t coalesced; // signals folded into an already pending call
+    uint32_t spilled;   // signals queued in the spill pool, ring buffer full
+    uint32_t dropped;   // signals lost, ring buffer and spill pool full
+    uint32_t payloads;  // payload buffers allocated and not yet released
+};
+
+#ifdef BUILD_MODULE_LOOPSTATS
+// histogram bucket 0 counts times of 0us, bucket n times from 2^(n-1) to
+//   2^n - 1 us, and the last bucket all longer times
+#define ZJS_LOOP_STATS_BUCKETS  16
+
+struct zjs_callback_loop_stats {
+    uint32_t signals;       // times signaled
+    uint32_t dispatches;    // times called
+    uint32_t drops;         // signals lost because the ring buffer was full
+    uint32_t wait_us[ZJS_LOOP_STATS_BUCKETS];   // from signal to call
+    uint32_t run_us[ZJS_LOOP_STATS_BUCKETS];    // time spent in the callback
+};
+
+typedef void (*zjs_loop_stats_func)(zjs_callback_id id, uint8_t priority,
+                                    const struct zjs_callback_loop_stats* stats,
+                                    void* data);
+
+/*
+ * Call func with the loop stats of each registered callback
+ *
+ * @param func          Function to call
+ * @param data          Passed through to func
+ */
+void zjs_foreach_loop_stats(zjs_loop_stats_func func, void* data);
+
+/*
+ * Clear the loop stats of all registered callbacks
+ */
+void zjs_reset_loop_stats(void);
+#endif
+
 /*
  * Initialize the callback module
  */
 void zjs_init_callbacks(void);
 
+/*
+ * Remove every callback and cancel every queued immediate, releasing the JS
+ * values they hold, and free the callback map and immediate queue; call it
+ * before zjs_modules_cleanup() and jerry_cleanup(). IDs given out before this
+ * no longer match any callback; the callback module can't be used after it.
+ */
+void zjs_callbacks_cleanup(void);
+
+/*
+ * Get callback registration counts, e.g. to check for callback leaks
+ *
+ * @param stats[out]    Filled in with the current counts
+ */
+void zjs_get_callback_stats(struct zjs_callback_stats* stats);
+
 /*
  * Get the number of callback functions registered to this ID
  *
@@ -152,15 +249,138 @@ void zjs_remove_callback(zjs_callback_id id);
  * immediately, but rather once the system has time to service the callback
  * module; this allows the system to fairly share CPU time as well as prevent
  * large recursion loops. Signaling a callback will cause the callback to be
- * called only once, and will NOT remove the callback from the list. You can
- * signal callbacks multiple times, but if the callback has not been serviced
- * between signaling, it will only get called once.
+ * called only once, and will NOT remove the callback from the list. Each
+ * signal queues its own call with a copy of args, unless the callback was set
+ * up with zjs_set_callback_coalescing(); then, if it has not been serviced
+ * between signals, it will only get called once, with the latest args.
+ *
+ * On Linux this is safe to call from any thread; on Zephyr it may be called
+ * from an ISR. On Linux, a signal that fits in the ring buffer takes no locks,
+ * and only wakes the main loop if it is asleep; once the ring buffer is full,
+ * and for coalescing callbacks, it enters the port critical section.
  *
  * @param id            ID returned from zjs_add_callback
  * @param args          Arguments given to the JS/C callback
  * @param size          Size of arguments (in bytes)
+ *
+ * @return              0 if queued, -ENOSPC if the queue was full and the
+ *                        signal was dropped; producers that can hold on to
+ *                        their data should stop and retry later
+ */
+int zjs_signal_callback(zjs_callback_id id, void* args, uint32_t size);
+
+/*
+ * Get a buffer from the payload pool to fill in and pass by reference with
+ * zjs_signal_callback_payload(). Safe to call from the same contexts as
+ * zjs_signal_callback().
+ *
+ * @param size          Bytes needed, up to ZJS_PAYLOAD_SIZE
+ *
+ * @return              Buffer, or NULL if size is too big or the pool is empty
+ */
+void* zjs_alloc_payload(uint32_t size);
+
+/*
+ * Give a payload buffer back to the pool
+ *
+ * @param payload       Buffer from zjs_alloc_payload()
  */
-void zjs_signal_callback(zjs_callback_id id, void* args, uint32_t size);
+void zjs_release_payload(void* payload);
+
+/*
+ * Get the size of a payload, as given to zjs_signal_callback_payload(), or
+ * zjs_alloc_payload() if it hasn't been signaled
+ *
+ * @param payload       Buffer from zjs_alloc_payload()
+ *
+ * @return              Size in bytes
+ */
+uint32_t zjs_payload_size(const void* payload);
+
+/*
+ * Signal a C callback with a payload buffer. Unlike zjs_signal_callback() the
+ * data is not copied into the ring buffer: only the pointer is queued, and
+ * the callback gets the buffer itself as its args. Ownership passes with it,
+ * the callback must call zjs_release_payload() once it is done with the data,
+ * which may be after it returns. If the callback is removed before it is
+ * called, the payload is released for it. Payloads are never coalesced.
+ *
+ * Debug builds report payloads that are still held a second after they were
+ * handed to their callback.
+ *
+ * @param id            ID returned from zjs_add_c_callback
+ * @param payload       Buffer from zjs_alloc_payload()
+ * @param size          Size of the data in the buffer (in bytes)
+ *
+ * @return              0 if queued, -EMSGSIZE if size is too big, -ENOSPC if
+ *                        the queue was full; on error the caller still owns
+ *                        the payload
+ */
+int zjs_signal_callback_payload(zjs_callback_id id, void* payload,
+                                uint32_t size);
+
+/*
+ * Queue a C function to be called as soon as the current callback returns,
+ * before any other callback is serviced. Immediates run in the order they
+ * were queued; ones queued by an immediate run after the next callback, or on
+ * the next time around the main loop. This is much cheaper than a 0 ms timer:
+ * entries come from a queue that only allocates when it grows, or for more
+ * than 3 args. Only call this from the main thread.
+ *
+ * @param function      Function to call
+ * @param handle        Passed through to function
+ * @param argv          Args for function, acquired until it returns
+ * @param argc          Number of args
+ *
+ * @return              ID to cancel it with, or 0 if out of memory
+ */
+uint32_t zjs_queue_immediate(zjs_immediate_func function, void* handle,
+                             const jerry_value_t argv[], uint32_t argc);
+
+/*
+ * Queue a JS function to be called like zjs_queue_immediate()
+ *
+ * @param js_func       JS function to call
+ * @param this          'this' for the call
+ * @param argv          Args for js_func, acquired until it returns
+ * @param argc          Number of args
+ *
+ * @return              ID to cancel it with, or 0 if out of memory
+ */
+uint32_t zjs_queue_js_immediate(jerry_value_t js_func, jerry_value_t this,
+                                const jerry_value_t argv[], uint32_t argc);
+
+/*
+ * Cancel an immediate that hasn't run yet
+ *
+ * @param id            ID returned from zjs_queue_immediate()
+ *
+ * @return              True if it was cancelled
+ */
+bool zjs_cancel_immediate(uint32_t id);
+
+/*
+ * Set the priority class a callback is serviced in, ZJS_PRIORITY_IO unless
+ * set otherwise
+ *
+ * @param id            ID returned from zjs_add_callback
+ * @param priority      Priority class
+ */
+void zjs_set_callback_priority(zjs_callback_id id,
+                               enum zjs_callback_priority priority);
+
+/*
+ * Coalesce signals to a callback: rather than queueing a call per signal, the
+ * callback is marked pending and called once per service with the args of the
+ * latest signal. Use this for events where only the latest value matters,
+ * like sensor readings, so bursts can't flood the ring buffer.
+ *
+ * @param id            ID returned from zjs_add_callback
+ * @param max_size      Largest args that will be signaled (in bytes), up to 64
+ *
+ * @return              True on success
+ */
+bool zjs_set_callback_coalescing(zjs_callback_id id, uint32_t max_size);
 
 /*
  * Add/register a C callback
@@ -190,4 +410,20 @@ void zjs_call_callback(zjs_callback_id id, void* data, uint32_t sz);
  */
 void zjs_service_callbacks(void);
 
+/*
+ * Block the main loop until a callback is signaled or the given time passes,
+ * whichever comes first. Signaling a callback, from any context, wakes the
+ * loop early.
+ *
+ * @param time          Max time to block in ms, ZJS_TICKS_FOREVER for no limit
+ */
+void zjs_loop_block(int32_t time);
+
+/*
+ * Wake the main loop if it is blocked in zjs_loop_block(), or cause the next
+ * call to return immediately. Use this when new work is added that the loop
+ * does not know about yet, e.g. a new timer with an earlier deadline.
+ */
+void zjs_loop_unblock(void);
+
 #endif /* SRC_ZJS_CALLBACKS_H_ */
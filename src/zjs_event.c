@@ -1,79 +1,185 @@
+#include <string.h>
+
 #include "zjs_event.h"
 #include "zjs_callbacks.h"
 
 #define ZJS_MAX_EVENT_NAME_SIZE     24
 #define DEFAULT_MAX_LISTENERS       10
-#ifdef DEBUG_BUILD
-#define HIDDEN_PROP(n) n
-#else
-#define HIDDEN_PROP(n) "\377" n
-#endif
+// initial number of slots in an emitter's name table, must be a power of 2
+#define EVENT_INITIAL_SLOTS         4
+// how far up the prototype chain to look for an emitter
+#define EVENT_MAX_DEPTH             8
 
 static jerry_value_t zjs_event_emitter_prototype;
 
+// One event name of an emitter. Names are copied in once when the first
+// listener is added, so looking one up never creates a JS string.
+struct event_slot {
+    uint32_t hash;              // 0 for an unused slot
+    zjs_callback_id id;         // listener list, -1 if all were removed
+    char name[ZJS_MAX_EVENT_NAME_SIZE + 1];
+};
+
+// Emitter state, kept as the native handle of the emitter object
 struct event {
-    int num_events;
-    jerry_value_t map;
     int max_listeners;
+    uint16_t used;              // slots with a name
+    uint16_t size;              // power of 2
+    struct event_slot* slots;
 };
 
+// Deferred event that needs a post call after the listeners run
 struct event_trigger {
-    void* handle;
+    zjs_callback_id id;
     zjs_post_event post;
+    void* handle;
 };
 
-struct event_names {
-    jerry_value_t name_array;
-    int idx;
-};
+static uint32_t hash_name(const char* name)
+{
+    // effects: returns the FNV-1a hash of name, never 0
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash ? hash : 1;
+}
 
-void post_event(void* h, jerry_value_t* ret_val)
+static struct event_slot* find_slot(struct event* ev, const char* name,
+                                    uint32_t hash)
 {
-    struct event_trigger* trigger = (struct event_trigger*)h;
-    if (trigger) {
-        if (trigger->post) {
-            trigger->post(trigger->handle);
+    // effects: returns the slot for name, or the empty slot where it belongs
+    uint32_t mask = ev->size - 1;
+    uint32_t i = hash & mask;
+    while (ev->slots[i].hash) {
+        if (ev->slots[i].hash == hash && !strcmp(ev->slots[i].name, name)) {
+            break;
         }
-        zjs_free(trigger);
+        i = (i + 1) & mask;
     }
+    return &ev->slots[i];
 }
 
-void zjs_add_event_listener(jerry_value_t obj, const char* event, jerry_value_t listener)
+static struct event_slot* lookup_event(struct event* ev, const char* name)
 {
-    struct event* ev;
+    // effects: returns the slot for name if it has a listener list, else NULL
+    struct event_slot* slot = find_slot(ev, name, hash_name(name));
+    return (slot->hash && slot->id != -1) ? slot : NULL;
+}
 
-    jerry_value_t event_emitter = zjs_get_property(obj, HIDDEN_PROP("event"));
-    if (!jerry_get_object_native_handle(event_emitter, (uintptr_t*)&ev)) {
-        DBG_PRINT("native handle not found\n");
-        return;
+static bool grow_slots(struct event* ev)
+{
+    // effects: doubles the name table, keeping all names; returns false if
+    //            out of memory
+    uint16_t old_size = ev->size;
+    struct event_slot* old = ev->slots;
+    struct event_slot* slots = zjs_malloc(sizeof(struct event_slot) *
+                                          old_size * 2);
+    if (!slots) {
+        return false;
     }
-    if (ev->num_events >= ev->max_listeners) {
-        DBG_PRINT("max listeners reached\n");
-        return;
+    memset(slots, 0, sizeof(struct event_slot) * old_size * 2);
+    ev->slots = slots;
+    ev->size = old_size * 2;
+    for (int i = 0; i < old_size; ++i) {
+        if (old[i].hash) {
+            *find_slot(ev, old[i].name, old[i].hash) = old[i];
+        }
     }
+    zjs_free(old);
+    return true;
+}
 
-    // Event object to hold callback ID and eventually listener arguments
-    jerry_value_t event_obj = zjs_get_property(ev->map, event);
-    if (!jerry_value_is_object(event_obj)) {
-        event_obj = jerry_create_object();
+static struct event* find_event(jerry_value_t obj)
+{
+    // effects: returns the emitter state of obj, or NULL if it isn't an
+    //            emitter; it can be inherited, e.g. from an emitter used as
+    //            a prototype
+    // native handles belong to whichever module set them, so only trust one
+    //   on an object that has the emitter prototype above it
+    struct event* ev = NULL;
+    jerry_value_t cur = jerry_acquire_value(obj);
+    for (int i = 0; i < EVENT_MAX_DEPTH && jerry_value_is_object(cur); ++i) {
+        if (cur == zjs_event_emitter_prototype) {
+            jerry_release_value(cur);
+            return ev;
+        }
+        if (!ev && !jerry_get_object_native_handle(cur, (uintptr_t*)&ev)) {
+            ev = NULL;
+        }
+        jerry_value_t proto = jerry_get_prototype(cur);
+        jerry_release_value(cur);
+        cur = proto;
     }
+    jerry_release_value(cur);
+    DBG_PRINT("not an event emitter\n");
+    return NULL;
+}
 
-    int32_t callback_id = -1;
-    jerry_value_t id_prop = zjs_get_property(event_obj, "callback_id");
-    if (jerry_value_is_number(id_prop)) {
-        // If there already is an event object, get the callback ID
-        zjs_obj_get_int32(event_obj, "callback_id", &callback_id);
+static bool get_event_name(jerry_value_t val, char* name)
+{
+    // requires: name has room for ZJS_MAX_EVENT_NAME_SIZE + 1 bytes
+    //  effects: copies the string val into name; returns false if val isn't a
+    //             string or is too long to be an event name
+    if (!jerry_value_is_string(val)) {
+        return false;
+    }
+    jerry_size_t sz = jerry_get_string_size(val);
+    if (sz > ZJS_MAX_EVENT_NAME_SIZE) {
+        DBG_PRINT("event name is too long\n");
+        return false;
+    }
+    jerry_size_t len = jerry_string_to_char_buffer(val, (jerry_char_t*)name,
+                                                   sz);
+    if (len != sz) {
+        DBG_PRINT("size mismatch\n");
+        return false;
     }
-    callback_id = zjs_add_callback_list(listener, obj, ev, post_event, callback_id);
+    name[len] = '\0';
+    return true;
+}
 
-    // Add callback ID to event object
-    zjs_obj_add_number(event_obj, callback_id, "callback_id");
-    // Add event object to master event listener
-    zjs_set_property(ev->map, event, event_obj);
+void zjs_add_event_listener(jerry_value_t obj, const char* event, jerry_value_t listener)
+{
+    struct event* ev = find_event(obj);
+    if (!ev) {
+        return;
+    }
+    if (strlen(event) > ZJS_MAX_EVENT_NAME_SIZE) {
+        DBG_PRINT("event name is too long\n");
+        return;
+    }
 
-    DBG_PRINT("added listener, callback id = %ld\n", callback_id);
+    uint32_t hash = hash_name(event);
+    struct event_slot* slot = find_slot(ev, event, hash);
+    if (!slot->hash) {
+        // keep at least a quarter of the slots empty so probes stay short
+        if ((ev->used + 1) * 4 > ev->size * 3) {
+            if (!grow_slots(ev)) {
+                DBG_PRINT("could not grow event table, out of memory\n");
+                return;
+            }
+            slot = find_slot(ev, event, hash);
+        }
+        slot->hash = hash;
+        slot->id = -1;
+        strcpy(slot->name, event);
+        ev->used++;
+    } else if (zjs_get_num_callbacks(slot->id) >= ev->max_listeners) {
+        DBG_PRINT("max listeners reached\n");
+        return;
+    }
 
-    ev->num_events++;
+    zjs_callback_id id = zjs_add_callback_list(listener, obj, NULL, NULL,
+                                               slot->id);
+    if (id == -1) {
+        DBG_PRINT("could not add listener\n");
+        return;
+    }
+    slot->id = id;
+
+    DBG_PRINT("added listener, callback id = %ld\n", id);
 }
 
 static jerry_value_t add_listener(const jerry_value_t function_obj,
@@ -81,26 +187,15 @@ static jerry_value_t add_listener(const jerry_value_t function_obj,
                                   const jerry_value_t argv[],
                                   const jerry_length_t argc)
 {
-    if (!jerry_value_is_string(argv[0])) {
+    char name[ZJS_MAX_EVENT_NAME_SIZE + 1];
+    if (argc < 1 || !get_event_name(argv[0], name)) {
         DBG_PRINT("first parameter must be event string\n");
         return jerry_acquire_value(this);
     }
-    if (!jerry_value_is_function(argv[1])) {
+    if (argc < 2 || !jerry_value_is_function(argv[1])) {
         DBG_PRINT("second parameter must be a listener function\n");
         return jerry_acquire_value(this);
     }
-    int sz = jerry_get_string_size(argv[0]);
-    if (sz > ZJS_MAX_EVENT_NAME_SIZE) {
-        DBG_PRINT("event name is too long\n");
-        return jerry_acquire_value(this);
-    }
-    char name[sz];
-    int len = jerry_string_to_char_buffer(argv[0], (jerry_char_t *)name, sz);
-    if (len != sz) {
-        DBG_PRINT("size mismatch\n");
-        return jerry_acquire_value(this);
-    }
-    name[len] = '\0';
 
     zjs_add_event_listener(this, name, argv[1]);
 
@@ -112,18 +207,11 @@ static jerry_value_t emit_event(const jerry_value_t function_obj,
                                 const jerry_value_t argv[],
                                 const jerry_length_t argc)
 {
-    if (!jerry_value_is_string(argv[0])) {
-        DBG_PRINT("parameter is not a string\n");
-        return jerry_acquire_value(this);
-    }
-    int sz = jerry_get_string_size(argv[0]);
-    char event[sz];
-    int len = jerry_string_to_char_buffer(argv[0], (jerry_char_t *)event, sz);
-    if (len != sz) {
-        DBG_PRINT("size mismatch\n");
-        return jerry_acquire_value(this);
+    char event[ZJS_MAX_EVENT_NAME_SIZE + 1];
+    if (argc < 1 || !get_event_name(argv[0], event)) {
+        DBG_PRINT("parameter is not an event string\n");
+        return jerry_create_boolean(false);
     }
-    event[len] = '\0';
 
     return jerry_create_boolean(zjs_trigger_event(this,
                                                   event,
@@ -138,48 +226,27 @@ static jerry_value_t remove_listener(const jerry_value_t function_obj,
                                      const jerry_value_t argv[],
                                      const jerry_length_t argc)
 {
-    struct event* ev;
-
-    jerry_value_t event_emitter = zjs_get_property(this, HIDDEN_PROP("event"));
-    if (!jerry_get_object_native_handle(event_emitter, (uintptr_t*)&ev)) {
-        DBG_PRINT("native handle not found\n");
+    struct event* ev = find_event(this);
+    if (!ev) {
         return jerry_acquire_value(this);
     }
-    if (!jerry_value_is_string(argv[0])) {
+    char event[ZJS_MAX_EVENT_NAME_SIZE + 1];
+    if (argc < 1 || !get_event_name(argv[0], event)) {
         DBG_PRINT("event name must be first parameter\n");
         return jerry_acquire_value(this);
     }
-    if (!jerry_value_is_function(argv[1])) {
+    if (argc < 2 || !jerry_value_is_function(argv[1])) {
         DBG_PRINT("event listener must be second parameter\n");
         return jerry_acquire_value(this);
     }
-    int sz = jerry_get_string_size(argv[0]);
-    char event[sz];
-    int len = jerry_string_to_char_buffer(argv[0], (jerry_char_t *)event, sz);
-    if (len != sz) {
-        DBG_PRINT("size mismatch\n");
-        return jerry_acquire_value(this);
-    }
-    event[len] = '\0';
 
-    // Event object to hold callback ID and eventually listener arguments
-    jerry_value_t event_obj = zjs_get_property(ev->map, event);
-    if (!jerry_value_is_object(event_obj)) {
-        DBG_PRINT("event object not found for '%s'\n", event);
-        return jerry_acquire_value(this);
-    }
-
-    int32_t callback_id = -1;
-    jerry_value_t id_prop = zjs_get_property(event_obj, "callback_id");
-    if (jerry_value_is_number(id_prop)) {
-        // If there already is an event object, get the callback ID
-        zjs_obj_get_int32(event_obj, "callback_id", &callback_id);
-    } else {
-        DBG_PRINT("callback_id not found for '%s'\n", event);
-        return jerry_acquire_value(this);
+    struct event_slot* slot = lookup_event(ev, event);
+    if (!slot) {
+        DBG_PRINT("no listeners for '%s'\n", event);
+        return jerry_create_boolean(false);
     }
 
-    bool removed = zjs_remove_callback_list_func(callback_id, argv[1]);
+    bool removed = zjs_remove_callback_list_func(slot->id, argv[1]);
 
     return jerry_create_boolean(removed);
 }
@@ -189,83 +256,53 @@ static jerry_value_t remove_all_listeners(const jerry_value_t function_obj,
                                           const jerry_value_t argv[],
                                           const jerry_length_t argc)
 {
-    struct event* ev;
-
-    jerry_value_t event_emitter = zjs_get_property(this, HIDDEN_PROP("event"));
-    if (!jerry_get_object_native_handle(event_emitter, (uintptr_t*)&ev)) {
-        DBG_PRINT("native handle not found\n");
+    struct event* ev = find_event(this);
+    if (!ev) {
         return jerry_acquire_value(this);
     }
-    if (!jerry_value_is_string(argv[0])) {
+    char event[ZJS_MAX_EVENT_NAME_SIZE + 1];
+    if (argc < 1 || !get_event_name(argv[0], event)) {
         DBG_PRINT("event name must be first parameter\n");
         return jerry_acquire_value(this);
     }
-    int sz = jerry_get_string_size(argv[0]);
-    char event[sz];
-    int len = jerry_string_to_char_buffer(argv[0], (jerry_char_t *)event, sz);
-    if (len != sz) {
-        DBG_PRINT("size mismatch\n");
-        return jerry_acquire_value(this);
-    }
-    event[len] = '\0';
 
-    // Event object to hold callback ID and eventually listener arguments
-    jerry_value_t event_obj = zjs_get_property(ev->map, event);
-    if (!jerry_value_is_object(event_obj)) {
-        DBG_PRINT("event object not found for '%s'\n", event);
-        return jerry_acquire_value(this);
+    struct event_slot* slot = lookup_event(ev, event);
+    if (slot) {
+        // the name stays in the table, ready for new listeners
+        zjs_remove_callback(slot->id);
+        slot->id = -1;
     }
 
-    int32_t callback_id = -1;
-    jerry_value_t id_prop = zjs_get_property(event_obj, "callback_id");
-    if (jerry_value_is_number(id_prop)) {
-        // If there already is an event object, get the callback ID
-        zjs_obj_get_int32(event_obj, "callback_id", &callback_id);
-    } else {
-        DBG_PRINT("callback_id not found for '%s'\n", event);
-        return jerry_acquire_value(this);
-    }
-
-    zjs_remove_callback(callback_id);
-
-    jerry_value_t event_name_val = jerry_create_string((const jerry_char_t*)event);
-    jerry_delete_property(ev->map, (const jerry_value_t)event_name_val);
-    jerry_release_value(event_name_val);
-
     return jerry_acquire_value(this);
 }
 
-bool foreach_event_name(const jerry_value_t prop_name,
-                        const jerry_value_t prop_value,
-                        void *data)
-{
-    struct event_names* names = (struct event_names*)data;
-
-    jerry_set_property_by_index(names->name_array,
-                                names->idx++,
-                                prop_name);
-    return true;
-}
-
 static jerry_value_t get_event_names(const jerry_value_t function_obj,
                                      const jerry_value_t this,
                                      const jerry_value_t argv[],
                                      const jerry_length_t argc)
 {
-    struct event* ev;
-    struct event_names names;
-
-    jerry_value_t event_emitter = zjs_get_property(this, HIDDEN_PROP("event"));
-    if (!jerry_get_object_native_handle(event_emitter, (uintptr_t*)&ev)) {
-        DBG_PRINT("native handle not found\n");
-        return jerry_acquire_value(this);
+    struct event* ev = find_event(this);
+    if (!ev) {
+        return jerry_create_array(0);
     }
-    names.idx = 0;
-    names.name_array = jerry_create_array(ev->num_events);
-
-    jerry_foreach_object_property(ev->map, foreach_event_name, &names);
 
-    return names.name_array;
+    int count = 0;
+    for (int i = 0; i < ev->size; ++i) {
+        if (ev->slots[i].hash && zjs_get_num_callbacks(ev->slots[i].id)) {
+            count++;
+        }
+    }
+    jerry_value_t name_array = jerry_create_array(count);
+    int idx = 0;
+    for (int i = 0; i < ev->size; ++i) {
+        if (ev->slots[i].hash && zjs_get_num_callbacks(ev->slots[i].id)) {
+            jerry_value_t name = jerry_create_string(
+                    (const jerry_char_t*)ev->slots[i].name);
+            jerry_set_property_by_index(name_array, idx++, name);
+            jerry_release_value(name);
+        }
+    }
+    return name_array;
 }
 
 static jerry_value_t get_max_listeners(const jerry_value_t function_obj,
@@ -273,11 +310,8 @@ static jerry_value_t get_max_listeners(const jerry_value_t function_obj,
                                        const jerry_value_t argv[],
                                        const jerry_length_t argc)
 {
-    struct event* ev;
-
-    jerry_value_t event_emitter = zjs_get_property(this, HIDDEN_PROP("event"));
-    if (!jerry_get_object_native_handle(event_emitter, (uintptr_t*)&ev)) {
-        DBG_PRINT("native handle not found\n");
+    struct event* ev = find_event(this);
+    if (!ev) {
         return jerry_acquire_value(this);
     }
     return jerry_create_number(ev->max_listeners);
@@ -288,14 +322,11 @@ static jerry_value_t set_max_listeners(const jerry_value_t function_obj,
                                        const jerry_value_t argv[],
                                        const jerry_length_t argc)
 {
-    struct event* ev;
-
-    jerry_value_t event_emitter = zjs_get_property(this, HIDDEN_PROP("event"));
-    if (!jerry_get_object_native_handle(event_emitter, (uintptr_t*)&ev)) {
-        DBG_PRINT("native handle not found\n");
+    struct event* ev = find_event(this);
+    if (!ev) {
         return jerry_acquire_value(this);
     }
-    if (!jerry_value_is_number(argv[0])) {
+    if (argc < 1 || !jerry_value_is_number(argv[0])) {
         DBG_PRINT("max listeners count must be first parameter\n");
         return jerry_acquire_value(this);
     }
@@ -304,61 +335,27 @@ static jerry_value_t set_max_listeners(const jerry_value_t function_obj,
     return jerry_acquire_value(this);
 }
 
-bool foreach_listener(const jerry_value_t prop_name,
-                      const jerry_value_t prop_value,
-                      void *data)
-{
-    struct event_names* names = (struct event_names*)data;
-
-    jerry_set_property_by_index(names->name_array,
-                                names->idx++,
-                                prop_name);
-    return true;
-}
-
 static jerry_value_t get_listener_count(const jerry_value_t function_obj,
                                         const jerry_value_t this,
                                         const jerry_value_t argv[],
                                         const jerry_length_t argc)
 {
-    struct event* ev;
-
-    jerry_value_t event_emitter = zjs_get_property(this, HIDDEN_PROP("event"));
-    if (!jerry_get_object_native_handle(event_emitter, (uintptr_t*)&ev)) {
-        DBG_PRINT("native handle not found\n");
+    struct event* ev = find_event(this);
+    if (!ev) {
         return zjs_error("native handle not found");
     }
-    if (!jerry_value_is_string(argv[0])) {
+    if (argc < 1 || !jerry_value_is_string(argv[0])) {
         DBG_PRINT("event name must be first parameter\n");
         return zjs_error("event name must be first parameter");
     }
-    int sz = jerry_get_string_size(argv[0]);
-    char event[sz];
-    int len = jerry_string_to_char_buffer(argv[0], (jerry_char_t *)event, sz);
-    if (len != sz) {
-        DBG_PRINT("size mismatch\n");
-        return zjs_error("string size mismatch");
-    }
-    event[len] = '\0';
-
-    // Event object to hold callback ID and eventually listener arguments
-    jerry_value_t event_obj = zjs_get_property(ev->map, event);
-    if (!jerry_value_is_object(event_obj)) {
-        DBG_PRINT("event object not found for '%s'\n", event);
+    char event[ZJS_MAX_EVENT_NAME_SIZE + 1];
+    if (!get_event_name(argv[0], event)) {
+        // too long to have been added
         return jerry_create_number(0);
     }
 
-    int32_t callback_id = -1;
-    jerry_value_t id_prop = zjs_get_property(event_obj, "callback_id");
-    if (jerry_value_is_number(id_prop)) {
-        // If there already is an event object, get the callback ID
-        zjs_obj_get_int32(event_obj, "callback_id", &callback_id);
-    } else {
-        DBG_PRINT("callback_id not found for '%s'\n", event);
-        return jerry_create_number(0);
-    }
-
-    return jerry_create_number(zjs_get_num_callbacks(callback_id));
+    struct event_slot* slot = lookup_event(ev, event);
+    return jerry_create_number(slot ? zjs_get_num_callbacks(slot->id) : 0);
 }
 
 static jerry_value_t get_listeners(const jerry_value_t function_obj,
@@ -366,52 +363,48 @@ static jerry_value_t get_listeners(const jerry_value_t function_obj,
                                    const jerry_value_t argv[],
                                    const jerry_length_t argc)
 {
-    struct event* ev;
-
-    jerry_value_t event_emitter = zjs_get_property(this, HIDDEN_PROP("event"));
-    if (!jerry_get_object_native_handle(event_emitter, (uintptr_t*)&ev)) {
-        DBG_PRINT("native handle not found\n");
-        return jerry_acquire_value(this);
+    struct event* ev = find_event(this);
+    if (!ev) {
+        return jerry_create_array(0);
     }
-    if (!jerry_value_is_string(argv[0])) {
+    char event[ZJS_MAX_EVENT_NAME_SIZE + 1];
+    if (argc < 1 || !get_event_name(argv[0], event)) {
         DBG_PRINT("event name must be first parameter\n");
-        return jerry_acquire_value(this);
-    }
-    int sz = jerry_get_string_size(argv[0]);
-    char event[sz];
-    int len = jerry_string_to_char_buffer(argv[0], (jerry_char_t *)event, sz);
-    if (len != sz) {
-        DBG_PRINT("size mismatch\n");
-        return jerry_acquire_value(this);
-    }
-    event[len] = '\0';
-
-    // Event object to hold callback ID and eventually listener arguments
-    jerry_value_t event_obj = zjs_get_property(ev->map, event);
-    if (!jerry_value_is_object(event_obj)) {
-        DBG_PRINT("event object not found for '%s'\n", event);
-        return jerry_acquire_value(this);
+        return jerry_create_array(0);
     }
 
-    int32_t callback_id = -1;
-    jerry_value_t id_prop = zjs_get_property(event_obj, "callback_id");
-    if (jerry_value_is_number(id_prop)) {
-        // If there already is an event object, get the callback ID
-        zjs_obj_get_int32(event_obj, "callback_id", &callback_id);
-    } else {
-        DBG_PRINT("callback_id not found for '%s'\n", event);
-        return jerry_acquire_value(this);
+    int count = 0;
+    jerry_value_t* func_array = NULL;
+    struct event_slot* slot = lookup_event(ev, event);
+    if (slot) {
+        func_array = zjs_get_callback_func_list(slot->id, &count);
     }
-    int count;
-    int i;
-    jerry_value_t* func_array = zjs_get_callback_func_list(callback_id, &count);
     jerry_value_t ret_array = jerry_create_array(count);
-    for (i = 0; i < count; ++i) {
+    for (int i = 0; i < count; ++i) {
         jerry_set_property_by_index(ret_array, i, func_array[i]);
     }
     return ret_array;
 }
 
+static void deliver_event(void* handle, const jerry_value_t argv[],
+                          uint32_t argc)
+{
+    // effects: calls the listeners of a zjs_trigger_event() without a post
+    //            function; handle is the callback ID itself
+    zjs_call_callback((zjs_callback_id)(intptr_t)handle, (void*)argv, argc);
+}
+
+static void deliver_event_post(void* handle, const jerry_value_t argv[],
+                               uint32_t argc)
+{
+    // effects: calls the listeners of a zjs_trigger_event(), then its post
+    //            function
+    struct event_trigger* trigger = (struct event_trigger*)handle;
+    zjs_call_callback(trigger->id, (void*)argv, argc);
+    trigger->post(trigger->handle);
+    zjs_free(trigger);
+}
+
 bool zjs_trigger_event(jerry_value_t obj,
                        const char* event,
                        jerry_value_t argv[],
@@ -419,47 +412,45 @@ bool zjs_trigger_event(jerry_value_t obj,
                        zjs_post_event post,
                        void* h)
 {
-    struct event* ev;
-    struct event_trigger* trigger = zjs_malloc(sizeof(struct event_trigger));
-    if (!trigger) {
-        DBG_PRINT("could not allocate trigger, out of memory\n");
+    struct event* ev = find_event(obj);
+    if (!ev) {
         return false;
     }
-
-    int32_t callback_id = -1;
-    jerry_value_t event_obj;
-
-    jerry_value_t event_emitter = zjs_get_property(obj, HIDDEN_PROP("event"));
-    if (!jerry_get_object_native_handle(event_emitter, (uintptr_t*)&ev)) {
-        zjs_free(trigger);
-        DBG_PRINT("native handle not found\n");
-        return jerry_create_boolean(false);
-    }
-
-    event_obj = zjs_get_property(ev->map, event);
-    if (!jerry_value_is_object(event_obj)) {
-        zjs_free(trigger);
-        DBG_PRINT("event object not found\n");
+    struct event_slot* slot = lookup_event(ev, event);
+    if (!slot) {
+        DBG_PRINT("no listeners for '%s'\n", event);
         return false;
     }
 
-    if (!zjs_obj_get_int32(event_obj, "callback_id", &callback_id)) {
-        zjs_free(trigger);
-        DBG_PRINT("[event] zjs_trigger_event(): Error, callback_id not found\n");
+    // listeners run from the immediate queue, so without a post function this
+    //   doesn't allocate
+    uint32_t queued;
+    if (post) {
+        struct event_trigger* trigger = zjs_malloc(sizeof(struct event_trigger));
+        if (!trigger) {
+            DBG_PRINT("could not allocate trigger, out of memory\n");
+            return false;
+        }
+        trigger->id = slot->id;
+        trigger->post = post;
+        trigger->handle = h;
+        queued = zjs_queue_immediate(deliver_event_post, trigger, argv, argc);
+        if (!queued) {
+            zjs_free(trigger);
+        }
+    } else {
+        queued = zjs_queue_immediate(deliver_event,
+                                     (void*)(intptr_t)slot->id, argv, argc);
+    }
+    if (!queued) {
+        DBG_PRINT("could not queue event '%s'\n", event);
         return false;
     }
 
-    trigger->handle = h;
-    trigger->post = post;
-
-    zjs_edit_callback_handle(callback_id, trigger);
-
-    zjs_signal_callback(callback_id, argv, argc * sizeof(jerry_value_t));
-
     DBG_PRINT("triggering event '%s', args_cnt=%lu, callback_id=%ld\n",
-              event, argc, callback_id);
+              event, argc, slot->id);
 
-    return jerry_create_boolean(true);
+    return true;
 }
 
 bool zjs_trigger_event_now(jerry_value_t obj,
@@ -469,48 +460,22 @@ bool zjs_trigger_event_now(jerry_value_t obj,
                            zjs_post_event post,
                            void* h)
 {
-    struct event* ev;
-    struct event_trigger* trigger = zjs_malloc(sizeof(struct event_trigger));
-    if (!trigger) {
-        DBG_PRINT("could not allocate trigger, out of memory\n");
-        return false;
-    }
-
-    int32_t callback_id = -1;
-    jerry_value_t event_obj;
-
-    jerry_value_t event_emitter = zjs_get_property(obj, HIDDEN_PROP("event"));
-    if (!jerry_get_object_native_handle(event_emitter, (uintptr_t*)&ev)) {
-        zjs_free(trigger);
-        jerry_release_value(event_emitter);
-        DBG_PRINT("native handle not found\n");
-        return false;
-    }
-
-    jerry_release_value(event_emitter);
-
-    event_obj = zjs_get_property(ev->map, event);
-    if (!jerry_value_is_object(event_obj)) {
-        zjs_free(trigger);
-        DBG_PRINT("event object not found\n");
+    struct event* ev = find_event(obj);
+    if (!ev) {
         return false;
     }
-
-    zjs_obj_get_int32(event_obj, "callback_id", &callback_id);
-    if (callback_id == -1) {
-        zjs_free(trigger);
-        DBG_PRINT("callback_id not found\n");
+    struct event_slot* slot = lookup_event(ev, event);
+    if (!slot) {
+        DBG_PRINT("no listeners for '%s'\n", event);
         return false;
     }
 
-    trigger->handle = h;
-    trigger->post = post;
-
     DBG_PRINT("triggering event %s now\n", event);
 
-    zjs_edit_callback_handle(callback_id, trigger);
-
-    zjs_call_callback(callback_id, argv, argc);
+    zjs_call_callback(slot->id, argv, argc);
+    if (post) {
+        post(h);
+    }
 
     return true;
 }
@@ -519,23 +484,33 @@ static void destroy_event(const uintptr_t pointer)
 {
     struct event* ev = (struct event*)pointer;
     if (ev) {
-        jerry_release_value(ev->map);
+        for (int i = 0; i < ev->size; ++i) {
+            if (ev->slots[i].hash && ev->slots[i].id != -1) {
+                zjs_remove_callback(ev->slots[i].id);
+            }
+        }
+        zjs_free(ev->slots);
         zjs_free(ev);
     }
 }
 
 void zjs_make_event(jerry_value_t obj, jerry_value_t prototype)
 {
-    jerry_value_t event_obj = jerry_create_object();
     struct event* ev = zjs_malloc(sizeof(struct event));
-    if (!ev) {
+    struct event_slot* slots = zjs_malloc(sizeof(struct event_slot) *
+                                          EVENT_INITIAL_SLOTS);
+    if (!ev || !slots) {
         DBG_PRINT("could not allocate event handle, out of memory\n");
+        zjs_free(ev);
+        zjs_free(slots);
         return;
     }
+    memset(slots, 0, sizeof(struct event_slot) * EVENT_INITIAL_SLOTS);
 
     ev->max_listeners = DEFAULT_MAX_LISTENERS;
-    ev->num_events = 0;
-    ev->map = jerry_create_object();
+    ev->used = 0;
+    ev->size = EVENT_INITIAL_SLOTS;
+    ev->slots = slots;
 
     jerry_value_t proto = zjs_event_emitter_prototype;
     if (jerry_value_is_object(prototype)) {
@@ -544,10 +519,7 @@ void zjs_make_event(jerry_value_t obj, jerry_value_t prototype)
     }
     jerry_set_prototype(obj, proto);
 
-    jerry_set_object_native_handle(event_obj, (uintptr_t)ev, destroy_event);
-
-    zjs_obj_add_object(obj, event_obj, HIDDEN_PROP("event"));
-    jerry_release_value(event_obj);
+    jerry_set_object_native_handle(obj, (uintptr_t)ev, destroy_event);
 }
 
 static jerry_value_t event_constructor(const jerry_value_t function_obj,
@@ -16,7 +16,8 @@ typedef void (*zjs_post_event)(void* handle);
  * be used to trigger events in C. If the object needs no other prototype, pass
  * undefined and the event emitter prototype will be used. If a prototype is
  * given, it will be used as the object's prototype but its prototype in turn
- * will be set to the event emitter prototype.
+ * will be set to the event emitter prototype. The event state is kept as the
+ * object's native handle, so the object must not have one of its own.
  *
  * @param obj           Object to turn into an event object
  * @param prototype     Object to decorate and use as prototype, or undefined
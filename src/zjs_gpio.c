@@ -38,6 +38,14 @@ static jerry_value_t zjs_gpio_pin_prototype;
 void (*zjs_gpio_convert_pin)(uint32_t orig, int *dev, int *pin) =
     zjs_default_convert_pin;
 
+// Args signaled from the ISR for each pin change; only the latest is kept if
+//   they come faster than the main loop services them, so count tells it how
+//   many were merged
+struct gpio_change {
+    uint32_t value;
+    uint32_t count;
+};
+
 // Handle for GPIO input pins, passed around between ISR/C callbacks
 struct gpio_handle {
     struct gpio_callback callback;  // Callback structure for zephyr
@@ -50,6 +58,8 @@ struct gpio_handle {
     jerry_value_t* open_ret_args;
     uint8_t edge_both;
     uint32_t last;
+    uint32_t changes;               // changes signaled, only the ISR sets it
+    uint32_t handled;               // changes as of the last onchange event
 };
 
 static jerry_value_t lookup_pin(const jerry_value_t pin_obj, struct device **port, int *pin)
@@ -102,15 +112,22 @@ static jerry_value_t lookup_pin(const jerry_value_t pin_obj, struct device **por
 static void gpio_c_callback(void* h, void* args)
 {
     struct gpio_handle *handle = (struct gpio_handle*)h;
+    struct gpio_change change;
+    memcpy(&change, args, sizeof(change));
+    // changes signaled since the last event were merged into this one
+    uint32_t dropped = change.count - handle->handled - 1;
+    handle->handled = change.count;
+
     jerry_value_t onchange_func = zjs_get_property(handle->pin_obj, "onchange");
 
     // If pin.onChange exists, call it
     if (jerry_value_is_function(onchange_func)) {
         jerry_value_t event = jerry_create_object();
-        uint32_t val = 0;
-        memcpy(&val, args, 4);
         // Put the boolean GPIO trigger value in the object
-        zjs_obj_add_boolean(event, val, "value");
+        zjs_obj_add_boolean(event, change.value, "value");
+        if (dropped) {
+            zjs_obj_add_number(event, dropped, "dropped");
+        }
 
         // Only aquire once, once we have it just keep using it.
         // It will be released in close()
@@ -139,8 +156,10 @@ static void gpio_zephyr_callback(struct device *port,
     // Read the value and save it in the handle
     gpio_pin_read(port, handle->pin, &handle->value);
     if ((handle->edge_both && handle->value != handle->last) || !handle->edge_both) {
-        // Signal the C callback, where we call the JS callback
-        zjs_signal_callback(handle->callbackId, &handle->value, 4);
+        // Signal the C callback, where we call the JS callback; the count
+        //   goes with the value, so the main loop never reads it here
+        struct gpio_change change = { handle->value, ++handle->changes };
+        zjs_signal_callback(handle->callbackId, &change, sizeof(change));
         handle->last = handle->value;
     }
 }
@@ -389,6 +408,11 @@ static jerry_value_t zjs_gpio_open(const jerry_value_t function_obj,
 
         // Register a C callback (will be called after the ISR is called)
         handle->callbackId = zjs_add_c_callback(handle, gpio_c_callback);
+        zjs_set_callback_priority(handle->callbackId, ZJS_PRIORITY_ISR);
+        // only the latest pin value matters if edges come faster than the
+        //   main loop can service them
+        zjs_set_callback_coalescing(handle->callbackId,
+                                    sizeof(struct gpio_change));
 
         if (!strcmp(edge, ZJS_EDGE_BOTH)) {
             handle->edge_both = 1;
@@ -4,12 +4,12 @@
 #define ZJS_LINUX_PORT_H_
 
 #include "zjs_util.h"
+#include <pthread.h>
 #include <unistd.h>
 
 typedef struct zjs_port_timer {
-    uint32_t sec;
-    uint32_t milli;
-    uint32_t interval;
+    uint64_t start;         // uptime in us when the timer was started
+    uint32_t interval;      // in ms
     void* data;
 } zjs_port_timer_t;
 
@@ -21,7 +21,26 @@ void zjs_port_timer_stop(zjs_port_timer_t* timer);
 
 uint8_t zjs_port_timer_test(zjs_port_timer_t* timer);
 
+int32_t zjs_port_timer_get_remaining(zjs_port_timer_t* timer);
+
+// ms since an arbitrary point in time, like k_uptime_get_32()
+uint32_t zjs_port_timer_get_uptime(void);
+
+// us since the same point in time, wraps around after about 71 minutes
+uint32_t zjs_port_get_uptime_us(void);
+
+// us since the same point in time, doesn't wrap around
+uint64_t zjs_port_timer_get_uptime_us(void);
+
+// Virtual time, for jslinux --virtual-time: the uptime functions above read a
+//   clock that starts at 0 and only moves when the main loop has nothing to
+//   do but wait, then jumps straight to the end of the wait
+void zjs_port_enable_virtual_time(void);
+bool zjs_port_is_virtual_time(void);
+void zjs_port_advance_virtual_time(uint64_t us);
+
 #define ZJS_TICKS_NONE          0
+#define ZJS_TICKS_FOREVER       -1
 #define CONFIG_SYS_CLOCK_TICKS_PER_SEC 100
 #define zjs_sleep usleep
 
@@ -29,14 +48,57 @@ uint8_t zjs_port_timer_test(zjs_port_timer_t* timer);
 
 #define EAGAIN      11
 #define EMSGSIZE    12
+#define EBUSY       16
 #define ENOSPC      28
 
+/*
+ * Counting semaphore with the same semantics as the Zephyr k_sem, so the main
+ * loop can block until a callback is signaled, possibly from another thread.
+ * The count is atomic, so giving and taking without waiting are lock-free;
+ * the lock and condition variable are only used while a taker is asleep.
+ */
+struct zjs_port_sem {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t count;
+    uint32_t limit;
+    uint32_t waiters;   // takers asleep on cond, or about to be
+};
+
+void zjs_port_sem_init(struct zjs_port_sem* sem,
+                       uint32_t initial_count,
+                       uint32_t limit);
+
+void zjs_port_sem_give(struct zjs_port_sem* sem);
+
+/*
+ * Take the semaphore, waiting up to timeout ms (ZJS_TICKS_NONE to not wait,
+ * ZJS_TICKS_FOREVER to wait indefinitely). Returns 0 if the semaphore was
+ * taken, -EBUSY if it was not available and timeout was ZJS_TICKS_NONE, and
+ * -EAGAIN if the timeout expired.
+ */
+int zjs_port_sem_take(struct zjs_port_sem* sem, int32_t timeout);
+
+/*
+ * Guards state shared with code that may signal callbacks from other threads,
+ * like irq_lock() does against ISRs on Zephyr. Critical sections don't nest.
+ */
+typedef int zjs_port_critical_t;
+
+zjs_port_critical_t zjs_port_enter_critical(void);
+
+void zjs_port_exit_critical(zjs_port_critical_t key);
+
+/*
+ * Lock-free ring buffer, any number of threads may put but only one thread
+ * may get. Only the low 7 bits of value are kept.
+ */
 struct zjs_port_ring_buf {
-    uint32_t head;   /**< Index in buf for the head element */
-    uint32_t tail;   /**< Index in buf for the tail element */
-    uint32_t size;   /**< Size of buf in 32-bit chunks */
+    uint32_t head;   /**< Word count consumed, written by the consumer */
+    uint32_t tail;   /**< Word count reserved, advanced by producers */
+    uint32_t size;   /**< Size of buf in 32-bit chunks, a power of 2 */
     uint32_t *buf;   /**< Memory region for stored entries */
-    uint32_t mask;   /**< Modulo mask if size is a power of 2 */
+    uint32_t mask;   /**< Modulo mask, size - 1 */
 };
 
 void zjs_port_ring_buf_init(struct zjs_port_ring_buf* buf,
@@ -55,4 +117,17 @@ int zjs_port_ring_buf_put(struct zjs_port_ring_buf* buf,
                           uint32_t* data,
                           uint8_t size32);
 
+// like get, but leaves the record in the buffer and doesn't copy its data;
+//   returns -EAGAIN if there is none
+int zjs_port_ring_buf_peek(struct zjs_port_ring_buf* buf,
+                           uint16_t* type,
+                           uint8_t* value,
+                           uint8_t* size32);
+
+// number of free 32-bit chunks, a record takes its size32 plus one
+int zjs_port_ring_buf_space_get(struct zjs_port_ring_buf* buf);
+
+// only reliable when called by the consumer
+int zjs_port_ring_buf_is_empty(struct zjs_port_ring_buf* buf);
+
 #endif /* ZJS_LINUX_PORT_H_ */
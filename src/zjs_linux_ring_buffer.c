@@ -15,10 +15,22 @@
  */
 
 /*
- * This ring buffer implementation was taken from the Zephyr source and
- * slightly modified to run on Linux.
+ * This ring buffer started out as the Zephyr implementation, modified to run
+ * on Linux. It is now a lock-free multi-producer/single-consumer queue so that
+ * zjs_signal_callback() can be called from threads other than the main loop.
+ *
+ * head and tail are free running word counters, masked to index the buffer,
+ * so the size must be a power of 2. A producer reserves space by advancing
+ * tail with a CAS, copies its data in, and then publishes the record by
+ * storing its header word with release semantics. Header words always have
+ * the committed bit set, so the consumer can tell a published record from a
+ * reserved one. The consumer zeroes every word it consumes before releasing it
+ * back to the producers by advancing head, so a stale header is never mistaken
+ * for a new one.
  */
 
+#include <string.h>
+
 #include "zjs_linux_port.h"
 
 #ifndef likely
@@ -28,34 +40,31 @@
 #define unlikely(x) __builtin_expect((long)!!(x), 0L)
 #endif
 
-struct ring_element {
-    uint32_t  type   :16; /**< Application-specific */
-    uint32_t  length :8;  /**< length in 32-bit chunks */
-    uint32_t  value  :8;  /**< Room for small integral values */
-};
-
-static int get_space(struct zjs_port_ring_buf* buf)
-{
-    if (buf->head == buf->tail) {
-        return buf->size - 1;
-    }
-
-    if (buf->tail < buf->head) {
-        return buf->head - buf->tail - 1;
-    }
-
-    /* buf->tail > buf->head */
-    return (buf->size - buf->tail) + buf->head - 1;
-}
+// header word layout: type:16 | length:8 (in 32-bit chunks) | value:7 | committed:1
+#define HDR_LENGTH_SHIFT    16
+#define HDR_VALUE_SHIFT     24
+#define HDR_COMMITTED       (1u << 31)
+#define HDR_TYPE(h)         ((h) & 0xffff)
+#define HDR_LENGTH(h)       (((h) >> HDR_LENGTH_SHIFT) & 0xff)
+#define HDR_VALUE(h)        (((h) >> HDR_VALUE_SHIFT) & 0x7f)
+#define MAKE_HDR(type, length, value) \
+    ((uint32_t)(type) | ((uint32_t)(length) << HDR_LENGTH_SHIFT) | \
+     ((uint32_t)((value) & 0x7f) << HDR_VALUE_SHIFT) | HDR_COMMITTED)
 
 void zjs_port_ring_buf_init(struct zjs_port_ring_buf* buf,
                             uint32_t size,
                             uint32_t* data)
 {
+    // round down to a power of 2
+    while (size & (size - 1)) {
+        size &= size - 1;
+    }
     buf->head = 0;
     buf->tail = 0;
     buf->size = size;
+    buf->mask = size - 1;
     buf->buf = data;
+    memset(data, 0, size * sizeof(uint32_t));
 }
 
 int zjs_port_ring_buf_get(struct zjs_port_ring_buf* buf,
@@ -64,40 +73,53 @@ int zjs_port_ring_buf_get(struct zjs_port_ring_buf* buf,
                           uint32_t* data,
                           uint8_t* size32)
 {
-    struct ring_element *header;
-    uint32_t i, index;
-
-    if (buf->head == buf->tail) {
+    uint32_t i, header, length;
+    // only the consumer writes head
+    uint32_t head = buf->head;
+
+    // pairs with the release store of the header in put, so the data words
+    //   are visible once the committed header is
+    header = __atomic_load_n(&buf->buf[head & buf->mask], __ATOMIC_ACQUIRE);
+    if (!(header & HDR_COMMITTED)) {
+        // empty, or the next record is reserved but not yet published
         return -EAGAIN;
     }
 
-    header = (struct ring_element *) &buf->buf[buf->head];
-
-    if (header->length > *size32) {
-        *size32 = header->length;
+    length = HDR_LENGTH(header);
+    if (length > *size32) {
+        *size32 = length;
         return -EMSGSIZE;
     }
 
-    *size32 = header->length;
-    *type = header->type;
-    *value = header->value;
+    *size32 = length;
+    *type = HDR_TYPE(header);
+    *value = HDR_VALUE(header);
 
-    if (likely(buf->mask)) {
-        for (i = 0; i < header->length; ++i) {
-            index = (i + buf->head + 1) & buf->mask;
-            data[i] = buf->buf[index];
-        }
-        buf->head = (buf->head + header->length + 1) & buf->mask;
-    } else {
-        for (i = 0; i < header->length; ++i) {
-            index = (i + buf->head + 1) % buf->size;
-            data[i] = buf->buf[index];
-        }
-        buf->head = (buf->head + header->length + 1) % buf->size;
+    for (i = 0; i < length; ++i) {
+        uint32_t index = (head + i + 1) & buf->mask;
+        data[i] = buf->buf[index];
+        buf->buf[index] = 0;
     }
+    buf->buf[head & buf->mask] = 0;
 
+    // hand the zeroed words back to the producers
+    __atomic_store_n(&buf->head, head + length + 1, __ATOMIC_RELEASE);
+    return 0;
+}
 
-
+int zjs_port_ring_buf_peek(struct zjs_port_ring_buf* buf,
+                           uint16_t* type,
+                           uint8_t* value,
+                           uint8_t* size32)
+{
+    uint32_t header = __atomic_load_n(&buf->buf[buf->head & buf->mask],
+                                      __ATOMIC_ACQUIRE);
+    if (!(header & HDR_COMMITTED)) {
+        return -EAGAIN;
+    }
+    *type = HDR_TYPE(header);
+    *value = HDR_VALUE(header);
+    *size32 = HDR_LENGTH(header);
     return 0;
 }
 
@@ -107,33 +129,41 @@ int zjs_port_ring_buf_put(struct zjs_port_ring_buf* buf,
                           uint32_t* data,
                           uint8_t size32)
 {
-    uint32_t i, space, index, rc = -1;
-
-    space = get_space(buf);
-    if (space >= (size32 + 1)) {
-        struct ring_element *header =
-                (struct ring_element *)&buf->buf[buf->tail];
-        header->type = type;
-        header->length = size32;
-        header->value = value;
-
-        if (likely(buf->mask)) {
-            for (i = 0; i < size32; ++i) {
-                index = (i + buf->tail + 1) & buf->mask;
-                buf->buf[index] = data[i];
-            }
-            buf->tail = (buf->tail + size32 + 1) & buf->mask;
-        } else {
-            for (i = 0; i < size32; ++i) {
-                index = (i + buf->tail + 1) % buf->size;
-                buf->buf[index] = data[i];
-            }
-            buf->tail = (buf->tail + size32 + 1) % buf->size;
+    uint32_t i, head, tail, needed = size32 + 1;
+
+    tail = __atomic_load_n(&buf->tail, __ATOMIC_RELAXED);
+    do {
+        // pairs with the release store of head in get, so the consumer is
+        //   done with (and has zeroed) the words being reserved
+        head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+        if (unlikely(buf->size - 1 - (tail - head) < needed)) {
+            return -EMSGSIZE;
         }
-        rc = 0;
-    } else {
-        rc = -EMSGSIZE;
+    } while (!__atomic_compare_exchange_n(&buf->tail, &tail, tail + needed,
+                                          true, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+
+    for (i = 0; i < size32; ++i) {
+        buf->buf[(tail + i + 1) & buf->mask] = data[i];
     }
+    // publish the record
+    __atomic_store_n(&buf->buf[tail & buf->mask],
+                     MAKE_HDR(type, size32, value), __ATOMIC_RELEASE);
+    return 0;
+}
+
+int zjs_port_ring_buf_space_get(struct zjs_port_ring_buf* buf)
+{
+    uint32_t head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&buf->tail, __ATOMIC_RELAXED);
+    return buf->size - 1 - (tail - head);
+}
 
-    return rc;
+int zjs_port_ring_buf_is_empty(struct zjs_port_ring_buf* buf)
+{
+    // a reserved but unpublished record counts as empty, its producer will
+    //   signal once it is published
+    uint32_t header = __atomic_load_n(&buf->buf[buf->head & buf->mask],
+                                      __ATOMIC_ACQUIRE);
+    return !(header & HDR_COMMITTED);
 }
@@ -0,0 +1,126 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#include "zjs_linux_port.h"
+#include <time.h>
+
+#ifdef __MACH__
+#include <sys/time.h>
+#endif
+
+static void get_deadline(struct timespec* deadline, int32_t timeout)
+{
+    // effects: fills in deadline with the absolute time timeout ms from now,
+    //            on the clock the condition variable was initialized with
+#ifdef __MACH__
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    deadline->tv_sec = now.tv_sec;
+    deadline->tv_nsec = now.tv_usec * 1000;
+#else
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+#endif
+    deadline->tv_sec += timeout / 1000;
+    deadline->tv_nsec += (timeout % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+void zjs_port_sem_init(struct zjs_port_sem* sem,
+                       uint32_t initial_count,
+                       uint32_t limit)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#ifndef __MACH__
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+    pthread_cond_init(&sem->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&sem->lock, NULL);
+    sem->count = initial_count;
+    sem->limit = limit;
+    sem->waiters = 0;
+}
+
+static bool sem_try_take(struct zjs_port_sem* sem)
+{
+    // effects: takes one from the count and returns true, or returns false if
+    //            it is zero
+    uint32_t count = __atomic_load_n(&sem->count, __ATOMIC_SEQ_CST);
+    while (count) {
+        if (__atomic_compare_exchange_n(&sem->count, &count, count - 1, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void zjs_port_sem_give(struct zjs_port_sem* sem)
+{
+    uint32_t count = __atomic_load_n(&sem->count, __ATOMIC_RELAXED);
+    while (count < sem->limit &&
+           !__atomic_compare_exchange_n(&sem->count, &count, count + 1, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    // a taker counts itself as waiting before it checks the count, and this
+    //   checks for waiters after the count went up, so one of them sees the
+    //   other; only wake the taker if it may have missed the count
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST)) {
+        // the taker holds the lock until it is waiting on cond, so this
+        //   signal can't come too early
+        pthread_mutex_lock(&sem->lock);
+        pthread_cond_signal(&sem->cond);
+        pthread_mutex_unlock(&sem->lock);
+    }
+}
+
+int zjs_port_sem_take(struct zjs_port_sem* sem, int32_t timeout)
+{
+    struct timespec deadline;
+    int rc = 0;
+
+    if (sem_try_take(sem)) {
+        return 0;
+    }
+    if (timeout == ZJS_TICKS_NONE) {
+        return -EBUSY;
+    }
+    if (timeout > 0) {
+        get_deadline(&deadline, timeout);
+    }
+
+    pthread_mutex_lock(&sem->lock);
+    __atomic_add_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+    while (!sem_try_take(sem)) {
+        if (timeout == ZJS_TICKS_FOREVER) {
+            pthread_cond_wait(&sem->cond, &sem->lock);
+        } else if (pthread_cond_timedwait(&sem->cond, &sem->lock, &deadline)) {
+            // only a timeout is possible with a valid cond and mutex
+            if (!sem_try_take(sem)) {
+                rc = -EAGAIN;
+            }
+            break;
+        }
+    }
+    __atomic_sub_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&sem->lock);
+
+    return rc;
+}
+
+static pthread_mutex_t critical_lock = PTHREAD_MUTEX_INITIALIZER;
+
+zjs_port_critical_t zjs_port_enter_critical(void)
+{
+    pthread_mutex_lock(&critical_lock);
+    return 0;
+}
+
+void zjs_port_exit_critical(zjs_port_critical_t key)
+{
+    pthread_mutex_unlock(&critical_lock);
+}
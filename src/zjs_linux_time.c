@@ -5,6 +5,11 @@
 
 #define ZEPHYR_TICKS_PER_SEC
 
+// set by zjs_port_enable_virtual_time(), before the main loop starts
+static bool virtual_time = false;
+// virtual uptime in us, may be read from other threads
+static uint64_t virtual_us = 0;
+
 //clock_gettime is not implemented on OSX
 #ifdef __MACH__
 #include <sys/time.h>
@@ -21,10 +26,7 @@ int clock_gettime(int clk_id, struct timespec* t) {
 
 void zjs_port_timer_start(zjs_port_timer_t* timer, uint32_t interval)
 {
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    timer->sec = now.tv_sec;
-    timer->milli = now.tv_nsec / 1000000;
+    timer->start = zjs_port_timer_get_uptime_us();
     timer->interval = interval;
 }
 
@@ -33,17 +35,66 @@ void zjs_port_timer_stop(zjs_port_timer_t* timer)
     timer->interval = 0;
 }
 
+static uint32_t get_elapsed(zjs_port_timer_t* timer)
+{
+    // effects: returns the whole ms since the timer was started
+    return (zjs_port_timer_get_uptime_us() - timer->start) / 1000;
+}
+
 uint8_t zjs_port_timer_test(zjs_port_timer_t* timer)
 {
-    uint32_t elapsed;
+    if (get_elapsed(timer) >= timer->interval) {
+        return 1;
+    }
+    return 0;
+}
+
+int32_t zjs_port_timer_get_remaining(zjs_port_timer_t* timer)
+{
+    // effects: returns the ms left until the timer expires, or 0 if it has
+    //            already expired or was stopped, like k_timer_remaining_get
+    uint32_t elapsed = get_elapsed(timer);
+
+    if (elapsed >= timer->interval) {
+        return 0;
+    }
+    return timer->interval - elapsed;
+}
+
+uint32_t zjs_port_timer_get_uptime(void)
+{
+    return (uint32_t)(zjs_port_timer_get_uptime_us() / 1000);
+}
+
+uint32_t zjs_port_get_uptime_us(void)
+{
+    return (uint32_t)zjs_port_timer_get_uptime_us();
+}
+
+uint64_t zjs_port_timer_get_uptime_us(void)
+{
+    if (virtual_time) {
+        return __atomic_load_n(&virtual_us, __ATOMIC_RELAXED);
+    }
+
     struct timespec now;
 
     clock_gettime(CLOCK_MONOTONIC, &now);
 
-    elapsed = (1000 * (now.tv_sec - timer->sec)) + ((now.tv_nsec / 1000000) - timer->milli);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
 
-    if (elapsed >= timer->interval) {
-        return 1;
-    }
-    return 0;
+void zjs_port_enable_virtual_time(void)
+{
+    virtual_time = true;
+}
+
+bool zjs_port_is_virtual_time(void)
+{
+    return virtual_time;
+}
+
+void zjs_port_advance_virtual_time(uint64_t us)
+{
+    __atomic_add_fetch(&virtual_us, us, __ATOMIC_RELAXED);
 }
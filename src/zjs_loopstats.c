@@ -0,0 +1,245 @@
+// Copyright (c) 2016, Intel Corporation.
+#ifdef BUILD_MODULE_LOOPSTATS
+
+#ifndef ZJS_LINUX_BUILD
+#include "zjs_zephyr_port.h"
+#else
+#include "zjs_linux_port.h"
+#include <signal.h>
+#endif
+
+// ZJS includes
+#include "zjs_callbacks.h"
+#include "zjs_loopstats.h"
+#include "zjs_modules.h"
+#include "zjs_timers.h"
+#include "zjs_util.h"
+
+static const char* priority_names[] = { "isr", "io", "timer", "background" };
+
+static jerry_value_t make_histogram(const uint32_t* buckets)
+{
+    jerry_value_t array = jerry_create_array(ZJS_LOOP_STATS_BUCKETS);
+    for (int i = 0; i < ZJS_LOOP_STATS_BUCKETS; ++i) {
+        jerry_value_t count = jerry_create_number(buckets[i]);
+        jerry_release_value(jerry_set_property_by_index(array, i, count));
+        jerry_release_value(count);
+    }
+    return array;
+}
+
+struct stats_array {
+    jerry_value_t array;
+    uint32_t count;
+};
+
+static void add_stats_object(zjs_callback_id id, uint8_t priority,
+                             const struct zjs_callback_loop_stats* stats,
+                             void* data)
+{
+    struct stats_array* result = (struct stats_array*)data;
+    jerry_value_t obj = jerry_create_object();
+    zjs_obj_add_number(obj, id, "id");
+    zjs_obj_add_string(obj, priority_names[priority], "priority");
+    zjs_obj_add_number(obj, stats->signals, "signals");
+    zjs_obj_add_number(obj, stats->dispatches, "dispatches");
+    zjs_obj_add_number(obj, stats->drops, "drops");
+
+    jerry_value_t wait = make_histogram(stats->wait_us);
+    jerry_value_t run = make_histogram(stats->run_us);
+    zjs_obj_add_object(obj, wait, "wait");
+    zjs_obj_add_object(obj, run, "run");
+    jerry_release_value(wait);
+    jerry_release_value(run);
+
+    jerry_release_value(jerry_set_property_by_index(result->array,
+                                                    result->count++, obj));
+    jerry_release_value(obj);
+}
+
+static jerry_value_t zjs_loopstats_get(const jerry_value_t function_obj,
+                                       const jerry_value_t this,
+                                       const jerry_value_t argv[],
+                                       const jerry_length_t argc)
+{
+    struct zjs_callback_stats totals;
+    zjs_get_callback_stats(&totals);
+
+    struct stats_array result;
+    result.array = jerry_create_array(totals.live);
+    result.count = 0;
+    zjs_foreach_loop_stats(add_stats_object, &result);
+    return result.array;
+}
+
+static jerry_value_t zjs_loopstats_timers(const jerry_value_t function_obj,
+                                          const jerry_value_t this,
+                                          const jerry_value_t argv[],
+                                          const jerry_length_t argc)
+{
+    struct zjs_timer_stats stats;
+    zjs_timers_get_stats(&stats);
+
+    jerry_value_t obj = jerry_create_object();
+    zjs_obj_add_number(obj, stats.wakeups, "wakeups");
+    zjs_obj_add_number(obj, stats.fired, "fired");
+    zjs_obj_add_number(obj, stats.saved, "saved");
+    return obj;
+}
+
+static void add_module_object(const char* name, bool loaded,
+                              uint32_t init_us, void* data)
+{
+    if (!loaded) {
+        return;
+    }
+    struct stats_array* result = (struct stats_array*)data;
+    jerry_value_t obj = jerry_create_object();
+    zjs_obj_add_string(obj, name, "name");
+    zjs_obj_add_number(obj, init_us, "initUs");
+    jerry_release_value(jerry_set_property_by_index(result->array,
+                                                    result->count++, obj));
+    jerry_release_value(obj);
+}
+
+static jerry_value_t zjs_loopstats_modules(const jerry_value_t function_obj,
+                                           const jerry_value_t this,
+                                           const jerry_value_t argv[],
+                                           const jerry_length_t argc)
+{
+    struct stats_array result;
+    result.array = jerry_create_array(0);
+    result.count = 0;
+    zjs_foreach_module(add_module_object, &result);
+    return result.array;
+}
+
+static jerry_value_t zjs_loopstats_reset(const jerry_value_t function_obj,
+                                         const jerry_value_t this,
+                                         const jerry_value_t argv[],
+                                         const jerry_length_t argc)
+{
+    zjs_reset_loop_stats();
+    zjs_timers_reset_stats();
+    return ZJS_UNDEFINED;
+}
+
+static jerry_value_t zjs_loopstats_dump_handler(const jerry_value_t function_obj,
+                                                const jerry_value_t this,
+                                                const jerry_value_t argv[],
+                                                const jerry_length_t argc)
+{
+    zjs_loopstats_dump();
+    return ZJS_UNDEFINED;
+}
+
+static void print_histogram(const char* name, const uint32_t* buckets)
+{
+    ZJS_PRINT("    %s:", name);
+    for (int i = 0; i < ZJS_LOOP_STATS_BUCKETS; ++i) {
+        if (buckets[i]) {
+            // print the upper bound of each non-empty bucket
+            if (i == ZJS_LOOP_STATS_BUCKETS - 1) {
+                ZJS_PRINT(" >=%u:%u", 1u << (i - 1), buckets[i]);
+            } else {
+                ZJS_PRINT(" <%u:%u", 1u << i, buckets[i]);
+            }
+        }
+    }
+    ZJS_PRINT("\n");
+}
+
+static void print_stats(zjs_callback_id id, uint8_t priority,
+                        const struct zjs_callback_loop_stats* stats,
+                        void* data)
+{
+    if (!stats->signals && !stats->dispatches) {
+        return;
+    }
+    ZJS_PRINT("[%d] %s: signals=%u, dispatches=%u, drops=%u\n", id,
+              priority_names[priority], stats->signals, stats->dispatches,
+              stats->drops);
+    print_histogram("wait us", stats->wait_us);
+    print_histogram("run us", stats->run_us);
+}
+
+static void print_module(const char* name, bool loaded, uint32_t init_us,
+                         void* data)
+{
+    if (loaded) {
+        ZJS_PRINT(" %s=%uus", name, init_us);
+    }
+}
+
+void zjs_loopstats_dump(void)
+{
+    struct zjs_callback_stats totals;
+    struct zjs_timer_stats timers;
+    zjs_get_callback_stats(&totals);
+    zjs_timers_get_stats(&timers);
+
+    ZJS_PRINT("\n--------- Loop Stats ------------\n");
+    ZJS_PRINT("callbacks: live=%u, peak=%u\n", totals.live, totals.peak);
+    ZJS_PRINT("signals: coalesced=%u, spilled=%u, dropped=%u\n",
+              totals.coalesced, totals.spilled, totals.dropped);
+    ZJS_PRINT("timers: wakeups=%u, fired=%u, wakeups saved=%u\n",
+              timers.wakeups, timers.fired, timers.saved);
+    ZJS_PRINT("module init:");
+    zjs_foreach_module(print_module, NULL);
+    ZJS_PRINT("\n");
+    zjs_foreach_loop_stats(print_stats, NULL);
+    ZJS_PRINT("------------- End ----------------\n");
+}
+
+#ifdef ZJS_LINUX_BUILD
+static int dump_requested = 0;
+static sigset_t dump_signals;
+
+static void* signal_thread(void* arg)
+{
+    int sig;
+    while (!sigwait(&dump_signals, &sig)) {
+        // the stats belong to the main loop, so have it do the dump
+        __atomic_store_n(&dump_requested, 1, __ATOMIC_RELEASE);
+        zjs_loop_unblock();
+    }
+    return NULL;
+}
+
+static int32_t dump_routine(void* handle)
+{
+    if (__atomic_exchange_n(&dump_requested, 0, __ATOMIC_ACQ_REL)) {
+        zjs_loopstats_dump();
+    }
+    return ZJS_TICKS_FOREVER;
+}
+
+void zjs_loopstats_watch_signal(void)
+{
+    pthread_t thread;
+    sigemptyset(&dump_signals);
+    sigaddset(&dump_signals, SIGUSR1);
+    // block it here, and in threads created later, so only the watcher
+    //   thread receives it
+    pthread_sigmask(SIG_BLOCK, &dump_signals, NULL);
+    if (pthread_create(&thread, NULL, signal_thread, NULL)) {
+        ERR_PRINT("could not create loop stats signal thread\n");
+        return;
+    }
+    pthread_detach(thread);
+    zjs_register_service_routine(NULL, dump_routine);
+}
+#endif
+
+jerry_value_t zjs_loopstats_init()
+{
+    jerry_value_t loopstats_obj = jerry_create_object();
+    zjs_obj_add_function(loopstats_obj, zjs_loopstats_get, "get");
+    zjs_obj_add_function(loopstats_obj, zjs_loopstats_timers, "timers");
+    zjs_obj_add_function(loopstats_obj, zjs_loopstats_modules, "modules");
+    zjs_obj_add_function(loopstats_obj, zjs_loopstats_reset, "reset");
+    zjs_obj_add_function(loopstats_obj, zjs_loopstats_dump_handler, "dump");
+    return loopstats_obj;
+}
+
+#endif // BUILD_MODULE_LOOPSTATS
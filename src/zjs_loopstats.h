@@ -0,0 +1,18 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#ifndef __zjs_loopstats_h__
+#define __zjs_loopstats_h__
+
+#include "jerry-api.h"
+
+jerry_value_t zjs_loopstats_init();
+
+// Print the loop stats of all callbacks
+void zjs_loopstats_dump(void);
+
+#ifdef ZJS_LINUX_BUILD
+// Dump the loop stats from the main loop whenever SIGUSR1 is received
+void zjs_loopstats_watch_signal(void);
+#endif
+
+#endif  // __zjs_loopstats_h__
@@ -3,14 +3,20 @@
 #ifndef ZJS_LINUX_BUILD
 // Zephyr includes
 #include <zephyr.h>
+#include "zjs_zephyr_port.h"
+#else
+#include "zjs_linux_port.h"
 #endif
 #include <string.h>
 #include <stdlib.h>
 
 // ZJS includes
 #include "zjs_event.h"
+#include "zjs_loopstats.h"
 #include "zjs_modules.h"
+#include "zjs_modules_hash_gen.h"
 #include "zjs_performance.h"
+#include "zjs_script.h"
 #include "zjs_util.h"
 #ifdef BUILD_MODULE_OCF
 #include "zjs_ocf_common.h"
@@ -39,54 +45,73 @@ typedef struct module {
     const char *name;
     initcb_t init;
     cleanupcb_t cleanup;
+    uint8_t flags;
+    uint32_t init_us;           // time taken by init, once loaded
     jerry_value_t instance;
 } module_t;
 
-// init function is required, cleanup is optional in these entries
-module_t zjs_modules_array[] = {
+// loaded at startup, because other modules depend on it
+#define MODULE_EAGER        0x01
+
+// The table is indexed by a perfect hash of the module names: FNV-1a with
+//   MODULE_HASH_SEED as the offset basis, keeping the top MODULE_SLOT_BITS
+//   bits. The build runs scripts/genmodhash on the MODULE() entries below to
+//   pick the seed and the slot of each module.
+#define MODULE_SLOTS        (1 << MODULE_SLOT_BITS)
+
+#define MODULE(name, init, cleanup, flags) \
+    [MODULE_SLOT_##name] = { #name, init, cleanup, flags }
+
+// init function is required, cleanup is optional in these entries; slots of
+//   modules left out of the build stay empty
+module_t zjs_modules_array[MODULE_SLOTS] = {
 #ifndef ZJS_LINUX_BUILD
 #ifndef QEMU_BUILD
 #ifndef CONFIG_BOARD_FRDM_K64F
 #ifdef BUILD_MODULE_AIO
-    { "aio", zjs_aio_init, zjs_aio_cleanup },
+    MODULE(aio, zjs_aio_init, zjs_aio_cleanup, 0),
 #endif
 #endif
 #ifdef BUILD_MODULE_BLE
-    { "ble", zjs_ble_init },
+    MODULE(ble, zjs_ble_init, NULL, 0),
 #endif
 #ifdef BUILD_MODULE_GPIO
-    { "gpio", zjs_gpio_init, zjs_gpio_cleanup },
+    MODULE(gpio, zjs_gpio_init, zjs_gpio_cleanup, 0),
 #endif
 #ifdef BUILD_MODULE_GROVE_LCD
-    { "grove_lcd", zjs_grove_lcd_init, zjs_grove_lcd_cleanup },
+    MODULE(grove_lcd, zjs_grove_lcd_init, zjs_grove_lcd_cleanup, 0),
 #endif
 #ifdef BUILD_MODULE_PWM
-    { "pwm", zjs_pwm_init },
+    MODULE(pwm, zjs_pwm_init, NULL, 0),
 #endif
 #ifdef BUILD_MODULE_I2C
-    { "i2c", zjs_i2c_init },
+    MODULE(i2c, zjs_i2c_init, NULL, 0),
 #endif
 #ifdef CONFIG_BOARD_ARDUINO_101
 #ifdef BUILD_MODULE_A101
-    { "arduino101_pins", zjs_a101_init },
+    MODULE(arduino101_pins, zjs_a101_init, NULL, 0),
 #endif
 #endif
 #ifdef CONFIG_BOARD_FRDM_K64F
-    { "k64f_pins", zjs_k64f_init },
+    MODULE(k64f_pins, zjs_k64f_init, NULL, 0),
 #endif
 #endif // QEMU_BUILD
 #ifdef BUILD_MODULE_UART
-    { "uart", zjs_uart_init, zjs_uart_cleanup },
+    MODULE(uart, zjs_uart_init, zjs_uart_cleanup, 0),
 #endif
 #endif // ZJS_LINUX_BUILD
 #ifdef BUILD_MODULE_EVENTS
-    { "events", zjs_event_init, zjs_event_cleanup },
+    // UART, BLE, etc. make event emitters without requiring it
+    MODULE(events, zjs_event_init, zjs_event_cleanup, MODULE_EAGER),
 #endif
 #ifdef BUILD_MODULE_PERFORMANCE
-    { "performance", zjs_performance_init },
+    MODULE(performance, zjs_performance_init, NULL, 0),
+#endif
+#ifdef BUILD_MODULE_LOOPSTATS
+    MODULE(loopstats, zjs_loopstats_init, NULL, 0),
 #endif
 #ifdef BUILD_MODULE_OCF
-    { "ocf", zjs_ocf_init }
+    MODULE(ocf, zjs_ocf_init, NULL, 0),
 #endif
 };
 
@@ -98,70 +123,192 @@ struct routine_map {
 static uint8_t num_routines = 0;
 struct routine_map svc_routine_map[NUM_SERVICE_ROUTINES];
 
+// module objects of the JS modules loaded so far, by name
+static jerry_value_t js_module_cache = 0;
+
+// must match the wrapper in scripts/genjsmodules and src/snapshot.c
+#define JS_MODULE_PREFIX    "(function (exports, require, module) {"
+#define JS_MODULE_SUFFIX    "\n})"
+
+static uint32_t module_slot(const char *name, uint32_t len)
+{
+    // effects: returns the slot in the module table for name, see
+    //            MODULE_HASH_SEED
+    uint32_t hash = MODULE_HASH_SEED;
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash >> (32 - MODULE_SLOT_BITS);
+}
+
+static module_t *find_module(const char *name, uint32_t len)
+{
+    // effects: returns the native module called name, or NULL if there is
+    //            none in this build
+    module_t *mod = &zjs_modules_array[module_slot(name, len)];
+    if (mod->name && !strncmp(mod->name, name, len) && !mod->name[len]) {
+        return mod;
+    }
+    return NULL;
+}
+
+static void load_module(module_t *mod)
+{
+    // effects: runs the module's init function the first time, and records
+    //            how long it took
+    if (mod->instance) {
+        return;
+    }
+    uint64_t start = zjs_port_timer_get_uptime_us();
+    mod->instance = mod->init();
+    mod->init_us = zjs_port_timer_get_uptime_us() - start;
+    DBG_PRINT("module %s loaded in %u us\n", mod->name, mod->init_us);
+}
+
+#ifndef ZJS_SNAPSHOT_BUILD
+static jerry_value_t run_source(const char *source, uint32_t len)
+{
+    // effects: parses and runs source, returning its completion value
+    jerry_value_t code = jerry_parse((const jerry_char_t *)source, len, false);
+    if (jerry_value_has_error_flag(code)) {
+        return code;
+    }
+    jerry_value_t result = jerry_run(code);
+    jerry_release_value(code);
+    return result;
+}
+#endif
+
+static jerry_value_t compile_js_module(const char *name)
+{
+    // effects: returns the wrapper function of JS module name, or an error
+    for (const zjs_js_module_t *js = zjs_js_modules; js->name; js++) {
+        if (!strcmp(js->name, name)) {
+#ifdef ZJS_SNAPSHOT_BUILD
+            return jerry_exec_snapshot(js->code, js->len, false);
+#else
+            return run_source((const char *)js->code, js->len);
+#endif
+        }
+    }
+
+#if defined(ZJS_LINUX_BUILD) && !defined(ZJS_SNAPSHOT_BUILD)
+    // not built in; jslinux runs scripts it wasn't built with, so look in the
+    //   modules directory of the tree
+    const char *base = getenv("ZJS_BASE");
+    char path[256];
+    snprintf(path, sizeof(path), "%s/modules/%s", base ? base : ".", name);
+    const char *source;
+    uint32_t len;
+    if (!zjs_read_script(path, &source, &len)) {
+        uint32_t prefix = sizeof(JS_MODULE_PREFIX) - 1;
+        uint32_t suffix = sizeof(JS_MODULE_SUFFIX) - 1;
+        char *wrapped = zjs_malloc(prefix + len + suffix);
+        if (!wrapped) {
+            zjs_free_script(source);
+            return zjs_error("require: out of memory");
+        }
+        memcpy(wrapped, JS_MODULE_PREFIX, prefix);
+        memcpy(wrapped + prefix, source, len);
+        memcpy(wrapped + prefix + len, JS_MODULE_SUFFIX, suffix);
+        zjs_free_script(source);
+
+        jerry_value_t result = run_source(wrapped, prefix + len + suffix);
+        zjs_free(wrapped);
+        return result;
+    }
+#endif
+    return zjs_error("require: module not found");
+}
+
+static jerry_value_t load_js_module(const char *name)
+{
+    // effects: returns the exports of JS module name, running the module the
+    //            first time it is required
+    jerry_value_t module_obj = zjs_get_property(js_module_cache, name);
+    if (jerry_value_is_object(module_obj)) {
+        // loaded already, or still loading if modules require each other
+        jerry_value_t exports = zjs_get_property(module_obj, "exports");
+        jerry_release_value(module_obj);
+        return exports;
+    }
+    jerry_release_value(module_obj);
+
+#ifdef DEBUG_BUILD
+    uint64_t start = zjs_port_timer_get_uptime_us();
+#endif
+    jerry_value_t wrapper = compile_js_module(name);
+    if (jerry_value_has_error_flag(wrapper)) {
+        return wrapper;
+    }
+    if (!jerry_value_is_function(wrapper)) {
+        jerry_release_value(wrapper);
+        return zjs_error("require: invalid module");
+    }
+
+    // cache the module before running it, so a cycle gets its partial exports
+    module_obj = jerry_create_object();
+    jerry_value_t exports = jerry_create_object();
+    zjs_set_property(module_obj, "exports", exports);
+    zjs_set_property(js_module_cache, name, module_obj);
+
+    jerry_value_t global_obj = jerry_get_global_object();
+    jerry_value_t require = zjs_get_property(global_obj, "require");
+    jerry_value_t args[] = { exports, require, module_obj };
+    jerry_value_t rval = jerry_call_function(wrapper, exports, args, 3);
+    jerry_release_value(require);
+    jerry_release_value(global_obj);
+    jerry_release_value(exports);
+    jerry_release_value(wrapper);
+
+    if (jerry_value_has_error_flag(rval)) {
+        // let a later require try again
+        zjs_set_property(js_module_cache, name, ZJS_UNDEFINED);
+        jerry_release_value(module_obj);
+        return rval;
+    }
+    jerry_release_value(rval);
+
+    // the module may have replaced module.exports
+    exports = zjs_get_property(module_obj, "exports");
+    jerry_release_value(module_obj);
+#ifdef DEBUG_BUILD
+    DBG_PRINT("JavaScript module %s loaded in %u us\n", name,
+              (uint32_t)(zjs_port_timer_get_uptime_us() - start));
+#endif
+    return exports;
+}
+
 static jerry_value_t native_require_handler(const jerry_value_t function_obj,
                                             const jerry_value_t this,
                                             const jerry_value_t argv[],
                                             const jerry_length_t argc)
 {
-    jerry_value_t arg = argv[0];
-    if (!jerry_value_is_string(arg)) {
+    if (argc < 1 || !jerry_value_is_string(argv[0])) {
         return zjs_error("native_require_handler: invalid argument");
     }
 
     const int maxlen = 32;
     char module[maxlen];
-    jerry_size_t sz = jerry_get_string_size(arg);
+    jerry_size_t sz = jerry_get_string_size(argv[0]);
     if (sz >= maxlen) {
         return zjs_error("native_require_handler: argument too long");
     }
-    int len = jerry_string_to_char_buffer(arg, (jerry_char_t *)module, sz);
+    int len = jerry_string_to_char_buffer(argv[0], (jerry_char_t *)module,
+                                          sz);
     module[len] = '\0';
 
-    int modcount = sizeof(zjs_modules_array) / sizeof(module_t);
-    for (int i = 0; i < modcount; i++) {
-        module_t *mod = &zjs_modules_array[i];
-        if (!strcmp(mod->name, module)) {
-            // We only want one instance of each module at a time
-            if (mod->instance == 0) {
-                mod->instance = jerry_acquire_value(mod->init());
-            }
-            return mod->instance;
-        }
-    }
-    ZJS_PRINT("Native module not found, searching for JavaScript module %s\n", module);
-    jerry_value_t global_obj = jerry_get_global_object();
-    jerry_value_t modules_obj = zjs_get_property(global_obj, "module");
-    if (!jerry_value_is_object(modules_obj)) {
-        jerry_release_value(global_obj);
-        jerry_release_value(modules_obj);
-        return zjs_error("native_require_handler: modules object not found");
-    }
-    jerry_value_t exports_obj = zjs_get_property(modules_obj, "exports");
-    if (!jerry_value_is_object(exports_obj)) {
-        jerry_release_value(global_obj);
-        jerry_release_value(modules_obj);
-        jerry_release_value(exports_obj);
-        return zjs_error("native_require_handler: exports object not found");
+    module_t *mod = find_module(module, len);
+    if (mod) {
+        // We only want one instance of each module at a time
+        load_module(mod);
+        return jerry_acquire_value(mod->instance);
     }
 
-    for (int i = 0; i < 4; i++) {
-        // Strip the ".js"
-        module[len-i] = '\0';
+    if (len > 3 && !strcmp(module + len - 3, ".js")) {
+        return load_js_module(module);
     }
-
-    jerry_value_t found_obj = zjs_get_property(exports_obj, module);
-
-    if (jerry_value_is_object(found_obj)) {
-        ZJS_PRINT("JavaScript module %s loaded\n", module);
-        jerry_release_value(global_obj);
-        jerry_release_value(modules_obj);
-        jerry_release_value(exports_obj);
-        return found_obj;
-    }
-
-    jerry_release_value(global_obj);
-    jerry_release_value(modules_obj);
-    jerry_release_value(exports_obj);
     return zjs_error("native_require_handler: module not found");
 }
 
@@ -172,25 +319,26 @@ void zjs_modules_init()
     // create the C handler for require JS call
     zjs_obj_add_function(global_obj, native_require_handler, "require");
     jerry_release_value(global_obj);
+    js_module_cache = jerry_create_object();
 
-    // auto-load the events module without waiting for require(); needed so its
-    //   init function will run before it's used by UART, etc.
-    int modcount = sizeof(zjs_modules_array) / sizeof(module_t);
-    for (int i = 0; i < modcount; i++) {
+    // the rest are loaded the first time they're required
+    for (int i = 0; i < MODULE_SLOTS; i++) {
         module_t *mod = &zjs_modules_array[i];
-
-        // DEV: if you add another module name here, remove the break below
-        if (!strcmp(mod->name, "events")) {
-            mod->instance = jerry_acquire_value(mod->init());
-            break;
+        if (!mod->name) {
+            continue;
+        }
+        if (mod->flags & MODULE_EAGER) {
+            load_module(mod);
         }
     }
 }
 
 void zjs_modules_cleanup()
 {
-    int modcount = sizeof(zjs_modules_array) / sizeof(module_t);
-    for (int i = 0; i < modcount; i++) {
+    jerry_release_value(js_module_cache);
+    js_module_cache = 0;
+
+    for (int i = 0; i < MODULE_SLOTS; i++) {
         module_t *mod = &zjs_modules_array[i];
         if (mod->instance) {
             if (mod->cleanup) {
@@ -202,10 +350,27 @@ void zjs_modules_cleanup()
     }
 }
 
+void zjs_foreach_module(zjs_module_func func, void* data)
+{
+    for (int i = 0; i < MODULE_SLOTS; i++) {
+        module_t *mod = &zjs_modules_array[i];
+        if (mod->name) {
+            func(mod->name, mod->instance != 0, mod->init_us, data);
+        }
+    }
+}
+
 void zjs_register_service_routine(void* handle, zjs_service_routine func)
 {
+    for (int i = 0; i < num_routines; ++i) {
+        if (svc_routine_map[i].func == func &&
+            svc_routine_map[i].handle == handle) {
+            // already registered, e.g. by a module loaded again
+            return;
+        }
+    }
     if (num_routines >= NUM_SERVICE_ROUTINES) {
-        DBG_PRINT(("not enough space, increase NUM_SERVICE_ROUTINES\n"));
+        ERR_PRINT("not enough space, increase NUM_SERVICE_ROUTINES\n");
         return;
     }
     svc_routine_map[num_routines].handle = handle;
@@ -214,10 +379,16 @@ void zjs_register_service_routine(void* handle, zjs_service_routine func)
     return;
 }
 
-void zjs_service_routines(void)
+int32_t zjs_service_routines(void)
 {
     int i;
+    int32_t wait = ZJS_TICKS_FOREVER;
     for (i = 0; i < num_routines; ++i) {
-        svc_routine_map[i].func(svc_routine_map[i].handle);
+        int32_t next = svc_routine_map[i].func(svc_routine_map[i].handle);
+        if (next != ZJS_TICKS_FOREVER &&
+            (wait == ZJS_TICKS_FOREVER || next < wait)) {
+            wait = next;
+        }
     }
+    return wait;
 }
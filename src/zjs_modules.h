@@ -9,13 +9,37 @@
 
 #include "jerry-api.h"
 
-#define NUM_SERVICE_ROUTINES 3
+#define NUM_SERVICE_ROUTINES 4
 
-typedef void (*zjs_service_routine)(void* handle);
+// A service routine returns the ms until it needs to be called again, or
+//   ZJS_TICKS_FOREVER if it has nothing scheduled
+typedef int32_t (*zjs_service_routine)(void* handle);
+
+// Called with each native module in the build, whether it has been loaded by
+//   require() yet, and how long its init function took, in us
+typedef void (*zjs_module_func)(const char* name, bool loaded,
+                                uint32_t init_us, void* data);
+
+// A JavaScript module built into the image, e.g. modules/Assert.js. The source
+//   is wrapped in a function taking (exports, require, module), so each module
+//   has its own scope; in snapshot builds code is the snapshot of that source.
+//   The table is generated by scripts/genjsmodules, or by the snapshot tool.
+typedef struct zjs_js_module {
+    const char* name;
+    const uint8_t* code;
+    uint32_t len;
+} zjs_js_module_t;
+
+// ends with an entry with a NULL name
+extern const zjs_js_module_t zjs_js_modules[];
 
 void zjs_modules_init();
 void zjs_modules_cleanup();
+// Calls func for each native module, in no particular order
+void zjs_foreach_module(zjs_module_func func, void* data);
 void zjs_register_service_routine(void* handle, zjs_service_routine func);
-void zjs_service_routines(void);
+// Calls all service routines, returns the soonest time any of them needs to
+//   be called again, in ms, or ZJS_TICKS_FOREVER
+int32_t zjs_service_routines(void);
 
 #endif  // __zjs_modules_h__
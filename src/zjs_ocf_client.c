@@ -497,7 +497,7 @@ static jerry_value_t ocf_find_resources(const jerry_value_t function_val,
     }
 
     struct ocf_handler* h = new_ocf_handler(NULL);
-    h->promise_obj = promise;
+    h->promise_obj = jerry_acquire_value(promise);
 
     zjs_make_promise(promise, post_ocf_promise, h);
 
@@ -619,7 +619,7 @@ static jerry_value_t ocf_retrieve(const jerry_value_t function_val,
 
     h = new_ocf_handler(resource);
     h->res = resource;
-    h->promise_obj = promise;
+    h->promise_obj = jerry_acquire_value(promise);
 
     zjs_make_promise(promise, post_ocf_promise, h);
 
@@ -693,7 +693,7 @@ static jerry_value_t ocf_update(const jerry_value_t function_val,
     h = new_ocf_handler(resource);
     zjs_make_promise(promise, post_ocf_promise, h);
     h->res = resource;
-    h->promise_obj = promise;
+    h->promise_obj = jerry_acquire_value(promise);
 
     if (oc_init_put(resource->resource_path,
                     &resource->server,
@@ -771,7 +771,7 @@ static jerry_value_t ocf_delete(const jerry_value_t function_val,
 
     h = new_ocf_handler(resource);
     zjs_make_promise(promise, post_ocf_promise, h);
-    h->promise_obj = promise;
+    h->promise_obj = jerry_acquire_value(promise);
 
     if (!oc_do_delete(uri, &resource->server, delete_finished, LOW_QOS, h)) {
         ERR_PRINT("DELETE call failed\n");
@@ -874,7 +874,7 @@ static jerry_value_t ocf_get_platform_info(const jerry_value_t function_val,
 
     h = new_ocf_handler(resource);
     zjs_make_promise(promise, post_ocf_promise, h);
-    h->promise_obj = promise;
+    h->promise_obj = jerry_acquire_value(promise);
 
     DBG_PRINT("sending GET to /oic/p\n");
 
@@ -980,7 +980,7 @@ static jerry_value_t ocf_get_device_info(const jerry_value_t function_val,
 
     h = new_ocf_handler(resource);
     zjs_make_promise(promise, post_ocf_promise, h);
-    h->promise_obj = promise;
+    h->promise_obj = jerry_acquire_value(promise);
 
     DBG_PRINT("sending GET to /oic/d\n");
 
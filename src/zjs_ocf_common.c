@@ -1,7 +1,14 @@
 #ifdef BUILD_MODULE_OCF
 
+#ifndef ZJS_LINUX_BUILD
+#include "zjs_zephyr_port.h"
+#else
+#include "zjs_linux_port.h"
+#endif
+
 #include "jerry-api.h"
 
+#include "zjs_callbacks.h"
 #include "zjs_util.h"
 #include "zjs_common.h"
 
@@ -185,10 +192,12 @@ void zjs_ocf_free_props(void* h)
 }
 
 /*
- * Must be defined for iotivity-constrained
+ * Must be defined for iotivity-constrained, called when it has new work for
+ * oc_main_poll(), possibly from its network thread
  */
 void oc_signal_main_loop(void)
 {
+    zjs_loop_unblock();
 }
 
 // Probably can remove this
@@ -203,9 +212,18 @@ static void app_init(void)
     oc_add_device("/oic/d", "oic.d.zephyrjs", "Zephyr.js Device", "1.0", "1.0", NULL, NULL);
 }
 
-void main_poll_routine(void* handle)
+int32_t main_poll_routine(void* handle)
 {
-    oc_main_poll();
+    // oc_main_poll() returns the absolute time of its next event, or 0
+    oc_clock_time_t next_event = oc_main_poll();
+    if (!next_event) {
+        return ZJS_TICKS_FOREVER;
+    }
+    oc_clock_time_t now = oc_clock_time();
+    if (next_event <= now) {
+        return 0;
+    }
+    return (int32_t)((next_event - now) * 1000 / OC_CLOCK_SECOND);
 }
 
 static const oc_handler_t handler = { .init = app_init,
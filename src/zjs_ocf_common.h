@@ -68,8 +68,11 @@ void zjs_ocf_free_props(void* h);
 
 /*
  * Routine to call into iotivity-constrained
+ *
+ * @return              ms until iotivity-constrained needs to be polled again,
+ *                        or ZJS_TICKS_FOREVER if it has no pending events
  */
-void main_poll_routine(void* handle);
+int32_t main_poll_routine(void* handle);
 
 /*
  * Object returned from require('ocf')
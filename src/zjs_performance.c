@@ -1,13 +1,15 @@
 // Copyright (c) 2016, Linaro Limited.
 #ifdef BUILD_MODULE_PERFORMANCE
 
+#ifndef ZJS_LINUX_BUILD
+#include "zjs_zephyr_port.h"
+#else
+#include "zjs_linux_port.h"
+#endif
+
 // ZJS includes
 #include "zjs_util.h"
 
-#ifdef ZJS_LINUX_BUILD
-#include <sys/time.h>
-#endif
-
 static jerry_value_t zjs_performance_now(const jerry_value_t function_obj,
                                          const jerry_value_t this,
                                          const jerry_value_t argv[],
@@ -15,13 +17,8 @@ static jerry_value_t zjs_performance_now(const jerry_value_t function_obj,
 {
     if (argc != 0)
         return zjs_error("performance.now: no args expected");
-#ifdef ZJS_LINUX_BUILD
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    uint64_t useconds = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
-#else
-    uint64_t useconds = (uint64_t)k_uptime_get() * 1000;
-#endif
+    // same monotonic clock timers are scheduled with
+    uint64_t useconds = zjs_port_timer_get_uptime_us();
     return jerry_create_number((double)useconds / 1000);
 }
 
@@ -6,193 +6,518 @@
 #include "zjs_promise.h"
 #include "zjs_callbacks.h"
 
+// most args fulfill or reject can pass on to then() or catch()
+#define PROMISE_MAX_ARGS    2
+// promise records allocated at once when the free list runs dry
+#define PROMISE_SLAB_SIZE   8
+
+enum promise_state {
+    PROMISE_PENDING,
+    PROMISE_FULFILLED,
+    PROMISE_REJECTED
+};
+
+// Promise state is kept on the promise object's native handle, in records
+// from fixed size slabs that are never freed, like callback records
+//
+// then() makes a new promise that is a child of the one it was called on.
+// When the parent settles, its handlers run on the parent's result and
+// their return value resolves the child. A parent holds a reference to each
+// child until then, so a pending promise nothing else refers to is
+// collected along with its children.
 struct promise {
+    struct promise* next;       // next in the resolution queue or free list
+    struct promise* children;   // promises from then(), in the order made
+    struct promise* sibling;    // next child of the same parent
+    uint8_t state;              // enum promise_state
+    uint8_t locked;             // resolved, maybe to a promise still pending
+    uint8_t queued;             // in the resolution queue
+    uint8_t posted;             // post function has been called
     uint8_t then_set;           // then() function has been set
-    jerry_value_t then;         // Function registered from then()
-    zjs_callback_id then_id;    // Callback ID for then JS callback
     uint8_t catch_set;          // catch() function has been set
-    jerry_value_t catch;        // Function registered from catch()
-    zjs_callback_id catch_id;   // Callback ID for catch JS callback
-    jerry_value_t this;         // 'this' object for this promise
+    jerry_value_t then;         // handler for the parent's fulfillment
+    jerry_value_t catch;        // handler for the parent's rejection
+    jerry_value_t this;         // the promise object, not a reference
     void* user_handle;
     zjs_post_promise_func post;
+    uint32_t argc;              // result args, once settled
+    jerry_value_t argv[PROMISE_MAX_ARGS];
 };
 
-struct promise* new_promise(void)
+// Resolving functions given to a foreign thenable's then(), only the first
+// call of either one counts
+struct promise_resolver {
+    jerry_value_t promise;
+    uint8_t refs;               // resolving functions still alive
+    uint8_t done;
+};
+
+static jerry_value_t zjs_promise_prototype = 0;
+static struct promise* free_promises = NULL;
+
+// settled promises whose children are waiting for their handlers to run, in
+//   the order they settled
+static struct promise* queue_head = NULL;
+static struct promise* queue_tail = NULL;
+static bool queue_scheduled = false;
+
+static void resolve_value(struct promise* handle, jerry_value_t value);
+
+static struct promise* new_promise(void)
 {
-    struct promise* new = zjs_malloc(sizeof(struct promise));
+    if (!free_promises) {
+        struct promise* slab = zjs_malloc(sizeof(struct promise) *
+                                          PROMISE_SLAB_SIZE);
+        if (!slab) {
+            return NULL;
+        }
+        for (int i = 0; i < PROMISE_SLAB_SIZE; ++i) {
+            slab[i].next = free_promises;
+            free_promises = &slab[i];
+        }
+    }
+    struct promise* new = free_promises;
+    free_promises = new->next;
     memset(new, 0, sizeof(struct promise));
-    new->catch_id = -1;
-    new->then_id = -1;
     return new;
 }
 
-// Dummy function for then/catch
-static jerry_value_t null_function(const jerry_value_t function_obj,
-                                   const jerry_value_t this,
-                                   const jerry_value_t argv[],
-                                   const jerry_length_t argc)
+static void release_children(struct promise* handle)
 {
-    return ZJS_UNDEFINED;
+    // effects: drops the parent's references to its children
+    struct promise* child = handle->children;
+    handle->children = NULL;
+    while (child) {
+        struct promise* sibling = child->sibling;
+        jerry_release_value(child->this);
+        child = sibling;
+    }
 }
 
-static void post_promise(void* h, jerry_value_t* ret_val)
+static void promise_free(const uintptr_t native)
 {
-    struct promise* handle = (struct promise*)h;
-    if (handle) {
-        if (handle->post) {
-            handle->post(handle->user_handle);
-        }
+    // effects: returns the record of a garbage collected promise object to
+    //            the free list
+    struct promise* handle = (struct promise*)native;
+    release_children(handle);
+    if (handle->then_set) {
         jerry_release_value(handle->then);
+    }
+    if (handle->catch_set) {
         jerry_release_value(handle->catch);
-        jerry_release_value(handle->this);
     }
+    if (handle->state != PROMISE_PENDING) {
+        for (int i = 0; i < handle->argc; ++i) {
+            jerry_release_value(handle->argv[i]);
+        }
+    }
+    handle->next = free_promises;
+    free_promises = handle;
 }
 
-static void promise_free(const uintptr_t native)
+static struct promise* find_promise(jerry_value_t obj)
 {
-    struct promise* handle = (struct promise*)native;
-    if (handle) {
-        zjs_free(handle);
+    // effects: returns the record of a promise object, or NULL if obj is not
+    //            one
+    uintptr_t handle;
+    if (!jerry_value_is_object(obj) ||
+        !jerry_get_object_native_handle(obj, &handle)) {
+        return NULL;
     }
+    // other objects have native handles too, only trust ours
+    jerry_value_t proto = jerry_get_prototype(obj);
+    bool is_promise = proto == zjs_promise_prototype;
+    jerry_release_value(proto);
+    return is_promise ? (struct promise*)handle : NULL;
 }
 
-static jerry_value_t promise_then(const jerry_value_t function_obj,
-                                   const jerry_value_t this,
-                                   const jerry_value_t argv[],
-                                   const jerry_length_t argc)
+static struct promise* create_promise(jerry_value_t obj)
 {
-    struct promise* handle = NULL;
+    // requires: obj is a new object without a native handle
+    //  effects: makes obj a pending promise, and returns its record, or NULL
+    //             if out of memory
+    struct promise* new = new_promise();
+    if (!new) {
+        ERR_PRINT("unable to allocate promise\n");
+        return NULL;
+    }
 
-    jerry_value_t promise_obj = zjs_get_property(this, "promise");
-    jerry_get_object_native_handle(promise_obj, (uintptr_t*)&handle);
+    new->this = obj;
 
-    jerry_release_value(promise_obj);
-    if (jerry_value_is_function(argv[0])) {
-        if (handle) {
-            jerry_release_value(handle->then);
-            handle->then = jerry_acquire_value(argv[0]);
-            zjs_edit_js_func(handle->then_id, handle->then);
-            handle->then_set = 1;
-        }
-
-        // Return the promise so it can be used by catch()
-        return this;
-    } else {
-        return ZJS_UNDEFINED;
-    }
+    jerry_set_prototype(obj, zjs_promise_prototype);
+    jerry_set_object_native_handle(obj, (uintptr_t)new, promise_free);
+    return new;
 }
 
-static jerry_value_t promise_catch(const jerry_value_t function_obj,
-                                   const jerry_value_t this,
-                                   const jerry_value_t argv[],
-                                   const jerry_length_t argc)
+static void resolve_immediate(void* h, const jerry_value_t argv[],
+                              uint32_t argc);
+
+static void queue_promise(struct promise* handle)
 {
-    struct promise* handle = NULL;
+    // requires: handle is settled
+    //  effects: queues its children to have their handlers run
+    if (handle->queued) {
+        return;
+    }
+    handle->queued = 1;
+    // the queue keeps the promise alive
+    jerry_acquire_value(handle->this);
 
-    jerry_value_t promise_obj = zjs_get_property(this, "promise");
-    jerry_get_object_native_handle(promise_obj, (uintptr_t*)&handle);
+    handle->next = NULL;
+    if (queue_tail) {
+        queue_tail->next = handle;
+    } else {
+        queue_head = handle;
+    }
+    queue_tail = handle;
 
-    jerry_release_value(promise_obj);
-    if (handle) {
-        if (jerry_value_is_function(argv[0])) {
-            jerry_release_value(handle->catch);
-            handle->catch = jerry_acquire_value(argv[0]);
-            zjs_edit_js_func(handle->catch_id, handle->catch);
-            handle->catch_set = 1;
+    if (!queue_scheduled) {
+        queue_scheduled = zjs_queue_immediate(resolve_immediate, NULL, NULL,
+                                              0) != 0;
+        if (!queue_scheduled) {
+            ERR_PRINT("unable to schedule promise calls\n");
         }
     }
-    return ZJS_UNDEFINED;
 }
 
-void zjs_make_promise(jerry_value_t obj, zjs_post_promise_func post,
-                      void* handle)
+static void add_child(struct promise* parent, struct promise* child)
 {
-    struct promise* new = new_promise();
-    jerry_value_t promise_obj = jerry_create_object();
+    // effects: makes child wait for parent to settle, after any children it
+    //            has already; the parent keeps the child alive until then
+    jerry_acquire_value(child->this);
+    struct promise** link = &parent->children;
+    while (*link) {
+        link = &(*link)->sibling;
+    }
+    child->sibling = NULL;
+    *link = child;
+    if (parent->state != PROMISE_PENDING) {
+        queue_promise(parent);
+    }
+}
 
-    zjs_obj_add_function(obj, promise_then, "then");
-    zjs_obj_add_function(obj, promise_catch, "catch");
-    jerry_set_object_native_handle(promise_obj, (uintptr_t)new, promise_free);
+static void settle_promise(struct promise* handle, const jerry_value_t argv[],
+                           uint32_t argc, bool rejected)
+{
+    // effects: fulfills or rejects the promise with args, and queues its
+    //            children
+    if (handle->state != PROMISE_PENDING) {
+        return;
+    }
+    if (argc > PROMISE_MAX_ARGS) {
+        ERR_PRINT("promise given %lu args, passing %u\n", argc,
+                  PROMISE_MAX_ARGS);
+        argc = PROMISE_MAX_ARGS;
+    }
+    for (int i = 0; i < argc; ++i) {
+        handle->argv[i] = jerry_acquire_value(argv[i]);
+    }
+    handle->argc = argc;
+    handle->state = rejected ? PROMISE_REJECTED : PROMISE_FULFILLED;
+    handle->locked = 1;
 
-    new->user_handle = handle;
-    new->post = post;
-    new->then_set = 0;
-    new->catch_set = 0;
-    new->this = jerry_acquire_value(obj);
+    // a root promise calls its post function even with no handlers
+    queue_promise(handle);
+}
 
-    // Add the "promise" object to the object passed as a property, because the
-    // object being made to a promise may already have a native handle.
-    zjs_obj_add_object(obj, promise_obj, "promise");
+static void run_child(struct promise* parent, struct promise* child)
+{
+    // requires: parent is settled
+    //  effects: calls the child's handler for the parent's result, with this
+    //             undefined, and resolves the child with what it returns, or
+    //             rejects it with what it throws; with no handler, settles
+    //             the child the same way as the parent
+    bool rejected = parent->state == PROMISE_REJECTED;
+    uint8_t set = rejected ? child->catch_set : child->then_set;
+    if (!set) {
+        settle_promise(child, parent->argv, parent->argc, rejected);
+        return;
+    }
 
-    DBG_PRINT("created promise, obj=%lu, promise=%p, handle=%p\n", obj, new,
-              handle);
+    jerry_value_t func = rejected ? child->catch : child->then;
+    jerry_value_t ret_val = jerry_call_function(func, ZJS_UNDEFINED,
+                                                parent->argv, parent->argc);
+    if (jerry_value_has_error_flag(ret_val)) {
+        DBG_PRINT("promise callback returned an error\n");
+        jerry_value_clear_error_flag(&ret_val);
+        settle_promise(child, &ret_val, 1, true);
+    } else {
+        resolve_value(child, ret_val);
+    }
+    jerry_release_value(ret_val);
 }
 
-void zjs_fulfill_promise(jerry_value_t obj, jerry_value_t argv[], uint32_t argc)
+static void resolve_immediate(void* h, const jerry_value_t argv[],
+                              uint32_t argc)
 {
-    struct promise* handle = NULL;
-    jerry_value_t promise_obj = zjs_get_property(obj, "promise");
+    // promises settled by these handlers are run too, like microtasks, so a
+    //   whole chain completes in one pass of the loop
+    while (queue_head) {
+        struct promise* handle = queue_head;
+        queue_head = handle->next;
+        if (!queue_head) {
+            queue_tail = NULL;
+        }
+        handle->queued = 0;
+
+        // take the children first, then() may add more while they run
+        struct promise* child = handle->children;
+        handle->children = NULL;
+        while (child) {
+            struct promise* sibling = child->sibling;
+            run_child(handle, child);
+            jerry_release_value(child->this);
+            child = sibling;
+        }
 
-    if (!jerry_value_is_object(promise_obj)) {
-        ERR_PRINT("'promise' not found in object %lu\n", obj);
-        return;
+        if (handle->post && !handle->posted) {
+            handle->posted = 1;
+            handle->post(handle->user_handle);
+        }
+        // this may let the object, and this record with it, be collected
+        jerry_release_value(handle->this);
     }
+    queue_scheduled = false;
+}
 
-    jerry_get_object_native_handle(promise_obj, (uintptr_t*)&handle);
+static void resolver_free(const uintptr_t native)
+{
+    struct promise_resolver* resolver = (struct promise_resolver*)native;
+    if (--resolver->refs == 0) {
+        jerry_release_value(resolver->promise);
+        zjs_free(resolver);
+    }
+}
 
+static jerry_value_t call_resolver(const jerry_value_t function_obj,
+                                   const jerry_value_t argv[],
+                                   const jerry_length_t argc, bool rejected)
+{
+    struct promise_resolver* resolver = NULL;
+    jerry_get_object_native_handle(function_obj, (uintptr_t*)&resolver);
+    if (!resolver || resolver->done) {
+        return ZJS_UNDEFINED;
+    }
+    resolver->done = 1;
+
+    struct promise* handle = find_promise(resolver->promise);
     if (handle) {
-        // Put *something* here in case it never gets registered
-        if (!handle->then_set) {
-            handle->then = jerry_create_external_function(null_function);
+        jerry_value_t value = argc >= 1 ? argv[0] : ZJS_UNDEFINED;
+        if (rejected) {
+            settle_promise(handle, &value, 1, true);
+        } else {
+            // the promise was locked waiting for this
+            handle->locked = 0;
+            resolve_value(handle, value);
         }
+    }
+    return ZJS_UNDEFINED;
+}
 
-        handle->then_id = zjs_add_callback_once(handle->then,
-                                                handle->this,
-                                                handle,
-                                                post_promise);
+static jerry_value_t resolver_fulfill(const jerry_value_t function_obj,
+                                      const jerry_value_t this,
+                                      const jerry_value_t argv[],
+                                      const jerry_length_t argc)
+{
+    return call_resolver(function_obj, argv, argc, false);
+}
+
+static jerry_value_t resolver_reject(const jerry_value_t function_obj,
+                                     const jerry_value_t this,
+                                     const jerry_value_t argv[],
+                                     const jerry_length_t argc)
+{
+    return call_resolver(function_obj, argv, argc, true);
+}
 
-        zjs_signal_callback(handle->then_id, argv, argc * sizeof(jerry_value_t));
+static void adopt_thenable(struct promise* handle, jerry_value_t thenable,
+                           jerry_value_t then)
+{
+    // requires: then is the then() function of thenable, which is not one of
+    //             our promises
+    //  effects: calls then() with functions that resolve or reject the
+    //             promise
+    struct promise_resolver* resolver =
+        zjs_malloc(sizeof(struct promise_resolver));
+    if (!resolver) {
+        jerry_value_t error = zjs_error("promise: out of memory");
+        jerry_value_clear_error_flag(&error);
+        settle_promise(handle, &error, 1, true);
+        jerry_release_value(error);
+        return;
+    }
+    resolver->promise = jerry_acquire_value(handle->this);
+    resolver->refs = 2;
+    resolver->done = 0;
+
+    jerry_value_t funcs[2];
+    funcs[0] = jerry_create_external_function(resolver_fulfill);
+    funcs[1] = jerry_create_external_function(resolver_reject);
+    jerry_set_object_native_handle(funcs[0], (uintptr_t)resolver,
+                                   resolver_free);
+    jerry_set_object_native_handle(funcs[1], (uintptr_t)resolver,
+                                   resolver_free);
+
+    jerry_value_t ret_val = jerry_call_function(then, thenable, funcs, 2);
+    if (jerry_value_has_error_flag(ret_val) && !resolver->done) {
+        resolver->done = 1;
+        jerry_value_clear_error_flag(&ret_val);
+        settle_promise(handle, &ret_val, 1, true);
+    }
+    jerry_release_value(ret_val);
+    jerry_release_value(funcs[0]);
+    jerry_release_value(funcs[1]);
+}
 
-        DBG_PRINT("fulfilling promise, obj=%lu, then_id=%d, argv=%p, nargs=%lu\n",
-                  obj, handle->then_id, argv, argc);
+static void resolve_value(struct promise* handle, jerry_value_t value)
+{
+    // effects: resolves the promise with value, following it if it is a
+    //            promise or another object with a then() function
+    if (handle->locked) {
+        return;
+    }
+    handle->locked = 1;
+
+    struct promise* other = find_promise(value);
+    if (other == handle) {
+        jerry_value_t error = zjs_error("promise: resolved with itself");
+        jerry_value_clear_error_flag(&error);
+        settle_promise(handle, &error, 1, true);
+        jerry_release_value(error);
+    } else if (other) {
+        // settles the same way as other, with no handlers of its own
+        if (handle->then_set) {
+            jerry_release_value(handle->then);
+            handle->then_set = 0;
+        }
+        if (handle->catch_set) {
+            jerry_release_value(handle->catch);
+            handle->catch_set = 0;
+        }
+        add_child(other, handle);
     } else {
-        ERR_PRINT("native handle not found\n");
+        jerry_value_t then = ZJS_UNDEFINED;
+        if (jerry_value_is_object(value)) {
+            then = zjs_get_property(value, "then");
+        }
+        if (jerry_value_is_function(then)) {
+            adopt_thenable(handle, value, then);
+        } else {
+            settle_promise(handle, &value, 1, false);
+        }
+        jerry_release_value(then);
+    }
+}
+
+static jerry_value_t promise_then(const jerry_value_t function_obj,
+                                  const jerry_value_t this,
+                                  const jerry_value_t argv[],
+                                  const jerry_length_t argc)
+{
+    // requires: this is a promise, argv[0] is the optional fulfillment
+    //             handler and argv[1] the optional rejection handler
+    //  effects: returns a new promise resolved with what the handler returns
+    struct promise* parent = find_promise(this);
+    if (!parent) {
+        return zjs_error("promise_then: not a promise");
     }
 
-    jerry_release_value(promise_obj);
+    jerry_value_t promise = jerry_create_object();
+    struct promise* child = create_promise(promise);
+    if (!child) {
+        jerry_release_value(promise);
+        return zjs_error("promise_then: out of memory");
+    }
+    if (argc >= 1 && jerry_value_is_function(argv[0])) {
+        child->then = jerry_acquire_value(argv[0]);
+        child->then_set = 1;
+    }
+    if (argc >= 2 && jerry_value_is_function(argv[1])) {
+        child->catch = jerry_acquire_value(argv[1]);
+        child->catch_set = 1;
+    }
+    add_child(parent, child);
+    return promise;
 }
 
-void zjs_reject_promise(jerry_value_t obj, jerry_value_t argv[], uint32_t argc)
+static jerry_value_t promise_catch(const jerry_value_t function_obj,
+                                   const jerry_value_t this,
+                                   const jerry_value_t argv[],
+                                   const jerry_length_t argc)
 {
-    struct promise* handle = NULL;
-    jerry_value_t promise_obj = zjs_get_property(obj, "promise");
+    // requires: this is a promise, argv[0] is the rejection handler
+    //  effects: same as then(undefined, handler)
+    jerry_value_t args[2] = { ZJS_UNDEFINED, ZJS_UNDEFINED };
+    if (argc >= 1) {
+        args[1] = argv[0];
+    }
+    return promise_then(function_obj, this, args, 2);
+}
 
-    if (!jerry_value_is_object(promise_obj)) {
-        ERR_PRINT("'promise' not found in object %lu\n", obj);
-        return;
+void zjs_make_promise(jerry_value_t obj, zjs_post_promise_func post,
+                      void* handle)
+{
+    struct promise* new = create_promise(obj);
+    if (new) {
+        new->user_handle = handle;
+        new->post = post;
     }
 
-    jerry_get_object_native_handle(promise_obj, (uintptr_t*)&handle);
+    DBG_PRINT("created promise, obj=%lu, promise=%p, handle=%p\n", obj, new,
+              handle);
+}
 
-    if (handle) {
-        // Put *something* here in case it never gets registered
-        if (!handle->catch_set) {
-            handle->catch = jerry_create_external_function(null_function);
-        }
+static void settle_root(jerry_value_t obj, jerry_value_t argv[],
+                        uint32_t argc, bool rejected)
+{
+    struct promise* handle = find_promise(obj);
+    if (!handle) {
+        ERR_PRINT("promise not found in object %lu\n", obj);
+        return;
+    }
+    if (handle->state != PROMISE_PENDING) {
+        DBG_PRINT("promise already settled, obj=%lu\n", obj);
+        return;
+    }
+    settle_promise(handle, argv, argc, rejected);
+}
 
-        handle->catch_id = zjs_add_callback_once(handle->catch,
-                                                 handle->this,
-                                                 handle,
-                                                 post_promise);
+void zjs_fulfill_promise(jerry_value_t obj, jerry_value_t argv[], uint32_t argc)
+{
+    DBG_PRINT("fulfilling promise, obj=%lu, argv=%p, nargs=%lu\n",
+              obj, argv, argc);
+    settle_root(obj, argv, argc, false);
+}
 
-        zjs_signal_callback(handle->catch_id, argv, argc * sizeof(jerry_value_t));
+void zjs_reject_promise(jerry_value_t obj, jerry_value_t argv[], uint32_t argc)
+{
+    DBG_PRINT("rejecting promise, obj=%lu, argv=%p, nargs=%lu\n",
+              obj, argv, argc);
+    settle_root(obj, argv, argc, true);
+}
 
-        DBG_PRINT("rejecting promise, obj=%lu, catch_id=%d, argv=%p, nargs=%lu\n",
-                  obj, handle->catch_id, argv, argc);
-    } else {
-        ERR_PRINT("native handle not found\n");
-    }
+void zjs_promise_init()
+{
+    zjs_native_func_t array[] = {
+        { promise_then, "then" },
+        { promise_catch, "catch" },
+        { NULL, NULL }
+    };
+    zjs_promise_prototype = jerry_create_object();
+    zjs_obj_add_functions(zjs_promise_prototype, array);
+}
 
-    jerry_release_value(promise_obj);
+void zjs_promise_cleanup()
+{
+    // drop the handler calls still queued, resolve_immediate() will find none
+    while (queue_head) {
+        struct promise* handle = queue_head;
+        queue_head = handle->next;
+        handle->queued = 0;
+        release_children(handle);
+        jerry_release_value(handle->this);
+    }
+    queue_tail = NULL;
+    queue_scheduled = false;
+    jerry_release_value(zjs_promise_prototype);
 }
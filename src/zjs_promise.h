@@ -13,9 +13,20 @@
 typedef void (*zjs_post_promise_func)(void* handle);
 
 /*
- * Turn an object into a promise
+ * Initialize the promise prototype, or reinitialize after cleanup
+ */
+void zjs_promise_init();
+
+/*
+ * Release the promise prototype and drop unfinished then()/catch() calls
+ */
+void zjs_promise_cleanup();
+
+/*
+ * Turn an object into a promise, by giving it the promise prototype and
+ * keeping its state in the object's native handle
  *
- * @param obj           Object to make a promise
+ * @param obj           New object without a native handle to make a promise
  * @param post          Function to be called when the promise has been fulfilled/rejected
  * @param handle        Handle passed to post function
  */
@@ -2,8 +2,12 @@
 
 #ifdef ZJS_LINUX_BUILD
 
+#include <fcntl.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "zjs_script.h"
 
@@ -54,6 +58,91 @@ uint8_t zjs_read_script(char* name, const char** script, uint32_t* length)
     return 0;
 }
 
+uint8_t zjs_map_snapshot(char* name, const uint32_t** snapshot,
+                         uint32_t* length)
+{
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        ERR_PRINT("error opening file\n");
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size == 0) {
+        ERR_PRINT("error reading size of snapshot file\n");
+        close(fd);
+        return 1;
+    }
+    // the snapshot is run in place, so it stays mapped for good; mmap also
+    //   gives it the alignment JerryScript needs
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        ERR_PRINT("error mapping snapshot file\n");
+        return 1;
+    }
+
+    *snapshot = (const uint32_t*)map;
+    *length = st.st_size;
+    return 0;
+}
+
+// largest snapshot zjs_compile_script() will try to make
+#define MAX_SNAPSHOT_SIZE   (16 * 1024 * 1024)
+
+uint8_t zjs_compile_script(const char* script, uint32_t length, char* output,
+                           uint32_t* size)
+{
+    // parse first, so a syntax error isn't taken for a full buffer below
+    jerry_value_t code = jerry_parse((const jerry_char_t*)script, length,
+                                     false);
+    if (jerry_value_has_error_flag(code)) {
+        ERR_PRINT("JerryScript: cannot parse javascript\n");
+        jerry_release_value(code);
+        return 1;
+    }
+    jerry_release_value(code);
+
+    uint8_t* buf = NULL;
+    size_t saved = 0;
+    for (size_t buf_size = 64 * 1024; !saved && buf_size <= MAX_SNAPSHOT_SIZE;
+         buf_size *= 2) {
+        zjs_free(buf);
+        buf = (uint8_t*)zjs_malloc(buf_size);
+        if (!buf) {
+            ERR_PRINT("error allocating %u bytes\n", (uint32_t)buf_size);
+            return 1;
+        }
+        saved = jerry_parse_and_save_snapshot((const jerry_char_t*)script,
+                                              length, true, false, buf,
+                                              buf_size);
+    }
+    if (!saved) {
+        ERR_PRINT("JerryScript: failed to create snapshot\n");
+        zjs_free(buf);
+        return 1;
+    }
+
+    FILE* f = fopen(output, "wb");
+    if (!f) {
+        ERR_PRINT("error opening file %s\n", output);
+        zjs_free(buf);
+        return 1;
+    }
+    uint8_t rval = 0;
+    if (fwrite(buf, saved, 1, f) != 1) {
+        ERR_PRINT("error writing snapshot file\n");
+        rval = 1;
+    }
+    if (fclose(f)) {
+        ERR_PRINT("error closing snapshot file\n");
+        rval = 1;
+    }
+    zjs_free(buf);
+
+    *size = saved;
+    return rval;
+}
+
 void zjs_free_script(const char* script)
 {
     if (script) {
@@ -12,4 +12,15 @@ uint8_t zjs_read_script(char* name, const char** script, uint32_t* length);
 
 void zjs_free_script(const char* script);
 
+// Maps snapshot file name read-only, to run in place with jerry_exec_snapshot;
+//   the mapping is never released, since functions the snapshot defines
+//   point into it. Returns 0 on success.
+uint8_t zjs_map_snapshot(char* name, const uint32_t** snapshot,
+                         uint32_t* length);
+
+// Saves a snapshot of script in file output, and its size in size. Returns 0
+//   on success.
+uint8_t zjs_compile_script(const char* script, uint32_t length, char* output,
+                           uint32_t* size);
+
 #endif /* ZJS_SCRIPT_H_ */
@@ -496,6 +496,9 @@ static jerry_value_t zjs_sensor_create(const jerry_value_t function_obj,
 
     sensor_handle_t* handle = zjs_sensor_alloc_handle(channel);
     handle->id = zjs_add_c_callback(handle, zjs_sensor_onchange_c_callback);
+    zjs_set_callback_priority(handle->id, ZJS_PRIORITY_ISR);
+    // the reading is kept in the handle, one update per service is enough
+    zjs_set_callback_coalescing(handle->id, 0);
     handle->channel = channel;
     handle->sensor_obj = sensor_obj;
 
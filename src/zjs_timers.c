@@ -16,19 +16,168 @@
 // ZJS includes
 #include "zjs_util.h"
 #include "zjs_callbacks.h"
+#include "zjs_timers.h"
+
+// initial number of timer slots in the heap, doubled whenever it fills up
+#define TIMER_HEAP_INITIAL_SIZE 8
+// shortest interval of a repeating timer, in us
+#define TIMER_MIN_INTERVAL_US   1000
+// most missed ticks a TIMER_CATCH_UP timer fires for, older ones are skipped
+#define TIMER_MAX_CATCH_UP      16
+
+// What a repeating timer does about ticks that were missed because the main
+//   loop was busy when they were due
+enum timer_policy {
+    TIMER_SKIP,         // drop them and stay on the original schedule
+    TIMER_CATCH_UP,     // fire once for each of them, back to back
+    TIMER_COALESCE,     // fire once for all of them and restart the schedule
+};
 
 typedef struct zjs_timer {
-    zjs_port_timer_t timer;
+    uint64_t expires;       // uptime in us when the timer next expires
+    uint64_t interval;      // in us
+    uint64_t slack;         // us it may fire late to share a wakeup
+    jerry_value_t obj;      // JS timer object, its native handle points here
     jerry_value_t* argv;
     uint32_t argc;
-    uint32_t interval;
     zjs_callback_id callback_id;
+    int32_t index;          // position in timer_heap, -1 if not scheduled
     bool repeat;
-    bool completed;
-    struct zjs_timer *next;
+    uint8_t policy;         // enum timer_policy
+    uint32_t pass;          // last zjs_timers_process_events() pass it fired in
+    struct zjs_timer *next; // next fired timeout waiting to be serviced
 } zjs_timer_t;
 
-static zjs_timer_t *zjs_timers = NULL;
+static jerry_value_t zjs_timer_prototype;
+static struct zjs_timer_stats timer_stats;
+static uint32_t timer_pass = 0;
+
+// Pending timers are kept in a binary min-heap ordered by expiration, so only
+//   the top needs to be checked and any timer can be removed through its index
+static zjs_timer_t **timer_heap = NULL;
+static uint32_t heap_size = 0;
+static uint32_t heap_limit = 0;
+
+// timeouts that have fired but whose callbacks haven't been serviced yet
+static zjs_timer_t *fired_timers = NULL;
+
+// deadlines are absolute 64-bit us uptimes, so they don't wrap around
+#define TIMER_BEFORE(a, b) ((a) < (b))
+
+static void heap_place(zjs_timer_t *tm, uint32_t index)
+{
+    timer_heap[index] = tm;
+    tm->index = index;
+}
+
+static void heap_sift_up(uint32_t index)
+{
+    zjs_timer_t *tm = timer_heap[index];
+    while (index > 0) {
+        uint32_t parent = (index - 1) / 2;
+        if (!TIMER_BEFORE(tm->expires, timer_heap[parent]->expires)) {
+            break;
+        }
+        heap_place(timer_heap[parent], index);
+        index = parent;
+    }
+    heap_place(tm, index);
+}
+
+static void heap_sift_down(uint32_t index)
+{
+    zjs_timer_t *tm = timer_heap[index];
+    while (1) {
+        uint32_t child = 2 * index + 1;
+        if (child >= heap_size) {
+            break;
+        }
+        if (child + 1 < heap_size &&
+            TIMER_BEFORE(timer_heap[child + 1]->expires,
+                         timer_heap[child]->expires)) {
+            child++;
+        }
+        if (!TIMER_BEFORE(timer_heap[child]->expires, tm->expires)) {
+            break;
+        }
+        heap_place(timer_heap[child], index);
+        index = child;
+    }
+    heap_place(tm, index);
+}
+
+static bool heap_insert(zjs_timer_t *tm)
+{
+    if (heap_size == heap_limit) {
+        uint32_t limit = heap_limit ? heap_limit * 2 : TIMER_HEAP_INITIAL_SIZE;
+        zjs_timer_t **heap = zjs_malloc(sizeof(zjs_timer_t *) * limit);
+        if (!heap) {
+            return false;
+        }
+        if (timer_heap) {
+            memcpy(heap, timer_heap, sizeof(zjs_timer_t *) * heap_size);
+            zjs_free(timer_heap);
+        }
+        timer_heap = heap;
+        heap_limit = limit;
+    }
+    heap_place(tm, heap_size++);
+    heap_sift_up(tm->index);
+    return true;
+}
+
+static void heap_remove(zjs_timer_t *tm)
+{
+    uint32_t index = tm->index;
+    tm->index = -1;
+    if (--heap_size == index) {
+        return;
+    }
+    // fill the hole with the last timer and restore the heap order
+    heap_place(timer_heap[heap_size], index);
+    if (index > 0 && TIMER_BEFORE(timer_heap[index]->expires,
+                                  timer_heap[(index - 1) / 2]->expires)) {
+        heap_sift_up(index);
+    } else {
+        heap_sift_down(index);
+    }
+}
+
+static void free_timer(zjs_timer_t *tm)
+{
+    // requires: tm is not in the heap or the fired list, and its callback has
+    //             been removed
+    //  effects: releases the timer's arguments and detaches it from its JS
+    //             object, so clearing it later is harmless
+    for (int i = 0; i < tm->argc; ++i) {
+        jerry_release_value(tm->argv[i]);
+    }
+    zjs_free(tm->argv);
+    jerry_set_object_native_handle(tm->obj, 0, NULL);
+    jerry_release_value(tm->obj);
+    zjs_free(tm);
+}
+
+static void unlink_fired_timer(zjs_timer_t *tm)
+{
+    for (zjs_timer_t **ptm = &fired_timers; *ptm; ptm = &(*ptm)->next) {
+        if (*ptm == tm) {
+            *ptm = tm->next;
+            return;
+        }
+    }
+}
+
+static void post_timer(void* h, jerry_value_t* ret_val)
+{
+    // effects: a timeout is done once its callback has been called, which
+    //            also removes the callback since it was added as 'once'
+    zjs_timer_t *tm = (zjs_timer_t *)h;
+    if (!tm->repeat) {
+        unlink_fired_timer(tm);
+        free_timer(tm);
+    }
+}
 
 jerry_value_t* pre_timer(void* h, uint32_t* argc)
 {
@@ -38,15 +187,15 @@ jerry_value_t* pre_timer(void* h, uint32_t* argc)
 }
 
 /*
- * Allocate a new timer and add it to list
+ * Allocate a new timer and schedule it
  *
- * interval     Time until expiration (in ticks)
+ * interval     Time until expiration (in us)
  * callback     JS callback function
  * repeat       Timeout or interval timer
  * argv         Array of arguments to pass to timer callback function
  * argc         Number of arguments in argv
  */
-static zjs_timer_t* add_timer(uint32_t interval,
+static zjs_timer_t* add_timer(uint64_t interval,
                               jerry_value_t callback,
                               jerry_value_t this,
                               bool repeat,
@@ -62,12 +211,24 @@ static zjs_timer_t* add_timer(uint32_t interval,
         return NULL;
     }
 
-    zjs_port_timer_init(&tm->timer);
+    if (repeat && interval < TIMER_MIN_INTERVAL_US) {
+        // a zero interval would never stop being due
+        interval = TIMER_MIN_INTERVAL_US;
+    }
     tm->interval = interval;
     tm->repeat = repeat;
-    tm->completed = false;
-    tm->next = zjs_timers;
-    tm->callback_id = zjs_add_callback(callback, this, tm, NULL);
+    tm->policy = TIMER_SKIP;
+    tm->slack = 0;
+    tm->pass = 0;
+    tm->index = -1;
+    tm->next = NULL;
+    tm->obj = jerry_create_object();
+    if (repeat) {
+        tm->callback_id = zjs_add_callback(callback, this, tm, post_timer);
+    } else {
+        tm->callback_id = zjs_add_callback_once(callback, this, tm, post_timer);
+    }
+    zjs_set_callback_priority(tm->callback_id, ZJS_PRIORITY_TIMER);
     tm->argc = argc;
     if (tm->argc) {
         tm->argv = zjs_malloc(sizeof(jerry_value_t) * argc);
@@ -78,54 +239,52 @@ static zjs_timer_t* add_timer(uint32_t interval,
         tm->argv = NULL;
     }
 
-    zjs_timers = tm;
+    tm->expires = zjs_port_timer_get_uptime_us() + interval;
+    if (tm->callback_id == -1 || !heap_insert(tm)) {
+        zjs_remove_callback(tm->callback_id);
+        free_timer(tm);
+        return NULL;
+    }
+
+    jerry_set_prototype(tm->obj, zjs_timer_prototype);
+    jerry_set_object_native_handle(tm->obj, (uintptr_t)tm, NULL);
 
-    DBG_PRINT("adding timer. id=%d, interval=%lu, repeat=%u, argv=%p, argc=%lu\n",
-            tm->callback_id, interval, repeat, argv, argc);
-    zjs_port_timer_start(&tm->timer, interval);
+    DBG_PRINT("adding timer. id=%d, interval=%luus, repeat=%u, argv=%p, argc=%lu\n",
+            tm->callback_id, (uint32_t)interval, repeat, argv, argc);
+    // the main loop may be blocked on a later deadline, make it recompute
+    zjs_loop_unblock();
     return tm;
 }
 
 /*
- * Remove a timer from the list
+ * Cancel a timer, whether it is scheduled or has fired but not been serviced
  *
- * id           ID of timer, returned from add_timer
- *
- * returns      True if the timer was removed successfully (if the ID is valid)
+ * tm           Timer returned from add_timer
  */
-static bool delete_timer(int32_t id)
+static void delete_timer(zjs_timer_t *tm)
 {
-    for (zjs_timer_t **ptm = &zjs_timers; *ptm; ptm = &(*ptm)->next) {
-        zjs_timer_t *tm = *ptm;
-        if (id == tm->callback_id) {
-            DBG_PRINT("removing timer. id=%d\n", tm->callback_id);
-            zjs_port_timer_stop(&tm->timer);
-            *ptm = tm->next;
-            for (int i = 0; i < tm->argc; ++i) {
-                jerry_release_value(tm->argv[i]);
-            }
-            zjs_remove_callback(tm->callback_id);
-            zjs_free(tm->argv);
-            zjs_free(tm);
-            return true;
-        }
+    DBG_PRINT("removing timer. id=%d\n", tm->callback_id);
+    if (tm->index >= 0) {
+        heap_remove(tm);
+    } else {
+        unlink_fired_timer(tm);
     }
-    return false;
+    zjs_remove_callback(tm->callback_id);
+    free_timer(tm);
 }
 
 void zjs_timers_cleanup()
 {
-    while (zjs_timers) {
-        zjs_timer_t *tm = zjs_timers;
-        for (int i = 0; i < tm->argc; ++i) {
-            jerry_release_value(tm->argv[i]);
-        }
-        zjs_port_timer_stop(&tm->timer);
-        zjs_remove_callback(tm->callback_id);
-        zjs_free(tm->argv);
-        zjs_timers = tm->next;
-        zjs_free(tm);
+    while (heap_size) {
+        delete_timer(timer_heap[heap_size - 1]);
     }
+    while (fired_timers) {
+        delete_timer(fired_timers);
+    }
+    zjs_free(timer_heap);
+    timer_heap = NULL;
+    heap_limit = 0;
+    jerry_release_value(zjs_timer_prototype);
 }
 
 static jerry_value_t add_timer_helper(const jerry_value_t function_obj,
@@ -138,16 +297,16 @@ static jerry_value_t add_timer_helper(const jerry_value_t function_obj,
             !jerry_value_is_number(argv[1]))
         return zjs_error("native_set_interval_handler: invalid arguments");
 
-    uint32_t interval = (uint32_t)(jerry_get_number_value(argv[1]));
+    // the delay is in ms but may have a fraction, keep us of it
+    double delay = jerry_get_number_value(argv[1]);
+    uint64_t interval = delay > 0 ? (uint64_t)(delay * 1000) : 0;
     jerry_value_t callback = argv[0];
-    jerry_value_t timer_obj = jerry_create_object();
 
     zjs_timer_t* handle = add_timer(interval, callback, this, repeat, argv, argc - 2);
-    if (handle->callback_id == -1)
+    if (!handle)
         return zjs_error("native_set_interval_handler: timer alloc failed");
-    jerry_set_object_native_handle(timer_obj, (uintptr_t)handle, NULL);
 
-    return timer_obj;
+    return jerry_acquire_value(handle->obj);
 }
 
 // native setInterval handler
@@ -176,6 +335,38 @@ static jerry_value_t native_set_timeout_handler(const jerry_value_t function_obj
                             false);
 }
 
+// native setImmediate handler
+static jerry_value_t native_set_immediate_handler(const jerry_value_t function_obj,
+                                                  const jerry_value_t this,
+                                                  const jerry_value_t argv[],
+                                                  const jerry_length_t argc)
+{
+    if (argc < 1 || !jerry_value_is_function(argv[0])) {
+        return zjs_error("native_set_immediate_handler: invalid arguments");
+    }
+
+    uint32_t id = zjs_queue_js_immediate(argv[0], this, argv + 1, argc - 1);
+    if (!id) {
+        return zjs_error("native_set_immediate_handler: out of memory");
+    }
+    return jerry_create_number(id);
+}
+
+// native clearImmediate handler
+static jerry_value_t native_clear_immediate_handler(const jerry_value_t function_obj,
+                                                    const jerry_value_t this,
+                                                    const jerry_value_t argv[],
+                                                    const jerry_length_t argc)
+{
+    if (argc < 1 || !jerry_value_is_number(argv[0])) {
+        return zjs_error("native_clear_immediate_handler: invalid arguments");
+    }
+
+    // clearing one that already ran is allowed and does nothing
+    zjs_cancel_immediate((uint32_t)jerry_get_number_value(argv[0]));
+    return ZJS_UNDEFINED;
+}
+
 // native clearInterval handler
 static jerry_value_t native_clear_interval_handler(const jerry_value_t function_obj,
                                                    const jerry_value_t this,
@@ -194,43 +385,216 @@ static jerry_value_t native_clear_interval_handler(const jerry_value_t function_
         return zjs_error("native_clear_interval_handler(): native handle not found");
     }
 
-    if (!delete_timer(handle->callback_id))
-        return zjs_error("native_clear_interval_handler: timer not found");
+    // the handle is cleared once a timeout has completed, clearing it again
+    //   is allowed and does nothing
+    if (handle) {
+        delete_timer(handle);
+    }
 
     return jerry_create_undefined();
 }
 
-void zjs_timers_process_events()
+// native timer.setMissedTickPolicy handler
+static jerry_value_t timer_set_missed_tick_policy(const jerry_value_t function_obj,
+                                                  const jerry_value_t this,
+                                                  const jerry_value_t argv[],
+                                                  const jerry_length_t argc)
 {
-#ifdef DEBUG_BUILD
-#ifndef ZJS_LINUX_BUILD
-    extern void update_print_timer(void);
-    update_print_timer();
-#endif
-#endif
-    for (zjs_timer_t *tm = zjs_timers; tm; tm = tm->next) {
-        if (tm->completed) {
-            delete_timer(tm->callback_id);
+    // requires: this is a timer from setInterval or setTimeout, arg is
+    //             "skip", "catchup" or "coalesce"
+    //  effects: sets what the timer does about ticks missed while the main
+    //             loop was busy
+    zjs_timer_t *tm;
+    if (!jerry_get_object_native_handle(this, (uintptr_t *)&tm)) {
+        return zjs_error("timer_set_missed_tick_policy: not a timer");
+    }
+
+    char policy[10];
+    if (argc < 1 || !jerry_value_is_string(argv[0]) ||
+        jerry_get_string_size(argv[0]) >= sizeof(policy)) {
+        return zjs_error("timer_set_missed_tick_policy: invalid arguments");
+    }
+    int len = jerry_string_to_char_buffer(argv[0], (jerry_char_t *)policy,
+                                          sizeof(policy) - 1);
+    policy[len] = '\0';
+
+    uint8_t value;
+    if (!strcmp(policy, "skip")) {
+        value = TIMER_SKIP;
+    } else if (!strcmp(policy, "catchup")) {
+        value = TIMER_CATCH_UP;
+    } else if (!strcmp(policy, "coalesce")) {
+        value = TIMER_COALESCE;
+    } else {
+        return zjs_error("timer_set_missed_tick_policy: unknown policy");
+    }
+
+    // the handle is cleared once a timeout has completed
+    if (tm) {
+        tm->policy = value;
+    }
+    return ZJS_UNDEFINED;
+}
+
+// native timer.setSlack handler
+static jerry_value_t timer_set_slack(const jerry_value_t function_obj,
+                                     const jerry_value_t this,
+                                     const jerry_value_t argv[],
+                                     const jerry_length_t argc)
+{
+    // requires: this is a timer from setInterval or setTimeout, arg is the
+    //             slack in ms
+    //  effects: lets the timer fire up to that much late, so it can share a
+    //             wakeup with other timers
+    zjs_timer_t *tm;
+    if (!jerry_get_object_native_handle(this, (uintptr_t *)&tm)) {
+        return zjs_error("timer_set_slack: not a timer");
+    }
+    if (argc < 1 || !jerry_value_is_number(argv[0])) {
+        return zjs_error("timer_set_slack: invalid arguments");
+    }
+
+    double slack = jerry_get_number_value(argv[0]);
+    if (tm) {
+        tm->slack = slack > 0 ? (uint64_t)(slack * 1000) : 0;
+    }
+    return ZJS_UNDEFINED;
+}
+
+static uint64_t latest_wakeup(uint32_t index, uint64_t wakeup)
+{
+    // effects: returns the latest time the loop can wake up and still fire
+    //            the timers in the heap at index and below within their
+    //            slack, or wakeup if that is earlier
+    if (index >= heap_size ||
+        !TIMER_BEFORE(timer_heap[index]->expires, wakeup)) {
+        // no timer below here expires any earlier
+        return wakeup;
+    }
+    zjs_timer_t *tm = timer_heap[index];
+    if (TIMER_BEFORE(tm->expires + tm->slack, wakeup)) {
+        wakeup = tm->expires + tm->slack;
+    }
+    wakeup = latest_wakeup(2 * index + 1, wakeup);
+    return latest_wakeup(2 * index + 2, wakeup);
+}
+
+void zjs_timers_get_stats(struct zjs_timer_stats *stats)
+{
+    *stats = timer_stats;
+}
+
+void zjs_timers_reset_stats(void)
+{
+    memset(&timer_stats, 0, sizeof(timer_stats));
+}
+
+static void reschedule_timer(zjs_timer_t *tm, uint64_t now)
+{
+    // requires: tm is a repeating timer that just fired at now
+    //  effects: moves its deadline on by its interval from the one that
+    //             fired, rather than from now, so it doesn't drift; if that is
+    //             due already, handles the missed ticks by its policy
+    tm->expires += tm->interval;
+    if (TIMER_BEFORE(now, tm->expires)) {
+        return;
+    }
+
+    uint64_t missed = (now - tm->expires) / tm->interval + 1;
+    if (tm->policy == TIMER_CATCH_UP) {
+        if (missed > TIMER_MAX_CATCH_UP) {
+            // too far behind, only fire for the latest ticks
+            tm->expires += (missed - TIMER_MAX_CATCH_UP) * tm->interval;
         }
-        else if (zjs_port_timer_test(&tm->timer) > 0) {
-            // timer has expired, signal the callback
-            DBG_PRINT("signaling timer. id=%d, argv=%p, argc=%lu\n",
-                    tm->callback_id, tm->argv, tm->argc);
-            zjs_signal_callback(tm->callback_id, tm->argv, tm->argc * sizeof(jerry_value_t));
-
-            // reschedule or remove timer
-            if (tm->repeat) {
-                zjs_port_timer_start(&tm->timer, tm->interval);
-            } else {
-                // delete this timer next time around
-                tm->completed = true;
-            }
+        // the rest fire in this pass
+    } else if (tm->policy == TIMER_COALESCE) {
+        tm->expires = now + tm->interval;
+    } else {
+        tm->expires += missed * tm->interval;
+    }
+}
+
+int32_t zjs_timers_process_events()
+{
+    // read the clock once, every timer due by now fires in this pass, which
+    //   batches timers whose slack windows overlap into one wakeup
+    uint64_t now = zjs_port_timer_get_uptime_us();
+    uint64_t last_ms = 0;
+    uint32_t fired = 0;
+    bool deferred = false;
+    timer_pass++;
+    while (heap_size && !TIMER_BEFORE(now, timer_heap[0]->expires)) {
+        zjs_timer_t *tm = timer_heap[0];
+        // timer has expired, signal the callback
+        DBG_PRINT("signaling timer. id=%d, argv=%p, argc=%lu\n",
+                tm->callback_id, tm->argv, tm->argc);
+        if (zjs_signal_callback(tm->callback_id, tm->argv,
+                                tm->argc * sizeof(jerry_value_t)) != 0) {
+            // the callback queue is full, leave this timer and the rest due
+            //   in the heap and try again once the queue has drained
+            DBG_PRINT("callback queue full, timer %d deferred\n",
+                      tm->callback_id);
+            deferred = true;
+            break;
+        }
+
+        // a timer put off by its slack to a later ms than the timers before
+        //   it would have needed its own wakeup otherwise
+        uint64_t ms = tm->expires / 1000;
+        if (!fired) {
+            last_ms = ms;
+        } else if (tm->slack && tm->pass != timer_pass && ms > last_ms) {
+            timer_stats.saved++;
+            last_ms = ms;
+        }
+        tm->pass = timer_pass;
+        fired++;
+
+        // reschedule or remove timer
+        if (tm->repeat) {
+            reschedule_timer(tm, now);
+            heap_sift_down(0);
+        } else {
+            // the timer is freed after its callback is serviced
+            heap_remove(tm);
+            tm->next = fired_timers;
+            fired_timers = tm;
         }
     }
+
+    if (fired) {
+        timer_stats.wakeups++;
+        timer_stats.fired += fired;
+    }
+
+    if (!heap_size) {
+        return ZJS_TICKS_FOREVER;
+    }
+    if (deferred) {
+        // don't wait, the due timers are retried on the next pass
+        return 0;
+    }
+    // wait for the timer that can be put off the least, the others whose
+    //   windows have opened by then fire along with it
+    uint64_t wakeup = latest_wakeup(0, UINT64_MAX);
+    if (TIMER_BEFORE(now, wakeup)) {
+        // round up, waking before the deadline would just mean waiting again
+        uint64_t wait = (wakeup - now + 999) / 1000;
+        return wait < INT32_MAX ? (int32_t)wait : INT32_MAX;
+    }
+    return 0;
 }
 
 void zjs_timers_init()
 {
+    zjs_native_func_t array[] = {
+        { timer_set_missed_tick_policy, "setMissedTickPolicy" },
+        { timer_set_slack, "setSlack" },
+        { NULL, NULL }
+    };
+    zjs_timer_prototype = jerry_create_object();
+    zjs_obj_add_functions(zjs_timer_prototype, array);
+
     jerry_value_t global_obj = jerry_get_global_object();
 
     // create the C handler for setInterval JS call
@@ -244,5 +608,9 @@ void zjs_timers_init()
     // create the C handler for clearTimeout JS call (same as clearInterval)
     zjs_obj_add_function(global_obj, native_clear_interval_handler,
                          "clearTimeout");
+    zjs_obj_add_function(global_obj, native_set_immediate_handler,
+                         "setImmediate");
+    zjs_obj_add_function(global_obj, native_clear_immediate_handler,
+                         "clearImmediate");
     jerry_release_value(global_obj);
 }
@@ -3,9 +3,21 @@
 #ifndef __zjs_timers_h__
 #define __zjs_timers_h__
 
-void zjs_timers_process_events();
+struct zjs_timer_stats {
+    uint32_t wakeups;   // passes that fired timers
+    uint32_t fired;     // timer expirations
+    uint32_t saved;     // wakeups avoided by firing timers within their slack
+};
+
+// Signals any expired timers, returns ms until the next timer expires,
+//   ZJS_TICKS_FOREVER if there are none, or 0 if the callback queue was too
+//   full to signal them all
+int32_t zjs_timers_process_events();
 void zjs_timers_init();
 // Stops and frees all timers
 void zjs_timers_cleanup();
+// Get counts of timer wakeups since init or the last reset
+void zjs_timers_get_stats(struct zjs_timer_stats *stats);
+void zjs_timers_reset_stats(void);
 
 #endif  // __zjs_timers_h__
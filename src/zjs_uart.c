@@ -19,6 +19,7 @@
 #include "zjs_callbacks.h"
 #include "zjs_event.h"
 #include "zjs_buffer.h"
+#include "zjs_modules.h"
 
 static jerry_value_t zjs_uart_prototype;
 
@@ -33,8 +34,6 @@ typedef struct {
 typedef struct {
     jerry_value_t uart_obj;
     jerry_value_t buf_obj;
-    char* buf;
-    uint32_t size;
     uint32_t min;
     uint32_t max;
 } uart_handle;
@@ -61,6 +60,11 @@ static zjs_callback_id read_id = -1;
 static volatile bool tx = false;
 // RX interrupt handled
 static volatile bool rx = false;
+// RX interrupts are disabled until rx_payload can be signaled, or a payload
+//   can be allocated for more data
+static volatile bool rx_paused = false;
+// data read from the UART that didn't fit in the callback queue
+static void* volatile rx_payload = NULL;
 
 static jerry_value_t make_uart_error(const char* name, const char* msg)
 {
@@ -90,9 +94,6 @@ static uart_handle* new_uart_handle(void)
 
     h->min = 1;
     h->max = UART_BUFFER_INITIAL_SIZE;
-    h->buf = zjs_malloc(UART_BUFFER_INITIAL_SIZE);
-    h->size = 0;
-    memset(h->buf, 0, UART_BUFFER_INITIAL_SIZE);
 
     return h;
 }
@@ -104,20 +105,19 @@ static void post_event(void* h)
 
 static void uart_c_callback(void* h, void* args)
 {
+    // args is a payload from uart_irq_handler()
+    uint32_t size = zjs_payload_size(args);
     if (!handle) {
         DBG_PRINT("UART handle not found\n");
-        return;
-    }
-    if (handle->size >= handle->min) {
-        handle->buf_obj = zjs_buffer_create(handle->size);
+    } else if (size >= handle->min) {
+        handle->buf_obj = zjs_buffer_create(size);
         zjs_buffer_t* buffer = zjs_buffer_find(handle->buf_obj);
 
-        memcpy(buffer->buffer, args, handle->size);
+        memcpy(buffer->buffer, args, size);
 
         zjs_trigger_event_now(handle->uart_obj, "read", &handle->buf_obj, 1, post_event, NULL);
-
-        handle->size = 0;
     }
+    zjs_release_payload(args);
 }
 
 static void uart_irq_handler(struct device *dev)
@@ -132,13 +132,41 @@ static void uart_irq_handler(struct device *dev)
         tx = true;
     }
 
-    if (uart_irq_rx_ready(dev)) {
-        uint32_t len = uart_fifo_read(dev, handle->buf, handle->max);
+    if (!rx_paused && uart_irq_rx_ready(dev)) {
         rx = true;
-        handle->buf[len] = '\0';
-        handle->size = len;
-        zjs_signal_callback(read_id, handle->buf, len);
+        // read straight into a payload that is handed to uart_c_callback()
+        void* payload = zjs_alloc_payload(handle->max);
+        if (payload) {
+            uint32_t len = uart_fifo_read(dev, payload, handle->max);
+            if (zjs_signal_callback_payload(read_id, payload, len) != 0) {
+                rx_payload = payload;
+            }
+        }
+        if (!payload || rx_payload) {
+            // the callback queue or payload pool is full, leave further data
+            //   in the UART until uart_poll_routine() gets through
+            rx_paused = true;
+            uart_irq_rx_disable(dev);
+        }
+    }
+}
+
+static int32_t uart_poll_routine(void* h)
+{
+    if (!rx_paused) {
+        return ZJS_TICKS_FOREVER;
+    }
+    if (rx_payload) {
+        if (zjs_signal_callback_payload(read_id, rx_payload,
+                                        zjs_payload_size(rx_payload)) != 0) {
+            // still full, try again soon
+            return 1;
+        }
+        rx_payload = NULL;
     }
+    rx_paused = false;
+    uart_irq_rx_enable(uart_dev);
+    return ZJS_TICKS_FOREVER;
 }
 
 static void write_data(struct device *dev, const char *buf, int len)
@@ -191,20 +219,10 @@ static jerry_value_t uart_set_read_range(const jerry_value_t function_obj,
     uint32_t min = jerry_get_number_value(argv[0]);
     uint32_t max = jerry_get_number_value(argv[1]);
 
-    if (handle->buf) {
-        void* old = handle->buf;
-        handle->buf = zjs_malloc(max);
-        memcpy(handle->buf, old, handle->size);
-        handle->buf[handle->size] = '\0';
-        zjs_free(old);
-        //if (handle->size >= min) {
-        //    jerry_value_t data = jerry_create_string((const jerry_char_t *)handle->buf);
-        //    zjs_trigger_event(handle->uart_obj, "read", &data, 1, NULL, NULL);
-        //}
-    } else {
-        handle->buf = zjs_malloc(max);
-        memset(handle->buf, 0, max);
-        handle->size = 0;
+    if (max > ZJS_PAYLOAD_SIZE) {
+        // reads go into payloads, so they can't be bigger than one
+        DBG_PRINT("max read size limited to %u\n", ZJS_PAYLOAD_SIZE);
+        max = ZJS_PAYLOAD_SIZE;
     }
     handle->min = min;
     handle->max = max;
@@ -337,6 +355,7 @@ static jerry_value_t uart_init(const jerry_value_t function_obj,
     zjs_fulfill_promise(promise, &handle->uart_obj, 1);
 
     read_id = zjs_add_c_callback(handle, uart_c_callback);
+    zjs_set_callback_priority(read_id, ZJS_PRIORITY_ISR);
 
     return promise;
 }
@@ -351,6 +370,10 @@ jerry_value_t zjs_uart_init()
     zjs_uart_prototype = jerry_create_object();
     zjs_obj_add_functions(zjs_uart_prototype, array);
 
+    // once for the module, not for each init(), since there are few slots;
+    //   it does nothing until reads are paused
+    zjs_register_service_routine(NULL, uart_poll_routine);
+
     jerry_value_t uart_obj = jerry_create_object();
     zjs_obj_add_function(uart_obj, uart_init, "init");
     return uart_obj;
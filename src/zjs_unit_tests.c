@@ -2,8 +2,18 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 
 #include "zjs_util.h"
+#include "zjs_callbacks.h"
+#include "zjs_linux_port.h"
+#include "zjs_promise.h"
+#include "zjs_script.h"
+#ifdef BUILD_MODULE_BUFFER
+#include "zjs_buffer.h"
+#endif
 
 static int passed = 0;
 static int total = 0;
@@ -87,11 +97,942 @@ static void test_compress_32()
     zjs_assert(check_compress_close(0xffffffff), "compression of 0xffffffff");
 }
 
+// Test callback ID allocation
+
+static int c_callback_calls = 0;
+
+static void count_c_callback(void* handle, void* args)
+{
+    c_callback_calls++;
+}
+
+static void test_callback_ids()
+{
+    struct zjs_callback_stats before, after;
+    zjs_get_callback_stats(&before);
+
+    zjs_callback_id ids[100];
+    int i, unique = 1;
+    for (i = 0; i < 100; ++i) {
+        ids[i] = zjs_add_c_callback(NULL, count_c_callback);
+        if (ids[i] == -1) {
+            unique = 0;
+        }
+        for (int j = 0; j < i; ++j) {
+            if (ids[i] == ids[j]) {
+                unique = 0;
+            }
+        }
+    }
+    zjs_assert(unique, "callback ids: 100 unique ids");
+
+    zjs_callback_id stale = ids[42];
+    zjs_remove_callback(stale);
+    ids[42] = zjs_add_c_callback(NULL, count_c_callback);
+    zjs_assert(ids[42] != -1 && ids[42] != stale,
+               "callback ids: reused slot gets a new id");
+
+    c_callback_calls = 0;
+    zjs_call_callback(stale, NULL, 0);
+    zjs_assert(c_callback_calls == 0, "callback ids: stale id is ignored");
+    zjs_call_callback(ids[42], NULL, 0);
+    zjs_assert(c_callback_calls == 1, "callback ids: new id is called");
+
+    zjs_get_callback_stats(&after);
+    zjs_assert(after.live == before.live + 100, "callback ids: live count");
+    zjs_assert(after.peak >= before.live + 100, "callback ids: peak count");
+
+    for (i = 0; i < 100; ++i) {
+        zjs_remove_callback(ids[i]);
+    }
+    zjs_get_callback_stats(&after);
+    zjs_assert(after.live == before.live &&
+               after.removed == before.removed + 101,
+               "callback ids: all removed");
+}
+
+// Test signal coalescing
+
+static uint32_t last_c_callback_arg = 0;
+
+static void save_c_callback(void* handle, void* args)
+{
+    c_callback_calls++;
+    last_c_callback_arg = *(uint32_t*)args;
+}
+
+static void test_callback_coalescing()
+{
+    struct zjs_callback_stats before, after;
+    zjs_callback_id plain = zjs_add_c_callback(NULL, save_c_callback);
+    zjs_callback_id latest = zjs_add_c_callback(NULL, save_c_callback);
+    zjs_assert(zjs_set_callback_coalescing(latest, sizeof(uint32_t)),
+               "coalescing: enabled");
+
+    zjs_get_callback_stats(&before);
+    c_callback_calls = 0;
+    for (uint32_t i = 1; i <= 5; ++i) {
+        zjs_signal_callback(plain, &i, sizeof(i));
+    }
+    zjs_service_callbacks();
+    zjs_assert(c_callback_calls == 5, "coalescing: off by default");
+
+    c_callback_calls = 0;
+    for (uint32_t i = 1; i <= 5; ++i) {
+        zjs_signal_callback(latest, &i, sizeof(i));
+    }
+    zjs_service_callbacks();
+    zjs_get_callback_stats(&after);
+    zjs_assert(c_callback_calls == 1 && last_c_callback_arg == 5,
+               "coalescing: called once with latest args");
+    zjs_assert(after.coalesced == before.coalesced + 4,
+               "coalescing: coalesced signals counted");
+
+    c_callback_calls = 0;
+    zjs_signal_callback(latest, &c_callback_calls, sizeof(uint32_t));
+    zjs_remove_callback(latest);
+    zjs_service_callbacks();
+    zjs_assert(c_callback_calls == 0, "coalescing: removed while pending");
+    zjs_remove_callback(plain);
+}
+
+// Test callback priorities and the service time budget
+
+static int call_order[4];
+
+static void order_c_callback(void* handle, void* args)
+{
+    call_order[c_callback_calls++] = (intptr_t)handle;
+}
+
+static void slow_c_callback(void* handle, void* args)
+{
+    c_callback_calls++;
+    usleep(2000);
+}
+
+static void test_callback_priority()
+{
+    zjs_callback_id timer = zjs_add_c_callback((void*)ZJS_PRIORITY_TIMER,
+                                               order_c_callback);
+    zjs_callback_id io = zjs_add_c_callback((void*)ZJS_PRIORITY_IO,
+                                            order_c_callback);
+    zjs_callback_id isr = zjs_add_c_callback((void*)ZJS_PRIORITY_ISR,
+                                             order_c_callback);
+    zjs_set_callback_priority(timer, ZJS_PRIORITY_TIMER);
+    zjs_set_callback_priority(isr, ZJS_PRIORITY_ISR);
+
+    c_callback_calls = 0;
+    zjs_signal_callback(timer, NULL, 0);
+    zjs_signal_callback(io, NULL, 0);
+    zjs_signal_callback(isr, NULL, 0);
+    zjs_service_callbacks();
+    zjs_assert(c_callback_calls == 3 && call_order[0] == ZJS_PRIORITY_ISR &&
+               call_order[1] == ZJS_PRIORITY_IO &&
+               call_order[2] == ZJS_PRIORITY_TIMER,
+               "callback priority: serviced by priority class");
+
+    zjs_callback_id slow = zjs_add_c_callback(NULL, slow_c_callback);
+    zjs_set_callback_priority(slow, ZJS_PRIORITY_BACKGROUND);
+    c_callback_calls = 0;
+    for (int i = 0; i < 10; ++i) {
+        zjs_signal_callback(slow, NULL, 0);
+    }
+    zjs_service_callbacks();
+    int first_pass = c_callback_calls;
+    zjs_assert(first_pass > 0 && first_pass < 10,
+               "callback priority: service stops at time budget");
+    for (int i = 0; i < 10 && c_callback_calls < 10; ++i) {
+        zjs_service_callbacks();
+    }
+    zjs_assert(c_callback_calls == 10,
+               "callback priority: rest serviced on later passes");
+
+    zjs_remove_callback(timer);
+    zjs_remove_callback(io);
+    zjs_remove_callback(isr);
+    zjs_remove_callback(slow);
+}
+
+// Test that a class that can't keep up doesn't hold up the others
+
+static int busy_calls = 0;
+
+static void busy_c_callback(void* handle, void* args)
+{
+    busy_calls++;
+    usleep(1000);
+}
+
+static int fill_ring(zjs_callback_id id)
+{
+    // effects: signals id until one signal has spilled over from the ring
+    //            buffer, or none fit, returns the number of signals queued
+    struct zjs_callback_stats before, after;
+    zjs_get_callback_stats(&before);
+    int count = 0;
+    do {
+        if (zjs_signal_callback(id, NULL, 0)) {
+            break;
+        }
+        count++;
+        zjs_get_callback_stats(&after);
+    } while (after.spilled == before.spilled);
+    return count;
+}
+
+static void test_callback_class_full()
+{
+    zjs_callback_id busy = zjs_add_c_callback(NULL, busy_c_callback);
+    zjs_callback_id isr = zjs_add_c_callback(NULL, count_c_callback);
+    zjs_set_callback_priority(busy, ZJS_PRIORITY_BACKGROUND);
+    zjs_set_callback_priority(isr, ZJS_PRIORITY_ISR);
+
+    // the background ring takes the first ring buffer full, but only a few
+    //   of them are called within the time budget
+    busy_calls = 0;
+    int signaled = fill_ring(busy);
+    zjs_service_callbacks();
+    zjs_assert(busy_calls > 0 && busy_calls < signaled,
+               "class full: background class over budget");
+
+    // keep it coming faster than it is called until its backlog is more
+    //   than its class ring holds, then queue the ISR signal behind it
+    for (int i = 0; i < 3; ++i) {
+        signaled += fill_ring(busy);
+        zjs_service_callbacks();
+    }
+    signaled += fill_ring(busy);
+    c_callback_calls = 0;
+    zjs_signal_callback(isr, NULL, 0);
+    zjs_service_callbacks();
+    zjs_assert(c_callback_calls == 1,
+               "class full: ISR signal behind a full class is called");
+
+    for (int i = 0; i < 1000 && busy_calls < signaled; ++i) {
+        zjs_service_callbacks();
+    }
+    zjs_assert(busy_calls == signaled,
+               "class full: background signals all called later");
+    zjs_remove_callback(busy);
+    zjs_remove_callback(isr);
+}
+
+// Test signals beyond what the ring buffer holds
+
+static uint32_t in_order_calls = 0;
+static bool in_order = true;
+
+static void in_order_c_callback(void* handle, void* args)
+{
+    if (*(uint32_t*)args != in_order_calls) {
+        in_order = false;
+    }
+    in_order_calls++;
+}
+
+static void test_callback_overflow()
+{
+    struct zjs_callback_stats before, after;
+    zjs_callback_id id = zjs_add_c_callback(NULL, in_order_c_callback);
+    uint32_t queued = 0, dropped = 0;
+
+    zjs_get_callback_stats(&before);
+    for (uint32_t i = 0; i < 1000; ++i) {
+        // number the queued ones so the order can be checked
+        if (zjs_signal_callback(id, &queued, sizeof(queued)) == 0) {
+            queued++;
+        } else {
+            dropped++;
+        }
+    }
+    zjs_get_callback_stats(&after);
+    zjs_assert(after.spilled > before.spilled,
+               "callback overflow: spilled when ring buffer full");
+    zjs_assert(dropped > 0 && after.dropped == before.dropped + dropped,
+               "callback overflow: drops reported and counted");
+
+    in_order_calls = 0;
+    for (int i = 0; i < 100 && in_order_calls < queued; ++i) {
+        zjs_service_callbacks();
+    }
+    zjs_assert(in_order_calls == queued && in_order,
+               "callback overflow: queued signals called in order");
+
+    zjs_assert(zjs_signal_callback(id, &queued, sizeof(queued)) == 0,
+               "callback overflow: queue usable after draining");
+    zjs_service_callbacks();
+    zjs_remove_callback(id);
+}
+
+// Test payloads passed by reference
+
+static void* payload_seen = NULL;
+static uint32_t payload_seen_size = 0;
+
+static void payload_c_callback(void* handle, void* args)
+{
+    payload_seen = args;
+    payload_seen_size = zjs_payload_size(args);
+    zjs_release_payload(args);
+}
+
+static void test_callback_payload()
+{
+    struct zjs_callback_stats before, after;
+    zjs_callback_id id = zjs_add_c_callback(NULL, payload_c_callback);
+
+    zjs_get_callback_stats(&before);
+    zjs_assert(zjs_alloc_payload(ZJS_PAYLOAD_SIZE + 1) == NULL,
+               "callback payload: too big to allocate");
+
+    // bigger than fits in the ring buffer as args
+    uint8_t* payload = zjs_alloc_payload(ZJS_PAYLOAD_SIZE);
+    for (int i = 0; i < ZJS_PAYLOAD_SIZE; ++i) {
+        payload[i] = i;
+    }
+    zjs_assert(zjs_signal_callback_payload(id, payload, ZJS_PAYLOAD_SIZE) == 0,
+               "callback payload: signaled");
+    payload_seen = NULL;
+    zjs_service_callbacks();
+    zjs_assert(payload_seen == payload &&
+               payload_seen_size == ZJS_PAYLOAD_SIZE &&
+               payload[ZJS_PAYLOAD_SIZE - 1] == (uint8_t)(ZJS_PAYLOAD_SIZE - 1),
+               "callback payload: callback gets the same buffer");
+
+    // a removed callback's payload is released for it
+    payload = zjs_alloc_payload(4);
+    zjs_signal_callback_payload(id, payload, 4);
+    zjs_remove_callback(id);
+    zjs_service_callbacks();
+
+    void* held[ZJS_PAYLOAD_COUNT];
+    int count = 0;
+    while (count < ZJS_PAYLOAD_COUNT && (held[count] = zjs_alloc_payload(1))) {
+        count++;
+    }
+    zjs_assert(count == ZJS_PAYLOAD_COUNT && zjs_alloc_payload(1) == NULL,
+               "callback payload: pool is bounded");
+    while (count) {
+        zjs_release_payload(held[--count]);
+    }
+
+    zjs_get_callback_stats(&after);
+    zjs_assert(after.payloads == before.payloads,
+               "callback payload: all payloads released");
+}
+
+// Test the immediate queue
+
+static char imm_order[16];
+static int imm_calls = 0;
+
+static void record_immediate(void* handle, const jerry_value_t argv[],
+                             uint32_t argc)
+{
+    imm_order[imm_calls++] = (char)(uintptr_t)handle;
+    if ((uintptr_t)handle == 'A') {
+        zjs_queue_immediate(record_immediate, (void*)'C', NULL, 0);
+    }
+}
+
+static void sum_immediate(void* handle, const jerry_value_t argv[],
+                          uint32_t argc)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < argc; ++i) {
+        sum += argv[i];
+    }
+    *(uint32_t*)handle = sum;
+}
+
+static void queue_c_callback(void* handle, void* args)
+{
+    imm_order[imm_calls++] = 'X';
+    zjs_queue_immediate(record_immediate, (void*)'E', NULL, 0);
+}
+
+static void record_c_callback(void* handle, void* args)
+{
+    imm_order[imm_calls++] = 'Y';
+}
+
+static void test_immediates()
+{
+    imm_calls = 0;
+    zjs_queue_immediate(record_immediate, (void*)'A', NULL, 0);
+    zjs_queue_immediate(record_immediate, (void*)'B', NULL, 0);
+    uint32_t id = zjs_queue_immediate(record_immediate, (void*)'D', NULL, 0);
+    zjs_assert(zjs_cancel_immediate(id) && !zjs_cancel_immediate(id),
+               "immediates: cancel once");
+    zjs_service_callbacks();
+    zjs_assert(imm_calls == 2 && !strncmp(imm_order, "AB", 2),
+               "immediates: run in order, not cancelled ones");
+    zjs_service_callbacks();
+    zjs_assert(imm_calls == 3 && imm_order[2] == 'C',
+               "immediates: queued by an immediate run on the next pass");
+
+    // more args than are stored inline
+    jerry_value_t args[5] = { 1, 2, 3, 4, 5 };
+    uint32_t sum = 0;
+    zjs_queue_immediate(sum_immediate, &sum, args, 5);
+    zjs_service_callbacks();
+    zjs_assert(sum == 15, "immediates: args passed");
+
+    // 40 outstanding grows the queue
+    imm_calls = 0;
+    for (int i = 0; i < 40; ++i) {
+        zjs_queue_immediate(sum_immediate, &sum, args, 1);
+    }
+    sum = 0;
+    zjs_service_callbacks();
+    zjs_assert(sum == 1, "immediates: queue grows");
+
+    zjs_callback_id x = zjs_add_c_callback(NULL, queue_c_callback);
+    zjs_callback_id y = zjs_add_c_callback(NULL, record_c_callback);
+    imm_calls = 0;
+    zjs_signal_callback(x, NULL, 0);
+    zjs_signal_callback(y, NULL, 0);
+    zjs_service_callbacks();
+    zjs_assert(imm_calls == 3 && !strncmp(imm_order, "XEY", 3),
+               "immediates: run before the next callback");
+    zjs_remove_callback(x);
+    zjs_remove_callback(y);
+}
+
+// Test the ring buffer with several producer threads
+
+#define RING_PRODUCERS      4
+#define RING_SIGNALS        200000
+#define RING_SIZE           256
+
+struct ring_producer {
+    struct zjs_port_ring_buf* buf;
+    uint16_t id;
+    uint32_t full;      // times the buffer was full
+};
+
+static void* ring_producer_thread(void* arg)
+{
+    struct ring_producer* producer = (struct ring_producer*)arg;
+    uint32_t data[3];
+    for (uint32_t seq = 0; seq < RING_SIGNALS; ++seq) {
+        // vary the record length so records wrap at different offsets
+        uint8_t len = seq % 4;
+        data[0] = seq;
+        data[1] = ~seq;
+        data[2] = producer->id;
+        while (zjs_port_ring_buf_put(producer->buf, producer->id,
+                                     seq & 0x7f, data, len) != 0) {
+            producer->full++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static double elapsed_sec(struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) +
+           (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void test_ring_buffer_mpsc()
+{
+    static uint32_t ring_data[RING_SIZE];
+    struct zjs_port_ring_buf buf;
+    struct ring_producer producers[RING_PRODUCERS];
+    pthread_t threads[RING_PRODUCERS];
+    uint32_t next_seq[RING_PRODUCERS] = { 0 };
+    uint32_t received = 0, errors = 0;
+    int i;
+
+    zjs_port_ring_buf_init(&buf, RING_SIZE, ring_data);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < RING_PRODUCERS; ++i) {
+        producers[i].buf = &buf;
+        producers[i].id = i;
+        producers[i].full = 0;
+        pthread_create(&threads[i], NULL, ring_producer_thread, &producers[i]);
+    }
+
+    while (received < RING_PRODUCERS * RING_SIGNALS) {
+        uint16_t type;
+        uint8_t value;
+        uint32_t data[3];
+        uint8_t size = 3;
+        if (zjs_port_ring_buf_get(&buf, &type, &value, data, &size) != 0) {
+            sched_yield();
+            continue;
+        }
+        received++;
+        if (type >= RING_PRODUCERS) {
+            errors++;
+            continue;
+        }
+        // each producer's records must arrive in order and intact
+        uint32_t seq = next_seq[type]++;
+        if (size != seq % 4 || value != (seq & 0x7f) ||
+            (size > 0 && data[0] != seq) ||
+            (size > 1 && data[1] != ~seq) ||
+            (size > 2 && data[2] != type)) {
+            errors++;
+        }
+    }
+    double sec = elapsed_sec(&start);
+
+    uint32_t full = 0;
+    for (i = 0; i < RING_PRODUCERS; ++i) {
+        pthread_join(threads[i], NULL);
+        full += producers[i].full;
+    }
+
+    uint16_t type;
+    uint8_t value, size = 0;
+    zjs_assert(errors == 0, "ring buffer: records from 4 threads intact");
+    zjs_assert(zjs_port_ring_buf_get(&buf, &type, &value, NULL, &size) ==
+               -EAGAIN, "ring buffer: empty after draining");
+    printf("ring buffer: %u signals in %.3f sec, %.0f signals/sec, "
+           "%u full retries\n", received, sec, received / sec, full);
+}
+
+// Test signaling callbacks from several threads while the main loop sleeps
+
+#define SIGNAL_PRODUCERS    4
+#define SIGNAL_SIGNALS      50000
+
+struct signal_producer {
+    zjs_callback_id id;
+    uint32_t next_seq;  // next sequence number the callback expects
+    uint32_t errors;
+    uint32_t full;      // times the queue was full
+};
+
+static void* signal_producer_thread(void* arg)
+{
+    struct signal_producer* producer = (struct signal_producer*)arg;
+    for (uint32_t seq = 0; seq < SIGNAL_SIGNALS; ++seq) {
+        while (zjs_signal_callback(producer->id, &seq, sizeof(seq)) != 0) {
+            producer->full++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void signal_producer_callback(void* handle, void* args)
+{
+    struct signal_producer* producer = (struct signal_producer*)handle;
+    // each thread's signals must arrive in order
+    if (*(uint32_t*)args != producer->next_seq++) {
+        producer->errors++;
+    }
+}
+
+static void test_signal_callback_mpsc()
+{
+    struct signal_producer producers[SIGNAL_PRODUCERS];
+    pthread_t threads[SIGNAL_PRODUCERS];
+    uint32_t stalls = 0;
+    int i;
+
+    for (i = 0; i < SIGNAL_PRODUCERS; ++i) {
+        memset(&producers[i], 0, sizeof(producers[i]));
+        producers[i].id = zjs_add_c_callback(&producers[i],
+                                             signal_producer_callback);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < SIGNAL_PRODUCERS; ++i) {
+        pthread_create(&threads[i], NULL, signal_producer_thread,
+                       &producers[i]);
+    }
+
+    // run the main loop the way main() does; a signal whose wake up was lost
+    //   would leave it asleep until the timeout
+    uint32_t received = 0;
+    while (received < SIGNAL_PRODUCERS * SIGNAL_SIGNALS && stalls < 3) {
+        zjs_service_callbacks();
+        received = 0;
+        for (i = 0; i < SIGNAL_PRODUCERS; ++i) {
+            received += producers[i].next_seq;
+        }
+        if (received < SIGNAL_PRODUCERS * SIGNAL_SIGNALS) {
+            struct timespec blocked;
+            clock_gettime(CLOCK_MONOTONIC, &blocked);
+            zjs_loop_block(1000);
+            if (elapsed_sec(&blocked) >= 1.0) {
+                stalls++;
+            }
+        }
+    }
+    double sec = elapsed_sec(&start);
+
+    uint32_t errors = 0, full = 0;
+    for (i = 0; i < SIGNAL_PRODUCERS; ++i) {
+        pthread_join(threads[i], NULL);
+        errors += producers[i].errors;
+        full += producers[i].full;
+        zjs_remove_callback(producers[i].id);
+    }
+    zjs_assert(errors == 0 && received == SIGNAL_PRODUCERS * SIGNAL_SIGNALS,
+               "signal callback: signals from 4 threads in order");
+    zjs_assert(stalls == 0, "signal callback: main loop woken for signals");
+    printf("signal callback: %u signals in %.3f sec, %.0f signals/sec, "
+           "%u full retries\n", received, sec, received / sec, full);
+}
+
+// Test promises, and time creating and resolving them
+
+#define PROMISE_COUNT       100000
+#define PROMISE_BATCH       100
+
+static uint32_t promise_thens = 0;
+static uint32_t promise_catches = 0;
+static uint32_t promise_posts = 0;
+static double promise_arg_sum = 0;
+
+static jerry_value_t count_then(const jerry_value_t function_obj,
+                                const jerry_value_t this,
+                                const jerry_value_t argv[],
+                                const jerry_length_t argc)
+{
+    promise_thens++;
+    if (argc == 1 && jerry_value_is_number(argv[0])) {
+        promise_arg_sum += jerry_get_number_value(argv[0]);
+    }
+    return ZJS_UNDEFINED;
+}
+
+static jerry_value_t count_catch(const jerry_value_t function_obj,
+                                 const jerry_value_t this,
+                                 const jerry_value_t argv[],
+                                 const jerry_length_t argc)
+{
+    promise_catches++;
+    return ZJS_UNDEFINED;
+}
+
+static jerry_value_t chain_step(const jerry_value_t function_obj,
+                                const jerry_value_t this,
+                                const jerry_value_t argv[],
+                                const jerry_length_t argc)
+{
+    promise_thens++;
+    promise_arg_sum = jerry_get_number_value(argv[0]);
+    return jerry_create_number(promise_arg_sum + 1);
+}
+
+static void count_post(void* handle)
+{
+    promise_posts++;
+}
+
+static jerry_value_t add_promise_handler(jerry_value_t promise,
+                                         const char* name, jerry_value_t func)
+{
+    // effects: calls then() or catch() on the promise, and returns the
+    //            promise it returns
+    jerry_value_t method = zjs_get_property(promise, name);
+    jerry_value_t ret = jerry_call_function(method, promise, &func, 1);
+    jerry_release_value(method);
+    return ret;
+}
+
+static void test_promises()
+{
+    jerry_value_t then_func = jerry_create_external_function(count_then);
+    jerry_value_t catch_func = jerry_create_external_function(count_catch);
+
+    promise_thens = promise_catches = promise_posts = 0;
+    jerry_value_t promise = jerry_create_object();
+    zjs_make_promise(promise, count_post, NULL);
+    jerry_release_value(add_promise_handler(promise, "catch", catch_func));
+    jerry_value_t arg = jerry_create_number(7);
+    zjs_fulfill_promise(promise, &arg, 1);
+    // then() can still be set after fulfilling
+    jerry_release_value(add_promise_handler(promise, "then", then_func));
+    zjs_reject_promise(promise, NULL, 0);
+    zjs_assert(promise_thens == 0, "promises: then() is not called at once");
+    zjs_service_callbacks();
+    zjs_assert(promise_thens == 1 && promise_catches == 0 &&
+               promise_posts == 1 && promise_arg_sum == 7,
+               "promises: fulfilled once, then() gets the args");
+    jerry_release_value(arg);
+    jerry_release_value(promise);
+
+    promise = jerry_create_object();
+    zjs_make_promise(promise, count_post, NULL);
+    promise_thens = 0;
+    jerry_value_t chained = add_promise_handler(promise, "then", then_func);
+    jerry_value_t caught = add_promise_handler(chained, "catch", catch_func);
+    zjs_reject_promise(promise, NULL, 0);
+    zjs_service_callbacks();
+    zjs_assert(promise_catches == 1 && promise_posts == 2 &&
+               promise_thens == 0, "promises: rejection skips to catch()");
+    jerry_release_value(caught);
+    jerry_release_value(chained);
+    jerry_release_value(promise);
+
+    // each then() returns a promise resolved with what its handler returns
+    jerry_value_t step_func = jerry_create_external_function(chain_step);
+    promise_thens = 0;
+    promise = jerry_create_object();
+    zjs_make_promise(promise, NULL, NULL);
+    chained = jerry_acquire_value(promise);
+    for (int i = 0; i < 5; ++i) {
+        jerry_value_t next = add_promise_handler(chained, "then", step_func);
+        jerry_release_value(chained);
+        chained = next;
+    }
+    arg = jerry_create_number(0);
+    zjs_fulfill_promise(promise, &arg, 1);
+    jerry_release_value(arg);
+    zjs_service_callbacks();
+    zjs_assert(promise_thens == 5 && promise_arg_sum == 4,
+               "promises: 5 step chain completes in one pass");
+    jerry_release_value(chained);
+    jerry_release_value(promise);
+    jerry_release_value(step_func);
+
+    // the rate depends on the machine, compare it before and after changes
+    promise_thens = promise_posts = 0;
+    promise_arg_sum = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < PROMISE_COUNT; ++i) {
+        promise = jerry_create_object();
+        zjs_make_promise(promise, count_post, NULL);
+        jerry_release_value(add_promise_handler(promise, "then", then_func));
+        arg = jerry_create_number(1);
+        zjs_fulfill_promise(promise, &arg, 1);
+        jerry_release_value(arg);
+        jerry_release_value(promise);
+        if (i % PROMISE_BATCH == PROMISE_BATCH - 1) {
+            zjs_service_callbacks();
+        }
+    }
+    zjs_service_callbacks();
+    double sec = elapsed_sec(&start);
+    zjs_assert(promise_thens == PROMISE_COUNT &&
+               promise_posts == PROMISE_COUNT &&
+               promise_arg_sum == PROMISE_COUNT,
+               "promises: 100k created and fulfilled");
+    printf("promises: %u created and fulfilled in %.3f sec, %.0f/sec\n",
+           PROMISE_COUNT, sec, PROMISE_COUNT / sec);
+
+    jerry_release_value(then_func);
+    jerry_release_value(catch_func);
+}
+
+#ifdef BUILD_MODULE_BUFFER
+// Soak the Buffer pools with random sized allocations, like a device making
+//   a Buffer for each read for a long time
+
+#define POOL_CYCLES         1000000
+#define POOL_SLOTS          64
+
+static void test_buffer_pool()
+{
+    struct zjs_buffer_pool_stats before[ZJS_BUFFER_POOL_CLASSES + 1];
+    struct zjs_buffer_pool_stats after[ZJS_BUFFER_POOL_CLASSES + 1];
+    uint8_t* blocks[POOL_SLOTS] = { NULL };
+    uint32_t sizes[POOL_SLOTS];
+    uint32_t seed = 12345, corrupt = 0, failed = 0;
+    uint32_t live_bytes = 0, peak_bytes = 0;
+    int i;
+
+    zjs_buffer_get_pool_stats(before);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t cycle = 0; cycle < POOL_CYCLES; ++cycle) {
+        seed = seed * 1103515245 + 12345;
+        int slot = (seed >> 8) % POOL_SLOTS;
+        if (blocks[slot]) {
+            // each block is filled with its size, check nothing overlapped
+            if (blocks[slot][0] != (uint8_t)sizes[slot] ||
+                blocks[slot][sizes[slot] - 1] != (uint8_t)sizes[slot]) {
+                corrupt++;
+            }
+            zjs_buffer_pool_free(blocks[slot], sizes[slot]);
+            if (sizes[slot] <= 256)
+                live_bytes -= sizes[slot];
+            blocks[slot] = NULL;
+            continue;
+        }
+        // mostly small reads, with the odd large one
+        uint32_t size = (seed >> 16) % 16 ? 1 + (seed >> 20) % 256 :
+                                            257 + (seed >> 20) % 1024;
+        blocks[slot] = zjs_buffer_pool_alloc(size);
+        if (!blocks[slot]) {
+            failed++;
+            continue;
+        }
+        sizes[slot] = size;
+        memset(blocks[slot], (uint8_t)size, size);
+        if (size <= 256) {
+            live_bytes += size;
+            if (live_bytes > peak_bytes)
+                peak_bytes = live_bytes;
+        }
+    }
+    for (i = 0; i < POOL_SLOTS; ++i) {
+        if (blocks[i]) {
+            zjs_buffer_pool_free(blocks[i], sizes[i]);
+        }
+    }
+    double sec = elapsed_sec(&start);
+    zjs_buffer_get_pool_stats(after);
+
+    // the last stats are for blocks too big to pool
+    uint32_t hits = 0, misses = 0, live = 0, pool_bytes = 0;
+    for (i = 0; i < ZJS_BUFFER_POOL_CLASSES; ++i) {
+        hits += after[i].hits - before[i].hits;
+        misses += after[i].misses - before[i].misses;
+        live += after[i].live - before[i].live;
+        pool_bytes += after[i].blocks * after[i].size;
+    }
+    int heap = ZJS_BUFFER_POOL_CLASSES;
+    live += after[heap].live - before[heap].live;
+    zjs_assert(corrupt == 0 && failed == 0,
+               "buffer pool: 1M alloc/free cycles keep blocks intact");
+    zjs_assert(live == 0, "buffer pool: all blocks given back");
+    zjs_assert(hits > misses * 100,
+               "buffer pool: small blocks reuse pooled memory");
+    printf("buffer pool: %u cycles in %.3f sec, %u hits, %u misses, "
+           "%u from the heap, %u pooled bytes for at most %u live "
+           "(%.0f%% unused)\n", POOL_CYCLES, sec, hits, misses,
+           after[heap].misses - before[heap].misses, pool_bytes, peak_bytes,
+           100.0 - 100.0 * peak_bytes / pool_bytes);
+}
+#endif
+
+// Test saving a snapshot file and running it in place, and compare the time
+//   to parse a script with the time to load its snapshot
+
+#define SNAPSHOT_FUNCS      500
+
+static void test_snapshot_file()
+{
+    char path[] = "/tmp/zjs_snapshot_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        zjs_assert(0, "snapshot: temp file created");
+        return;
+    }
+    close(fd);
+
+    const char *source = "var a = [1, 2, 3]; a.length * 14;";
+    uint32_t size;
+    const uint32_t *snapshot;
+    uint32_t len;
+    if (zjs_compile_script(source, strlen(source), path, &size) ||
+        zjs_map_snapshot(path, &snapshot, &len)) {
+        zjs_assert(0, "snapshot: compiled and mapped");
+        unlink(path);
+        return;
+    }
+    zjs_assert(len == size, "snapshot: compiled and mapped");
+    jerry_value_t result = jerry_exec_snapshot(snapshot, len, false);
+    zjs_assert(jerry_value_is_number(result) &&
+               jerry_get_number_value(result) == 42,
+               "snapshot: runs in place");
+    jerry_release_value(result);
+    // the file is written again below, which must not happen under a mapping
+    munmap((void *)snapshot, len);
+
+    zjs_assert(zjs_compile_script("var 1a;", 7, path, &size),
+               "snapshot: syntax error reported");
+
+    // a script with many small functions, the rates depend on the machine
+    const int func_len = 64;
+    char *big = zjs_malloc(SNAPSHOT_FUNCS * func_len + 1);
+    char *end = big;
+    for (int i = 0; i < SNAPSHOT_FUNCS; ++i) {
+        end += snprintf(end, func_len, "function f%d(x) { return x * %d; }\n",
+                        i, i);
+    }
+    uint32_t big_len = end - big;
+    if (zjs_compile_script(big, big_len, path, &size) ||
+        zjs_map_snapshot(path, &snapshot, &len)) {
+        zjs_assert(0, "snapshot: 500 functions compiled and mapped");
+        zjs_free(big);
+        unlink(path);
+        return;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    jerry_value_t code = jerry_parse((jerry_char_t *)big, big_len, false);
+    double parse_sec = elapsed_sec(&start);
+    jerry_release_value(code);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    result = jerry_exec_snapshot(snapshot, len, false);
+    double exec_sec = elapsed_sec(&start);
+    zjs_assert(!jerry_value_has_error_flag(result),
+               "snapshot: 500 functions run from snapshot");
+    jerry_release_value(result);
+    printf("snapshot: %u bytes of source parsed in %.3f ms, %u byte "
+           "snapshot run in %.3f ms\n", big_len, parse_sec * 1000, len,
+           exec_sec * 1000);
+
+    munmap((void *)snapshot, len);
+    zjs_free(big);
+    unlink(path);
+}
+
+// Test the virtual clock, this leaves it on so it must run last
+
+static void test_virtual_time()
+{
+    zjs_port_enable_virtual_time();
+    // clear any wakeup left by the tests before
+    zjs_loop_block(0);
+    uint64_t start = zjs_port_timer_get_uptime_us();
+    usleep(2000);
+    zjs_assert(zjs_port_timer_get_uptime_us() == start,
+               "virtual time: clock stands still while busy");
+
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    zjs_loop_block(600000);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    zjs_assert(after.tv_sec - before.tv_sec < 2 &&
+               zjs_port_timer_get_uptime_us() == start + 600000000,
+               "virtual time: idle wait skips ahead");
+
+    zjs_loop_unblock();
+    zjs_loop_block(1000);
+    zjs_assert(zjs_port_timer_get_uptime_us() == start + 600000000,
+               "virtual time: no skip with work pending");
+}
+
 void zjs_run_unit_tests()
 {
     test_hex_to_byte();
     test_default_convert_pin();
     test_compress_32();
+    test_callback_ids();
+    test_callback_coalescing();
+    test_callback_priority();
+    test_callback_class_full();
+    test_callback_overflow();
+    test_callback_payload();
+    test_immediates();
+    test_ring_buffer_mpsc();
+    test_signal_callback_mpsc();
+    test_promises();
+#ifdef BUILD_MODULE_BUFFER
+    test_buffer_pool();
+#endif
+    test_snapshot_file();
+    test_virtual_time();
 
     printf("TOTAL - %d of %d passed\n", passed, total);
     exit(!(passed == total));
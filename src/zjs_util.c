@@ -5,12 +5,150 @@
 // ZJS includes
 #include "zjs_util.h"
 
+// Property names used on hot paths, created once by zjs_init_names() and
+//   never released
+static const char *const known_names[] = {
+    "activeLow", "baud", "bus", "callback_id", "channel", "data", "device",
+    "deviceId", "direction", "edge", "error", "errorCode", "exports", "id",
+    "message", "module", "name", "onchange", "onerror", "period", "pin",
+    "polarity", "port", "properties", "pull", "pulseWidth", "reading",
+    "resourcePath", "state", "uuid", "value", "x", "y", "z"
+};
+
+// must be a power of 2, at least twice the number of known names
+#define KNOWN_NAME_SLOTS    64
+// dynamic names remembered, and the longest one that is
+#define NAME_CACHE_SIZE     8
+#define NAME_CACHE_LEN      23
+
+struct known_name {
+    const char *name;   // NULL for an empty slot
+    uint32_t hash;
+    jerry_value_t value;
+};
+
+struct cached_name {
+    uint32_t hash;      // 0 for an empty entry
+    char name[NAME_CACHE_LEN + 1];
+    jerry_value_t value;
+};
+
+static struct known_name known_table[KNOWN_NAME_SLOTS];
+// most recently used first
+static struct cached_name name_cache[NAME_CACHE_SIZE];
+static bool names_ready = false;
+
+static uint32_t hash_name(const char *name, uint32_t *len)
+{
+    // effects: returns the FNV-1a hash of name, never 0, and its length in len
+    uint32_t hash = 2166136261u;
+    const char *start = name;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    *len = name - start;
+    return hash ? hash : 1;
+}
+
+void zjs_init_names()
+{
+    // requires: jerry_init() has been called
+    //  effects: creates the JS strings for the known property names
+    int count = sizeof(known_names) / sizeof(known_names[0]);
+    for (int i = 0; i < count; i++) {
+        uint32_t len;
+        uint32_t hash = hash_name(known_names[i], &len);
+        uint32_t slot = hash & (KNOWN_NAME_SLOTS - 1);
+        while (known_table[slot].name) {
+            slot = (slot + 1) & (KNOWN_NAME_SLOTS - 1);
+        }
+        known_table[slot].name = known_names[i];
+        known_table[slot].hash = hash;
+        known_table[slot].value =
+            jerry_create_string((const jerry_char_t *)known_names[i]);
+    }
+    names_ready = true;
+}
+
+void zjs_cleanup_names()
+{
+    // effects: releases all the property name strings
+    for (int i = 0; i < KNOWN_NAME_SLOTS; i++) {
+        if (known_table[i].name) {
+            jerry_release_value(known_table[i].value);
+        }
+    }
+    for (int i = 0; i < NAME_CACHE_SIZE; i++) {
+        if (name_cache[i].hash) {
+            jerry_release_value(name_cache[i].value);
+        }
+    }
+    memset(known_table, 0, sizeof(known_table));
+    memset(name_cache, 0, sizeof(name_cache));
+    names_ready = false;
+}
+
+static jerry_value_t get_name(const char *name, bool *temp)
+{
+    // effects: returns a JS string for name; if *temp is set the caller must
+    //            release it, otherwise it belongs to the name cache
+    *temp = false;
+    if (names_ready) {
+        uint32_t len;
+        uint32_t hash = hash_name(name, &len);
+        uint32_t slot = hash & (KNOWN_NAME_SLOTS - 1);
+        while (known_table[slot].name) {
+            if (known_table[slot].hash == hash &&
+                !strcmp(known_table[slot].name, name)) {
+                return known_table[slot].value;
+            }
+            slot = (slot + 1) & (KNOWN_NAME_SLOTS - 1);
+        }
+
+        if (len <= NAME_CACHE_LEN) {
+            int i;
+            for (i = 0; i < NAME_CACHE_SIZE - 1; i++) {
+                if (!name_cache[i].hash || (name_cache[i].hash == hash &&
+                                            !strcmp(name_cache[i].name, name))) {
+                    break;
+                }
+            }
+            struct cached_name entry = name_cache[i];
+            if (entry.hash != hash || strcmp(entry.name, name)) {
+                // miss, replace the least recently used one
+                if (entry.hash) {
+                    jerry_release_value(entry.value);
+                }
+                entry.hash = hash;
+                memcpy(entry.name, name, len + 1);
+                entry.value = jerry_create_string((const jerry_char_t *)name);
+            }
+            memmove(&name_cache[1], &name_cache[0],
+                    sizeof(struct cached_name) * i);
+            name_cache[0] = entry;
+            return entry.value;
+        }
+    }
+    *temp = true;
+    return jerry_create_string((const jerry_char_t *)name);
+}
+
+static void put_name(jerry_value_t jname, bool temp)
+{
+    // effects: releases a name from get_name() if it was temporary
+    if (temp) {
+        jerry_release_value(jname);
+    }
+}
+
 void zjs_set_property(const jerry_value_t obj, const char *str,
                       const jerry_value_t prop)
 {
-    jerry_value_t name = jerry_create_string((const jerry_char_t *)str);
-    jerry_set_property(obj, name, prop);
-    jerry_release_value(name);
+    bool temp;
+    jerry_value_t name = get_name(str, &temp);
+    jerry_release_value(jerry_set_property(obj, name, prop));
+    put_name(name, temp);
 }
 
 jerry_value_t zjs_get_property(const jerry_value_t obj, const char *name)
@@ -18,9 +156,10 @@ jerry_value_t zjs_get_property(const jerry_value_t obj, const char *name)
     // requires: obj is an object, name is a property name string
     //  effects: looks up the property name in obj, and returns it; the value
     //             will be owned by the caller and must be released
-    jerry_value_t jname = jerry_create_string((const jerry_char_t *)name);
+    bool temp;
+    jerry_value_t jname = get_name(name, &temp);
     jerry_value_t rval = jerry_get_property(obj, jname);
-    jerry_release_value(jname);
+    put_name(jname, temp);
     return rval;
 }
 
@@ -39,10 +178,11 @@ void zjs_obj_add_boolean(jerry_value_t obj, bool flag, const char *name)
 {
     // requires: obj is an existing JS object
     //  effects: creates a new field in parent named name, set to value
-    jerry_value_t jname = jerry_create_string((const jerry_char_t *)name);
+    bool temp;
+    jerry_value_t jname = get_name(name, &temp);
     jerry_value_t jbool = jerry_create_boolean(flag);
-    jerry_set_property(obj, jname, jbool);
-    jerry_release_value(jname);
+    jerry_release_value(jerry_set_property(obj, jname, jbool));
+    put_name(jname, temp);
     jerry_release_value(jbool);
 }
 
@@ -55,12 +195,13 @@ void zjs_obj_add_function(jerry_value_t obj, void *func, const char *name)
     // NOTE: The docs on this function make it look like func obj should be
     //   released before we return, but in a loop of 25k buffer creates there
     //   seemed to be no memory leak. Reconsider with future intelligence.
-    jerry_value_t jname = jerry_create_string((const jerry_char_t *)name);
+    bool temp;
+    jerry_value_t jname = get_name(name, &temp);
     jerry_value_t jfunc = jerry_create_external_function(func);
     if (jerry_value_is_function(jfunc)) {
-        jerry_set_property(obj, jname, jfunc);
+        jerry_release_value(jerry_set_property(obj, jname, jfunc));
     }
-    jerry_release_value(jname);
+    put_name(jname, temp);
     jerry_release_value(jfunc);
 }
 
@@ -69,19 +210,21 @@ void zjs_obj_add_object(jerry_value_t parent, jerry_value_t child,
 {
     // requires: parent and child are existing JS objects
     //  effects: creates a new field in parent named name, that refers to child
-    jerry_value_t jname = jerry_create_string((const jerry_char_t *)name);
-    jerry_set_property(parent, jname, child);
-    jerry_release_value(jname);
+    bool temp;
+    jerry_value_t jname = get_name(name, &temp);
+    jerry_release_value(jerry_set_property(parent, jname, child));
+    put_name(jname, temp);
 }
 
 void zjs_obj_add_string(jerry_value_t obj, const char *str, const char *name)
 {
     // requires: obj is an existing JS object
     //  effects: creates a new field in parent named name, set to sval
-    jerry_value_t jname = jerry_create_string((const jerry_char_t *)name);
+    bool temp;
+    jerry_value_t jname = get_name(name, &temp);
     jerry_value_t jstr = jerry_create_string((const jerry_char_t *)str);
-    jerry_set_property(obj, jname, jstr);
-    jerry_release_value(jname);
+    jerry_release_value(jerry_set_property(obj, jname, jstr));
+    put_name(jname, temp);
     jerry_release_value(jstr);
 }
 
@@ -89,10 +232,11 @@ void zjs_obj_add_number(jerry_value_t obj, double num, const char *name)
 {
     // requires: obj is an existing JS object
     //  effects: creates a new field in parent named name, set to nval
-    jerry_value_t jname = jerry_create_string((const jerry_char_t *)name);
+    bool temp;
+    jerry_value_t jname = get_name(name, &temp);
     jerry_value_t jnum = jerry_create_number(num);
-    jerry_set_property(obj, jname, jnum);
-    jerry_release_value(jname);
+    jerry_release_value(jerry_set_property(obj, jname, jnum));
+    put_name(jname, temp);
     jerry_release_value(jnum);
 }
 
@@ -105,8 +249,10 @@ bool zjs_obj_get_boolean(jerry_value_t obj, const char *name, bool *flag)
     if (jerry_value_has_error_flag(value))
         return false;
 
-    if (!jerry_value_is_boolean(value))
+    if (!jerry_value_is_boolean(value)) {
+        jerry_release_value(value);
         return false;
+    }
 
     *flag = jerry_get_boolean_value(value);
     jerry_release_value(value);
@@ -126,12 +272,16 @@ bool zjs_obj_get_string(jerry_value_t obj, const char *name, char *buffer,
     if (jerry_value_has_error_flag(value))
         return false;
 
-    if (!jerry_value_is_string(value))
+    if (!jerry_value_is_string(value)) {
+        jerry_release_value(value);
         return false;
+    }
 
     jerry_size_t jlen = jerry_get_string_size(value);
-    if (jlen >= len)
+    if (jlen >= len) {
+        jerry_release_value(value);
         return false;
+    }
 
     int wlen = jerry_string_to_char_buffer(value, (jerry_char_t *)buffer, jlen);
     buffer[wlen] = '\0';
@@ -259,12 +409,12 @@ jerry_value_t zjs_error(const char *error)
 
 #ifdef DEBUG_BUILD
 
-static uint8_t init = 0;
-static int seconds = 0;
-
 #ifdef ZJS_LINUX_BUILD
 #include <time.h>
 
+static uint8_t init = 0;
+static int seconds = 0;
+
 int zjs_get_sec(void)
 {
     struct timespec now;
@@ -288,51 +438,16 @@ int zjs_get_ms(void)
 }
 #else
 
-#include "zjs_zephyr_port.h"
-
-static zjs_port_timer_t print_timer;
-// Millisecond counter to increment
-static uint32_t milli = 0;
-
-void update_print_timer(void)
-{
-    if (!init) {
-        zjs_port_timer_init(&print_timer);
-        zjs_port_timer_start(&print_timer, 1);
-        init = 1;
-    }
-    if (zjs_port_timer_test(&print_timer)) {
-        if (milli >= 100) {
-            milli = 0;
-            seconds++;
-        } else {
-            // TODO: Find out why incrementing by 1 results in timer being
-            //       ~50% too slow. Increasing by 2 works as it did before the
-            //       unified kernel.
-            milli += 2;
-        }
-        zjs_port_timer_start(&print_timer, 1);
-    }
-}
-
+// uptime is kept by the kernel, so this doesn't depend on the main loop
+//   waking up every tick
 int zjs_get_sec(void)
 {
-    if (!init) {
-        zjs_port_timer_init(&print_timer);
-        zjs_port_timer_start(&print_timer, 1);
-        init = 1;
-    }
-    return seconds;
+    return k_uptime_get_32() / 1000;
 }
 
 int zjs_get_ms(void)
 {
-    if (!init) {
-        zjs_port_timer_init(&print_timer);
-        zjs_port_timer_start(&print_timer, 1);
-        init = 1;
-    }
-    return milli;
+    return k_uptime_get_32() % 1000;
 }
 
 #endif // ZJS_LINUX_BUILD
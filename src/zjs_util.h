@@ -26,6 +26,17 @@
 #endif  // ZJS_TRACE_MALLOC
 #endif  // ZJS_LINUX_BUILD
 
+/**
+ * Create the JS strings for property names used on hot paths, so that
+ * zjs_get_property(), zjs_set_property() and the zjs_obj_* helpers don't have
+ * to create a new string for them on every call. Other names go in a small
+ * cache of recently used names. Call once, after jerry_init().
+ */
+void zjs_init_names();
+
+/** Release the property name strings, before jerry_cleanup() */
+void zjs_cleanup_names();
+
 void zjs_set_property(const jerry_value_t obj, const char *str,
                       const jerry_value_t prop);
 jerry_value_t zjs_get_property (const jerry_value_t obj, const char *str);
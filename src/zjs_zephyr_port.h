@@ -4,18 +4,51 @@
 #define ZJS_ZEPHYR_PORT_H_
 
 #include <zephyr.h>
+#include <misc/ring_buffer.h>
 
 #define zjs_port_timer_t                struct k_timer
 #define zjs_port_timer_init(t)          k_timer_init(t, NULL, NULL)
 #define zjs_port_timer_start(t, i)      k_timer_start(t, i, i)
 #define zjs_port_timer_stop             k_timer_stop
 #define zjs_port_timer_test             k_timer_status_get
+#define zjs_port_timer_get_remaining    k_timer_remaining_get
+#define zjs_port_timer_get_uptime       k_uptime_get_32
+// us since boot, at system tick resolution
+#define zjs_port_get_uptime_us()        (k_uptime_get_32() * 1000)
+#define zjs_port_timer_get_uptime_us()  ((uint64_t)k_uptime_get() * 1000)
 #define ZJS_TICKS_NONE                  TICKS_NONE
+#define ZJS_TICKS_FOREVER               K_FOREVER
 #define zjs_sleep                       k_sleep
 
 #define zjs_port_ring_buf ring_buf
 #define zjs_port_ring_buf_init sys_ring_buf_init
 #define zjs_port_ring_buf_get sys_ring_buf_get
 #define zjs_port_ring_buf_put sys_ring_buf_put
+#define zjs_port_ring_buf_space_get sys_ring_buf_space_get
+#define zjs_port_ring_buf_is_empty sys_ring_buf_is_empty
+
+// like sys_ring_buf_get(), but leaves the record in the buffer and doesn't
+//   copy its data; returns -EAGAIN if there is none
+static inline int zjs_port_ring_buf_peek(struct ring_buf *buf, uint16_t *type,
+                                         uint8_t *value, uint8_t *size32)
+{
+    if (sys_ring_buf_is_empty(buf)) {
+        return -EAGAIN;
+    }
+    struct ring_element *header = (struct ring_element *)&buf->buf[buf->head];
+    *type = header->type;
+    *value = header->value;
+    *size32 = header->length;
+    return 0;
+}
+
+#define zjs_port_sem k_sem
+#define zjs_port_sem_init k_sem_init
+#define zjs_port_sem_give k_sem_give
+#define zjs_port_sem_take k_sem_take
+
+#define zjs_port_critical_t unsigned int
+#define zjs_port_enter_critical irq_lock
+#define zjs_port_exit_critical irq_unlock
 
 #endif /* ZJS_ZEPHYR_PORT_H_ */
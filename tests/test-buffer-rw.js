@@ -131,4 +131,52 @@ assert(buf.readUInt8(4) == 0xce && buf.readUInt8(5) == 0xfa &&
        buf.readUInt8(6) == 0xad && buf.readUInt8(7) == 0xbe,
        "writeUInt32LE: write long, offset 4");
 
+// test signed reads and writes
+buf.writeInt8(-2, 0);
+assert(buf.readUInt8(0) == 0xfe && buf.readInt8(0) == -2,
+       "writeInt8/readInt8: negative byte");
+buf.writeInt16BE(-2, 0);
+assert(buf.readUInt16BE(0) == 0xfffe && buf.readInt16BE(0) == -2,
+       "writeInt16BE/readInt16BE: negative short");
+buf.writeInt16LE(0x7fff, 2);
+assert(buf.readInt16LE(2) == 0x7fff && buf.readInt16BE(2) == -129,
+       "writeInt16LE/readInt16LE: positive short");
+buf.writeInt32LE(-100000, 4);
+assert(buf.readInt32LE(4) == -100000 && buf.readUInt32LE(4) == 4294867296,
+       "writeInt32LE/readInt32LE: negative long");
+buf.writeInt32BE(-1, 0);
+assert(buf.readInt32BE(0) == -1, "writeInt32BE/readInt32BE: negative long");
+
+// test float and double reads and writes
+buf.writeFloatLE(1.5, 0);
+assert(buf.readFloatLE(0) == 1.5 && buf.readUInt32LE(0) == 0x3fc00000,
+       "writeFloatLE/readFloatLE: float");
+buf.writeFloatBE(-0.25, 4);
+assert(buf.readFloatBE(4) == -0.25 && buf.readUInt8(4) == 0xbe,
+       "writeFloatBE/readFloatBE: float");
+buf.writeDoubleBE(-3.25);
+assert(buf.readDoubleBE() == -3.25 && buf.readUInt8(0) == 0xc0,
+       "writeDoubleBE/readDoubleBE: double");
+buf.writeDoubleLE(1e100, 0);
+assert(buf.readDoubleLE(0) == 1e100, "writeDoubleLE/readDoubleLE: double");
+expectThrow("readDoubleLE: out of bounds", function () {
+    buf.readDoubleLE(1);
+});
+
+// test batch reads
+for (var i = 0; i < 4; i++) {
+    buf.writeInt16LE(-i * 1000, i * 2);
+}
+var values = buf.readInt16LEArray(2, 3);
+assert(values.length == 3 && values[0] == -1000 && values[2] == -3000,
+       "readInt16LEArray: count from offset");
+values = buf.readUInt8Array();
+assert(values.length == 8 && values[2] == 0x18 && values[3] == 0xfc,
+       "readUInt8Array: whole buffer by default");
+assert(buf.readUInt32BEArray(4).length == 1,
+       "readUInt32BEArray: as many as fit");
+expectThrow("readInt16LEArray: out of bounds", function () {
+    buf.readInt16LEArray(2, 4);
+});
+
 console.log("TOTAL: " + passed + " of " + total + " passed");
@@ -103,9 +103,100 @@ assert(buff.toString('hex') === expected,
        "The value of toString('hex') expected:" + expected +
        " got:" + buff.toString('hex'));
 
-expectThrow("Error thrown when 'hex' is not given to toString()", function () {
-    // unsupported encoding
-    buff.toString("utf8");
+expectThrow("Error thrown when an unsupported encoding is given to toString()",
+            function () {
+    buff.toString("utf16");
+});
+
+// Function: Buffer Buffer.from(value, string encoding)
+buff = Buffer.from("00ff10", "hex");
+assert(buff.length === 3 && buff.readUInt8(1) === 0xff &&
+       buff.toString("hex") === "00ff10", "Buffer.from() decodes hex");
+assert(buff.toString("hex", 1, 2) === "ff",
+       "toString() encodes from start up to end");
+
+var plain = ["", "f", "fo", "foo", "foob", "fooba", "foobar"];
+var base64 = ["", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy"];
+for (var i = 0; i < plain.length; i++) {
+    assert(Buffer.from(plain[i]).toString("base64") === base64[i],
+           "toString('base64') encodes '" + plain[i] + "'");
+    assert(Buffer.from(base64[i], "base64").toString("utf8") === plain[i],
+           "Buffer.from() decodes base64 '" + base64[i] + "'");
+}
+
+buff = new Buffer("a\u00e9\ud83d\ude00");
+assert(buff.length === 7 && buff.readUInt8(3) === 0xf0 &&
+       buff.readUInt8(6) === 0x80, "strings are stored as UTF-8");
+assert(buff.toString("utf8") === "a\u00e9\ud83d\ude00",
+       "toString('utf8') decodes UTF-8");
+assert(buff.toString("utf-8", 0, 4) === "a\u00e9\ufffd",
+       "toString('utf-8') replaces a cut off sequence");
+assert(Buffer.from("\u00e9", "ascii").readUInt8(0) === 0xe9 &&
+       buff.toString("ascii", 0, 1) === "a",
+       "ascii encoding uses one byte per character");
+
+var copied = Buffer.from(buff);
+copied.writeUInt8(0x62, 0);
+assert(buff.readUInt8(0) === 0x61, "Buffer.from() copies a Buffer");
+
+// Function: unsigned long write(string value, offset, length, encoding)
+buff = new Buffer(4);
+buff.fill(0);
+assert(buff.write("beef", 1, "hex") === 2 && buff.readUInt16BE(1) === 0xbeef,
+       "write() decodes the string");
+assert(buff.write("abcdef", 2) === 2 && buff.readUInt8(3) === 0x62,
+       "write() stops at the end of the buffer");
+
+// Function: Buffer slice(long start, long end)
+buff = new Buffer(8);
+for (var i = 0; i < buff.length; i++) {
+    buff.writeUInt8(i, i);
+}
+var view = buff.slice(2, -2);
+assert(view.length === 4 && view.readUInt8(0) === 2,
+       "slice() returns the bytes from start up to end");
+view.writeUInt8(99, 0);
+assert(buff.readUInt8(2) === 99, "slice() shares memory with its parent");
+assert(buff.subarray(6, 2).length === 0,
+       "subarray() with end before start is empty");
+
+// Function: unsigned long copy(Buffer target, ...)
+var target = new Buffer(3);
+assert(buff.copy(target, 1, 4) === 2 && target.readUInt8(1) === 4 &&
+       target.readUInt8(2) === 5, "copy() copies as much as fits in target");
+
+// Function: Buffer fill(value, unsigned long offset, unsigned long end)
+buff.fill(0).fill(7, 2, 4);
+assert(buff.readUInt8(1) === 0 && buff.readUInt8(2) === 7 &&
+       buff.readUInt8(3) === 7 && buff.readUInt8(4) === 0,
+       "fill() sets the range to the value");
+buff.fill("ab");
+assert(buff.readUInt8(0) === 0x61 && buff.readUInt8(7) === 0x62,
+       "fill() repeats a string");
+
+// Functions: boolean equals(Buffer other), long compare(Buffer other)
+var other = new Buffer(8);
+other.fill("ab");
+assert(buff.equals(other) && buff.compare(other) === 0,
+       "equals() and compare() match identical Buffers");
+other.writeUInt8(0x62, 0);
+assert(!buff.equals(other) && buff.compare(other) === -1 &&
+       other.compare(buff) === 1, "compare() orders by the first difference");
+assert(buff.slice(0, 4).compare(buff) === -1,
+       "compare() puts a shorter prefix first");
+
+// Function: Buffer Buffer.concat(sequence<Buffer> list, unsigned long length)
+var joined = Buffer.concat([buff.slice(0, 2), target]);
+assert(joined.length === 5 && joined.readUInt8(1) === 0x62 &&
+       joined.readUInt8(4) === 5, "Buffer.concat() joins Buffers in order");
+assert(Buffer.concat([target], 5).readUInt8(4) === 0,
+       "Buffer.concat() pads with zeros up to the length");
+
+expectThrow("Error thrown when Buffer methods are called on other objects",
+            function () {
+    // objects that only borrow the methods have no buffer behind them
+    var fake = { readUInt8: buff.readUInt8 };
+    fake.readUInt8(0);
 });
 
 console.log("TOTAL: " + passed + " of " + total + " passed");
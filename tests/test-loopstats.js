@@ -0,0 +1,100 @@
+// Copyright (c) 2016, Intel Corporation.
+
+// Test loopstats module
+
+var loopstats = require("loopstats");
+
+var total = 0;
+var passed = 0;
+
+function assert(actual, description) {
+    total += 1;
+    var label = "\033[1m\033[31mFAIL\033[0m";
+    if (actual === true) {
+        passed += 1;
+        label = "\033[1m\033[32mPASS\033[0m";
+    }
+    console.log(label + " - " + description);
+}
+
+function sum(histogram) {
+    var count = 0;
+    for (var i = 0; i < histogram.length; i++) {
+        count += histogram[i];
+    }
+    return count;
+}
+
+var modules = loopstats.modules();
+var names = [];
+for (var i = 0; i < modules.length; i++) {
+    names.push(modules[i].name);
+}
+assert(names.indexOf("loopstats") !== -1 && names.indexOf("events") !== -1,
+       "loopstats: loaded modules listed");
+assert(names.indexOf("performance") === -1,
+       "loopstats: modules not yet required not listed");
+assert(typeof modules[0].initUs === "number", "loopstats: init time reported");
+
+var ticks = 0;
+var id = setInterval(function() {
+    ticks++;
+    if (ticks < 5) {
+        return;
+    }
+
+    var stats = loopstats.get();
+    var timer = null;
+    for (var i = 0; i < stats.length; i++) {
+        if (stats[i].priority === "timer" && stats[i].dispatches === 5) {
+            timer = stats[i];
+        }
+    }
+    assert(stats instanceof Array, "loopstats: get returns array");
+    assert(timer !== null, "loopstats: interval callback found");
+    assert(timer.signals === 5, "loopstats: signals counted");
+    assert(timer.drops === 0, "loopstats: no drops");
+    assert(timer.wait.length === 16 && timer.run.length === 16,
+           "loopstats: histograms have 16 buckets");
+    assert(sum(timer.wait) === 5,
+           "loopstats: wait histogram counts dispatches");
+    assert(sum(timer.run) === 4,
+           "loopstats: run histogram counts finished calls");
+
+    loopstats.reset();
+    stats = loopstats.get();
+    var cleared = true;
+    for (var i = 0; i < stats.length; i++) {
+        if (stats[i].dispatches !== 0 || sum(stats[i].run) !== 0) {
+            cleared = false;
+        }
+    }
+    assert(cleared, "loopstats: reset clears stats");
+    var timers = loopstats.timers();
+    assert(timers.wakeups === 0 && timers.fired === 0 && timers.saved === 0,
+           "loopstats: reset clears timer stats");
+
+    clearInterval(id);
+    testSlack();
+}, 10);
+
+function testSlack() {
+    // intervals whose deadlines are a few ms apart but within each other's
+    //   slack should share wakeups
+    var intervals = [];
+    for (var i = 0; i < 4; i++) {
+        intervals[i] = setInterval(function () {}, 20 + i * 3);
+        intervals[i].setSlack(15);
+    }
+
+    setTimeout(function () {
+        for (var i = 0; i < intervals.length; i++) {
+            clearInterval(intervals[i]);
+        }
+        var timers = loopstats.timers();
+        assert(timers.fired > timers.wakeups,
+               "loopstats: timers with slack share wakeups");
+        assert(timers.saved > 0, "loopstats: wakeups saved counted");
+        console.log("TOTAL: " + passed + " of " + total + " passed");
+    }, 500);
+}
@@ -0,0 +1,28 @@
+// Copyright (c) 2016, Intel Corporation.
+
+// Test require() of native and JavaScript modules
+
+var assert = require("Assert.js");
+
+assert.true(typeof assert.true === "function",
+            "require: JavaScript module exports its API");
+assert.true(require("Assert.js") === assert,
+            "require: JavaScript module only run once");
+assert.true(typeof Assert === "undefined",
+            "require: JavaScript module has its own scope");
+assert.true(typeof module === "undefined",
+            "require: no global module object");
+assert.true(require("performance") === require("performance"),
+            "require: native module only loaded once");
+
+assert.throws("require: unknown JavaScript module", function () {
+    require("NoSuchModule.js");
+});
+assert.throws("require: unknown native module", function () {
+    require("nosuchmodule");
+});
+assert.throws("require: name too long", function () {
+    require("ThisModuleNameIsLongerThan32Bytes.js");
+});
+
+assert.result();
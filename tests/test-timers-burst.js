@@ -0,0 +1,32 @@
+// Copyright (c) 2016, Intel Corporation.
+
+// Timer burst test for jslinux: sets more timeouts at once than the callback
+// queue holds, so some can't be signaled in the pass they expire in; those
+// must wait for the queue to drain and fire then, not be lost
+
+var total = 0;
+var passed = 0;
+function assert(actual, description) {
+    total += 1;
+    var label = "\033[1m\033[31mFAIL\033[0m";
+    if (actual === true) {
+        passed += 1;
+        label = "\033[1m\033[32mPASS\033[0m";
+    }
+    console.log(label + " - " + description);
+}
+
+// far more than the 1 KB ring buffer and its spill entries hold
+var TIMEOUTS = 1000;
+
+var fired = 0;
+for (var i = 0; i < TIMEOUTS; i++) {
+    setTimeout(function () {
+        fired++;
+    }, 0);
+}
+
+setTimeout(function () {
+    assert(fired === TIMEOUTS, "setTimeout: every timeout in a burst fires");
+    console.log("TOTAL: " + passed + " of " + total + " passed");
+}, 1000);
@@ -0,0 +1,64 @@
+// Copyright (c) 2016, Intel Corporation.
+
+// Timer drift test, run with: jslinux --virtual-time tests/test-timers-drift.js
+// Runs a 1.5 ms interval 10,000 times. The loop only waits whole ms, so every
+// other tick fires 0.5 ms late, like on a busy loop; the interval must stay on
+// its original schedule anyway, rather than add up the lateness of each tick
+
+var performance = require("performance");
+
+var total = 0;
+var passed = 0;
+function assert(actual, description) {
+    total += 1;
+    var label = "\033[1m\033[31mFAIL\033[0m";
+    if (actual === true) {
+        passed += 1;
+        label = "\033[1m\033[32mPASS\033[0m";
+    }
+    console.log(label + " - " + description);
+}
+
+var ITERATIONS = 10000;
+var INTERVAL = 1.5;
+
+var count = 0;
+var maxLate = 0;
+var start = performance.now();
+var timer = setInterval(function () {
+    count++;
+    // how far this tick is behind where the schedule says it should be
+    var late = performance.now() - (start + count * INTERVAL);
+    if (late > maxLate) {
+        maxLate = late;
+    }
+    if (count === ITERATIONS) {
+        clearInterval(timer);
+        console.log("drift after " + ITERATIONS + " iterations: " + late +
+                    " ms, worst tick: " + maxLate + " ms");
+        // the virtual clock makes this exact: no tick is later than the
+        //   wakeup it waited for, so any more than that is accumulated drift
+        assert(maxLate < 1, "setInterval: no cumulative drift");
+        console.log("TOTAL: " + passed + " of " + total + " passed");
+    }
+}, INTERVAL);
+timer.setMissedTickPolicy("catchup");
+
+// the other policies are accepted, unknown ones are not
+var policies = setInterval(function () {}, 1000);
+var threw = false;
+try {
+    policies.setMissedTickPolicy("skip");
+    policies.setMissedTickPolicy("coalesce");
+} catch (e) {
+    threw = true;
+}
+assert(!threw, "setMissedTickPolicy: skip and coalesce");
+threw = false;
+try {
+    policies.setMissedTickPolicy("sometimes");
+} catch (e) {
+    threw = true;
+}
+assert(threw, "setMissedTickPolicy: unknown policy throws");
+clearInterval(policies);
@@ -0,0 +1,40 @@
+// Copyright (c) 2016, Intel Corporation.
+
+// Virtual time test, run with: jslinux --virtual-time tests/test-timers-virtual.js
+// An hour of 10 minute intervals should finish right away, with every tick
+// exactly on time since the clock only moves while the loop is idle
+
+var performance = require("performance");
+
+var total = 0;
+var passed = 0;
+function assert(actual, description) {
+    total += 1;
+    var label = "\033[1m\033[31mFAIL\033[0m";
+    if (actual === true) {
+        passed += 1;
+        label = "\033[1m\033[32mPASS\033[0m";
+    }
+    console.log(label + " - " + description);
+}
+
+var INTERVAL = 10 * 60 * 1000;
+
+var ticks = 0;
+var onTime = true;
+var start = performance.now();
+var id = setInterval(function () {
+    ticks++;
+    if (performance.now() - start !== ticks * INTERVAL) {
+        onTime = false;
+    }
+    if (ticks === 6) {
+        clearInterval(id);
+        assert(onTime, "virtual time: intervals fire exactly on time");
+    }
+}, INTERVAL);
+
+setTimeout(function () {
+    assert(ticks === 6, "virtual time: an hour passes");
+    console.log("TOTAL: " + passed + " of " + total + " passed");
+}, 6 * INTERVAL + 1);
@@ -101,6 +101,35 @@ expectThrow("clearTimeout: timeoutID does not exist", function () {
     clearTimeout(NotExistedTimeoutID);
 });
 
+// test setImmediate and clearImmediate
+var immediateOrder = "";
+setTimeout(function () {
+    immediateOrder += "t";
+}, 0);
+setImmediate(function (arg1, arg2, arg3, arg4) {
+    immediateOrder += "a";
+    assert(arg1 === 1 && arg2 === "b" && arg3 === null && arg4 === 4,
+           "setImmediate: optional args");
+    setImmediate(function () {
+        immediateOrder += "c";
+    });
+}, 1, "b", null, 4);
+setImmediate(function () {
+    immediateOrder += "b";
+});
+var testImmediateID = setImmediate(function () {
+    immediateOrder += "x";
+});
+clearImmediate(testImmediateID);
+
+setTimeout(function () {
+    assert(immediateOrder.indexOf("ab") === 0 &&
+           immediateOrder.indexOf("c") > 0,
+           "setImmediate: called in order, before timers");
+    assert(immediateOrder.indexOf("x") === -1,
+           "clearImmediate: immediateID");
+}, 100);
+
 setTimeout(function () {
     console.log("TOTAL: " + passed + " of " + total + " passed");
 }, 2000);